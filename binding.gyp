@@ -9,6 +9,28 @@
             "cflags_cc!": [ "-fno-exceptions" ],
             "sources": [
                 "src/gamebryosavegame.cpp",
+                "src/screenshot.cpp",
+                "src/fileregion.cpp",
+                "src/bufferpool.cpp",
+                "src/scratchbuffer.cpp",
+                "src/sharedcache.cpp",
+                "src/thumbnails.cpp",
+                "src/imageops.cpp",
+                "src/atlas.cpp",
+                "src/threadpool.cpp",
+                "src/readscheduler.cpp",
+                "src/memorypressure.cpp",
+                "src/slowlog.cpp",
+                "src/resultdelivery.cpp",
+                "src/savebody.cpp",
+                "src/formids.cpp",
+                "src/fingerprint.cpp",
+                "src/streamcodec.cpp",
+                "src/recompress.cpp",
+                "src/fileops.cpp",
+                "src/rewrite.cpp",
+                "src/chunkeddecoder.cpp",
+                "src/cpudispatch.cpp",
                 "src/fmt/format.cc"
             ],
             "include_dirs": [
@@ -9,14 +9,445 @@ export interface GamebryoSaveGame {
   characterLevel: number;
   location: string;
   saveNumber: number;
+  // only the header fields are read from Starfield saves, plugins and the fingerprints throw
+  // "not supported for this game" for those, as do the methods reading from the body
   plugins: string[];
+  // 64-bit fingerprints of the plugin list (case-insensitive) as 16 digit hex strings. The load order
+  // fingerprint changes with the order of plugins, the plugin set fingerprint doesn't
+  loadOrderFingerprint: string;
+  pluginSetFingerprint: string;
   creationTime: number;
   fileName: string;
   screenshotSize: Dimensions;
   playTime: string;
   getScreenshot?: () => any;
+  // decode the screenshot into an existing buffer at the specified byte offset, returns the number of bytes written
+  readScreenshotInto?: (target: Uint8Array, offset?: number) => number;
+  // number of bytes serializeInto will write
+  serializedSize?: () => number;
+  // write all fields and the screenshot into the target (which may be a view of a SharedArrayBuffer)
+  // at the specified byte offset, returns the number of bytes written. See ISerializedSave for the layout
+  serializeInto?: (target: Uint8Array, offset?: number) => number;
+  // decode all change form records (Skyrim, Skyrim SE and Fallout 4 only)
+  readChangeForms?: (callback: (err: Error, forms: IChangeForms) => void) => void;
+  // accessors for the global data tables (Skyrim, Skyrim SE and Fallout 4 only). These only decode as much
+  // of the body as necessary, results are cached. Called without a callback they block until that is done,
+  // with one they read on the thread pool and pass the result to the callback.
+  // All return (or pass) undefined if the save doesn't contain the requested data
+  getGlobalData?: {
+    (type: number): Buffer;
+    (type: number, callback: (err: Error, data: Buffer) => void): void;
+  };
+  getMiscStats?: {
+    (): IMiscStat[];
+    (callback: (err: Error, stats: IMiscStat[]) => void): void;
+  };
+  getPlayerLocation?: {
+    (): IPlayerLocation;
+    (callback: (err: Error, location: IPlayerLocation) => void): void;
+  };
+  getGlobalVariables?: {
+    (): IGlobalVariable[];
+    (callback: (err: Error, variables: IGlobalVariable[]) => void): void;
+  };
+  getGameTime?: {
+    (): IGameTime;
+    (callback: (err: Error, time: IGameTime) => void): void;
+  };
+  getWeather?: {
+    (): IWeather;
+    (callback: (err: Error, weather: IWeather) => void): void;
+  };
+  // the form id array of the save (ref ids of type 0 index into this). The array is a view of data
+  // cached on the save object without copying it and must be treated as read-only. remapFormIds
+  // writes to a new array unless told otherwise, use ids.slice() for a modifiable copy
+  getFormIdArray?: {
+    (): Uint32Array;
+    (callback: (err: Error, ids: Uint32Array) => void): void;
+  };
+  // count the papyrus script instances per script. Scripts not in knownScripts (if set) or not
+  // defined in the save are flagged, their instances are orphaned
+  scanScripts?: (knownScripts: string[] | undefined, callback: (err: Error, scan: IScriptScan) => void) => void;
+  // write a copy of the save with the screenshot scaled down to fit maxWidth x maxHeight, or removed
+  // if either is 0. The rest of the file is copied unchanged. Since offsets inside the body don't get
+  // adjusted, the copies are meant for archiving only and may not load in the game. Not supported for Morrowind
+  rewriteScreenshot?: (output: string, maxWidth: number, maxHeight: number,
+                       callback: (err: Error, result: IRewriteResult) => void) => void;
   screenshot?: any;
+  // how far a save returned by open() has been read. Accessors block until the data they return is available.
+  // If reading failed before that, they return empty values. Saves from the constructor are always complete,
+  // those from create() are complete unless they were passed to the callback along with an error
+  readyState?: 'reading' | 'header' | 'screenshot' | 'complete' | 'failed';
+  // restored from a shared cache entry of an older version of the file (see staleWhileRevalidate). The fields
+  // are those of the old version, methods reading from the file fail. An up to date copy is passed to the
+  // onUpdate callback once it has been read
+  stale?: boolean;
+  // where reading failed, if it failed after the header. Fields of the failed section and those after it are empty
+  parseError?: IParseError;
+  // resolves once the specified part has been read ('complete' by default, 'plugins' is the same).
+  // Rejects if reading fails before that
+  whenReady?: (phase?: 'header' | 'screenshot' | 'plugins' | 'complete') => Promise<GamebryoSaveGame>;
 }
 
+/**
+ * Result of readSerialized, decoded from the binary layout serializeInto writes.
+ * All numbers are little endian, offsets are relative to the start of the record:
+ *   0  char[4]  magic "GBSV"
+ *   4  uint32   layout version (1)
+ *   8  uint32   total size of the record in bytes
+ *  12  uint32   save number
+ *  16  uint32   creation time (seconds since the unix epoch)
+ *  20  uint32   character level
+ *  24  uint32   screenshot width
+ *  28  uint32   screenshot height
+ *  32  uint32   number of plugins
+ *  36  uint32   offset of the screenshot (16 byte aligned)
+ *  40  uint32   screenshot size in bytes
+ *  44  uint32   reserved
+ *  48  strings  character name, location, play time, file name, then one per plugin.
+ *               Each is a uint32 byte length followed by that many bytes of utf-8
+ *  ... rgba pixels of the screenshot
+ */
+export interface ISerializedSave {
+  characterName: string;
+  characterLevel: number;
+  location: string;
+  saveNumber: number;
+  plugins: string[];
+  creationTime: number;
+  fileName: string;
+  screenshotSize: Dimensions;
+  playTime: string;
+  // view of the pixels inside the source buffer, not a copy
+  screenshot: Uint8Array;
+  // bytes the record occupies in the source buffer
+  byteLength: number;
+}
+
+export function readSerialized(source: Uint8Array, offset?: number): ISerializedSave;
+
+export interface IMiscStat {
+  name: string;
+  category: number;
+  value: number;
+}
+
+// ref ids are the 24-bit values as stored in the save, the upper two bits are the ref id type
+export interface IPlayerLocation {
+  nextObjectId: number;
+  worldSpace1: number;
+  coorX: number;
+  coorY: number;
+  worldSpace2: number;
+  x: number;
+  y: number;
+  z: number;
+}
+
+export interface IGlobalVariable {
+  refId: number;
+  value: number;
+}
+
+export interface IGameTime {
+  year?: number;
+  month?: number;
+  day?: number;
+  hour?: number;
+  daysPassed?: number;
+  timeScale?: number;
+}
+
+export interface IWeather {
+  climate: number;
+  weather: number;
+  previousWeather: number;
+  unknownWeather1: number;
+  unknownWeather2: number;
+  regionWeather: number;
+  currentTime: number;
+  beginTime: number;
+  weatherPercent: number;
+}
+
+export interface IRewriteResult {
+  // dimensions of the screenshot in the copy
+  width: number;
+  height: number;
+  inputSize: number;
+  outputSize: number;
+}
+
+export interface IScriptUsage {
+  name: string;
+  instances: number;
+  // the save has instances of this script but no definition
+  undefined: boolean;
+  // not in the list of known scripts
+  missing: boolean;
+}
+
+export interface IScriptScan {
+  instanceCount: number;
+  orphanedCount: number;
+  scripts: IScriptUsage[];
+}
+
+/**
+ * Change form records of a save as parallel arrays, in the order they appear in the file
+ */
+export interface IChangeForms {
+  count: number;
+  // 24-bit ref ids as stored in the file, the upper two bits are the ref id type
+  refIds: Uint32Array;
+  changeFlags: Uint32Array;
+  types: Uint8Array;
+  versions: Uint8Array;
+  // the (decompressed) data of record i is data.subarray(offsets[i], offsets[i + 1])
+  offsets: Uint32Array;
+  data: Buffer;
+}
+
+export interface IAtlasRect {
+  x: number;
+  y: number;
+  width: number;
+  height: number;
+}
+
+export interface IAtlas {
+  // rgba pixels, width * height * 4 bytes
+  atlas: Buffer;
+  width: number;
+  height: number;
+  // one entry per save, in the order they were passed in. width and height are 0 for saves without screenshot
+  rects: IAtlasRect[];
+}
+
+export interface IConfigureOptions {
+  // "raw" keeps screenshots in memory as is, "compressed" keeps them lz4 compressed and
+  // decodes them when requested
+  screenshotRetention?: 'raw' | 'compressed';
+  // number of decoded screenshots to keep around when using compressed retention
+  screenshotCacheSize?: number;
+  // for formats that store the screenshot as uncompressed rgba (Fallout 4, Skyrim SE), skip the
+  // pixels while parsing and only read them from the file once the screenshot is used. This defers
+  // the load (the pixels are still copied into memory once), the file isn't memory mapped. Loading
+  // fails if the file changed (size or modification time) in the meantime
+  mapScreenshots?: boolean;
+  // number of bytes idle pixel buffers may occupy to be reused between saves. 0 disables pooling
+  bufferPoolSize?: number;
+  // maximum number of bytes all decompressed save bodies may occupy in memory together. Bodies that
+  // don't fit are decompressed into temporary files mapped back into memory instead. 0 (the default)
+  // means no limit
+  decompressMemoryLimit?: number;
+  // where to put those temporary files. Should be on disk, not a tmpfs. Defaults to TMPDIR or /var/tmp,
+  // the user temp directory on windows
+  scratchDirectory?: string;
+  // path of a cache file shared by all processes using this module. Saves found in it (same path,
+  // size and modification time) don't have to be parsed again. An empty string disables the cache
+  sharedCache?: string;
+  // size of the cache file in bytes and of each entry in it. These only apply when the file is created.
+  // Entries (lz4 compressed, including the screenshot) that don't fit a slot are not cached
+  sharedCacheSize?: number;
+  sharedCacheSlotSize?: number;
+  // if the shared cache has an entry for a save but size or modification time changed (e.g. cloud sync
+  // touched the file), return the cached result right away flagged as stale and read the save again in
+  // the background, after other pending reads. See onUpdate. Off by default
+  staleWhileRevalidate?: boolean;
+  // directory to keep png thumbnails of all saves read in full in. Thumbnails are stored by
+  // the hash of their pixels and written in batches in the background. An empty string disables the store
+  thumbnailDirectory?: string;
+  // thumbnails are scaled down to fit a square of this size (256 by default)
+  thumbnailSize?: number;
+  // number of saves read in parallel (create, recompressBatch). 0 (the default) adapts the number at
+  // runtime to what the storage handles best, see getStats
+  readConcurrency?: number;
+  // upper bound for the adaptive read concurrency
+  maxReadConcurrency?: number;
+  // maximum number of callbacks (create, createAtlas, recompress, ...) run per turn of the event loop.
+  // Remaining ones run in the next turn so a large batch of results doesn't block the ui. Defaults to 32
+  deliveryBatchSize?: number;
+  // parses taking at least this many milliseconds get recorded in the slow log, see getSlowLog.
+  // 0 (the default) disables the log
+  slowLogThreshold?: number;
+  // number of entries the slow log keeps, older ones get dropped. Defaults to 100
+  slowLogSize?: number;
+  // free caches and pools automatically when the system runs low on memory (see trim). On by default
+  trimOnMemoryPressure?: boolean;
+  // instruction sets used for image conversion, downscaling and string checks. Defaults to the best the
+  // cpu supports ('auto'), can be lowered to compare performance. Levels the cpu lacks are an error
+  cpuLevel?: CpuLevel | 'auto';
+}
+
+export function configure(options: IConfigureOptions): void;
+
+export interface IReadStats {
+  // number of reads allowed in parallel right now and why
+  limit: number;
+  maxLimit: number;
+  adaptive: boolean;
+  reason: string;
+  inFlight: number;
+  queued: number;
+  // stale saves waiting to be read again
+  queuedBackground: number;
+  completed: number;
+  // measured over the last window (about a second): reads completed per second, average time
+  // to read a save and average time saves waited for their turn
+  throughput: number;
+  latencyMs: number;
+  queueMs: number;
+}
+
+// bytes freed by a trim
+export interface ITrimResult {
+  screenshotCache: number;
+  bufferPool: number;
+  // zlib state kept by the threads decompressing change forms
+  inflaters: number;
+  total: number;
+}
+
+export interface IMemoryStats {
+  // how memory pressure is detected: psi (linux), the memory.pressure or memory.events of the cgroup
+  // (linux, if system wide psi isn't available), the low memory notification (windows) or not at all
+  monitor: 'psi' | 'cgroup-psi' | 'cgroup-events' | 'windows' | 'none';
+  pressureEvents: number;
+  // automatic and manual ones
+  trims: number;
+  freedTotal: number;
+  lastTrim: ITrimResult;
+}
+
+export type CpuLevel = 'scalar' | 'sse2' | 'ssse3' | 'avx2' | 'avx512' | 'neon';
+
+export interface ICpuStats {
+  // best level the cpu supports and the one in use (see cpuLevel)
+  detected: CpuLevel;
+  active: CpuLevel;
+}
+
+export interface IStats {
+  reads: IReadStats;
+  memory: IMemoryStats;
+  cpu: ICpuStats;
+}
+
+export function getStats(): IStats;
+
+/**
+ * free the memory held by caches (decoded screenshots) and pools (idle buffers, decompression state)
+ * right away, as happens automatically under memory pressure. Memory in use isn't affected
+ */
+export function trim(): ITrimResult;
+
+export interface ISlowParse {
+  path: string;
+  fileSize: number;
+  // when the parse ended, milliseconds since the unix epoch
+  time: number;
+  game: 'morrowind' | 'oblivion' | 'starfield' | 'skyrim' | 'skyrimse' | 'fallout3' | 'fallout4' | 'unknown';
+  compression: 'none' | 'zlib' | 'lz4';
+  quick: boolean;
+  // restored from the shared cache, all the time is counted as openMs then
+  cached: boolean;
+  // set if the parse failed. The part it failed in gets the time until then
+  error?: string;
+  // time spent per part of the file. Parts that weren't read (the screenshot in quick reads) are 0.
+  // decompressMs is included in pluginsMs. Storing the result in the shared cache and thumbnail store
+  // is only included in totalMs
+  totalMs: number;
+  openMs: number;
+  headerMs: number;
+  imageMs: number;
+  decompressMs: number;
+  pluginsMs: number;
+}
+
+/**
+ * the parses recorded in the slow log, oldest first. Empties the log if clear is set
+ */
+export function getSlowLog(clear?: boolean): ISlowParse[];
+
+/**
+ * returns the save right away and reads it in the background. The header fields (name, level,
+ * location, save number, play time) become available first, then the screenshot, then everything else
+ */
+export function open(filePath: string, quick: boolean): GamebryoSaveGame;
+
+export interface IParseError {
+  // the part of the file that couldn't be read: 'screenshot' or 'plugins' (which includes everything after
+  // the screenshot)
+  section: 'screenshot' | 'plugins';
+  // byte offset of the problem. If compressed is set, this is an offset into the decompressed body
+  offset: number;
+  compressed: boolean;
+  message: string;
+}
+
+/**
+ * set the function called when a stale save (see staleWhileRevalidate) has been read again, with the
+ * up to date save or the error reading it failed with. Replaces the previous callback, undefined removes it
+ */
+export function onUpdate(callback?: (err: Error, filePath: string, save?: GamebryoSaveGame) => void): void;
+
+/**
+ * read a save in the background. If reading fails after the header, the callback receives the error (with
+ * section and offset properties as in IParseError) together with the partially read save
+ */
+export function create(filePath: string, quick: boolean, callback: (err: Error, save?: GamebryoSaveGame) => void): void;
+
+/**
+ * fingerprints of a plugin list (i.e. the current profile) comparable to those of save games
+ */
+export function fingerprintPlugins(plugins: string[]): { loadOrder: string, pluginSet: string };
+
+/**
+ * thumbnail of a save (png) from the thumbnail store, without opening the save.
+ * undefined if there is none or the save changed since
+ */
+export function getThumbnail(filePath: string): Buffer;
+
+/**
+ * path of the thumbnail of a save in the thumbnail store, undefined if there is none
+ */
+export function getThumbnailPath(filePath: string): string;
+
+export function createAtlas(saves: GamebryoSaveGame[], cellWidth: number, cellHeight: number,
+                            callback: (err: Error, atlas: IAtlas) => void): void;
+
+/**
+ * rewrite the plugin index (upper byte) of each form id in ids.
+ * map contains the new index for each of the 256 old ones.
+ * If lightMap (4096 entries) is set, ids in the FE space get their light plugin index
+ * (bits 12-23) replaced through it instead.
+ * The result is written to output (same length as ids, may be ids itself to remap in place) or,
+ * if that isn't set, to a new array. ids isn't modified then, so it may be the read-only array
+ * from getFormIdArray. Returns the array written to
+ */
+export function remapFormIds(ids: Uint32Array, map: Uint8Array, lightMap?: Uint16Array,
+                             output?: Uint32Array): Uint32Array;
+
+export interface IRecompressResult {
+  // compression of the body before conversion
+  sourceCompression?: 'none' | 'zlib' | 'lz4';
+  inputSize?: number;
+  outputSize?: number;
+  // only set in batch results, if this file failed
+  error?: string;
+}
+
+/**
+ * rewrite a Skyrim SE save with its body compressed in a different format. LZ4 saves load
+ * considerably faster. input and output may be the same file
+ */
+export function recompress(input: string, output: string, compression: 'zlib' | 'lz4',
+                           callback: (err: Error, result: IRecompressResult) => void): void;
 
-export function create(filePath: string, quick: boolean, callback: (err: Error, save: GamebryoSaveGame) => void): void;
+/**
+ * recompress multiple saves in parallel. The callback receives one result per job, in order,
+ * errors for individual files are reported in their result
+ */
+export function recompressBatch(jobs: Array<{ input: string, output: string }>, compression: 'zlib' | 'lz4',
+                                callback: (err: Error, results: IRecompressResult[]) => void): void;
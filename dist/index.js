@@ -1,3 +1,53 @@
 Object.defineProperty(exports, "__esModule", { value: true });
 
-module.exports = require('./GamebryoSave');
+const native = require('./GamebryoSave');
+
+// decode a save written by serializeInto. Works on views of SharedArrayBuffers so workers
+// can hand over parse results without the screenshot being copied
+function readSerialized(source, offset) {
+  offset = offset || 0;
+  const base = source.byteOffset + offset;
+  const view = new DataView(source.buffer, base);
+
+  const magic = String.fromCharCode(view.getUint8(0), view.getUint8(1), view.getUint8(2), view.getUint8(3));
+  if (magic !== 'GBSV') {
+    throw new Error('not a serialized save game');
+  }
+  if (view.getUint32(4, true) !== 1) {
+    throw new Error('unsupported serialization version ' + view.getUint32(4, true));
+  }
+
+  let pos = 48;
+  const readString = () => {
+    const length = view.getUint32(pos, true);
+    const result = Buffer.from(source.buffer, base + pos + 4, length).toString('utf8');
+    pos += 4 + length;
+    return result;
+  };
+
+  const characterName = readString();
+  const location = readString();
+  const playTime = readString();
+  const fileName = readString();
+  const pluginCount = view.getUint32(32, true);
+  const plugins = [];
+  for (let i = 0; i < pluginCount; ++i) {
+    plugins.push(readString());
+  }
+
+  return {
+    characterName,
+    characterLevel: view.getUint32(20, true),
+    location,
+    saveNumber: view.getUint32(12, true),
+    plugins,
+    creationTime: view.getUint32(16, true),
+    fileName,
+    screenshotSize: { width: view.getUint32(24, true), height: view.getUint32(28, true) },
+    playTime,
+    screenshot: new Uint8Array(source.buffer, base + view.getUint32(36, true), view.getUint32(40, true)),
+    byteLength: view.getUint32(8, true),
+  };
+}
+
+module.exports = Object.assign({}, native, { readSerialized });
@@ -0,0 +1,63 @@
+#include "atlas.h"
+#include "imageops.h"
+#include "screenshot.h"
+#include "threadpool.h"
+
+#include <algorithm>
+#include <cmath>
+#include <stdexcept>
+
+// keep the atlas within what a gpu can reasonably be expected to take as a texture
+static const uint32_t MAX_ATLAS_SIZE = 16384;
+
+Atlas buildAtlas(const std::vector<AtlasSource> &sources, uint32_t cellWidth, uint32_t cellHeight)
+{
+  if ((cellWidth == 0) || (cellHeight == 0)) {
+    throw std::runtime_error("invalid cell size");
+  }
+
+  Atlas result;
+  uint32_t count = static_cast<uint32_t>(sources.size());
+  uint32_t columns = (std::max)(1u, static_cast<uint32_t>(std::ceil(std::sqrt(static_cast<double>(count)))));
+  uint32_t rows = (std::max)(1u, (count + columns - 1) / columns);
+
+  if ((static_cast<uint64_t>(columns) * cellWidth > MAX_ATLAS_SIZE)
+      || (static_cast<uint64_t>(rows) * cellHeight > MAX_ATLAS_SIZE)) {
+    throw std::runtime_error("atlas too large, reduce the cell size or number of images");
+  }
+
+  result.width = columns * cellWidth;
+  result.height = rows * cellHeight;
+  result.pixels.resize(static_cast<size_t>(result.width) * result.height * 4, 0);
+  result.rects.resize(count);
+
+  for (uint32_t i = 0; i < count; ++i) {
+    const AtlasSource &source = sources[i];
+    AtlasRect &rect = result.rects[i];
+    if ((source.screenshot == nullptr)
+        || (source.screenshot->size() != static_cast<size_t>(source.width) * source.height * 4)) {
+      rect = AtlasRect{ 0, 0, 0, 0 };
+      continue;
+    }
+    fitInto(source.width, source.height, cellWidth, cellHeight, rect.width, rect.height);
+    rect.x = (i % columns) * cellWidth + (cellWidth - rect.width) / 2;
+    rect.y = (i / columns) * cellHeight + (cellHeight - rect.height) / 2;
+  }
+
+  ThreadPool::instance().parallelFor(count, [&](size_t idx) {
+    const AtlasSource &source = sources[idx];
+    const AtlasRect &rect = result.rects[idx];
+    if (rect.width == 0) {
+      return;
+    }
+
+    std::vector<uint8_t> decoded(source.screenshot->size());
+    source.screenshot->copyTo(decoded.data());
+
+    uint8_t *target = &result.pixels[(static_cast<size_t>(rect.y) * result.width + rect.x) * 4];
+    downscaleRGBA(decoded.data(), source.width, source.height,
+                  target, rect.width, rect.height, result.width * 4);
+  });
+
+  return result;
+}
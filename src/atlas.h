@@ -0,0 +1,32 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+class Screenshot;
+
+struct AtlasSource {
+  const Screenshot *screenshot;
+  uint32_t width;
+  uint32_t height;
+};
+
+/* area of the atlas an image was placed in. Empty if the source had no screenshot */
+struct AtlasRect {
+  uint32_t x;
+  uint32_t y;
+  uint32_t width;
+  uint32_t height;
+};
+
+struct Atlas {
+  uint32_t width;
+  uint32_t height;
+  std::vector<uint8_t> pixels;
+  std::vector<AtlasRect> rects;
+};
+
+/* pack downscaled versions of all the screenshots into a single rgba image, one grid cell
+ * per source in the order they were passed. Images keep their aspect ratio and are centered in their cell.
+ * The downscaling happens on the thread pool */
+Atlas buildAtlas(const std::vector<AtlasSource> &sources, uint32_t cellWidth, uint32_t cellHeight);
@@ -0,0 +1,77 @@
+#include "bufferpool.h"
+
+BufferPool &BufferPool::instance()
+{
+  static BufferPool s_Instance;
+  return s_Instance;
+}
+
+void BufferPool::setCapacity(size_t bytes)
+{
+  std::vector<std::vector<uint8_t>> dropped;
+  {
+    std::lock_guard<std::mutex> lock(m_Mutex);
+    m_Capacity = bytes;
+    while (m_IdleBytes > m_Capacity) {
+      m_IdleBytes -= m_Idle.back().capacity();
+      dropped.push_back(std::move(m_Idle.back()));
+      m_Idle.pop_back();
+    }
+  }
+  // dropped buffers get freed on the way out, outside the lock
+}
+
+std::vector<uint8_t> BufferPool::acquire(size_t size)
+{
+  std::vector<uint8_t> result;
+  {
+    std::lock_guard<std::mutex> lock(m_Mutex);
+    // the smallest buffer that fits, as long as it's no more than twice the size requested
+    size_t best = m_Idle.size();
+    for (size_t i = 0; i < m_Idle.size(); ++i) {
+      size_t cap = m_Idle[i].capacity();
+      if ((cap >= size) && (cap / 2 <= size)
+          && ((best == m_Idle.size()) || (cap < m_Idle[best].capacity()))) {
+        best = i;
+      }
+    }
+    if (best != m_Idle.size()) {
+      m_IdleBytes -= m_Idle[best].capacity();
+      result = std::move(m_Idle[best]);
+      m_Idle.erase(m_Idle.begin() + best);
+    }
+  }
+  result.resize(size);
+  return result;
+}
+
+void BufferPool::release(std::vector<uint8_t> &&buffer)
+{
+  if (buffer.capacity() == 0) {
+    return;
+  }
+
+  std::vector<uint8_t> temp(std::move(buffer));
+  {
+    std::lock_guard<std::mutex> lock(m_Mutex);
+    if (m_IdleBytes + temp.capacity() <= m_Capacity) {
+      m_IdleBytes += temp.capacity();
+      m_Idle.push_back(std::move(temp));
+      return;
+    }
+  }
+  // otherwise temp gets freed on the way out, outside the lock
+}
+
+size_t BufferPool::trim()
+{
+  std::vector<std::vector<uint8_t>> idle;
+  size_t result;
+  {
+    std::lock_guard<std::mutex> lock(m_Mutex);
+    idle.swap(m_Idle);
+    result = m_IdleBytes;
+    m_IdleBytes = 0;
+  }
+  return result;
+}
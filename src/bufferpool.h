@@ -0,0 +1,42 @@
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+#include <mutex>
+#include <vector>
+
+/**
+ * Process-wide pool of pixel buffers so that batch scans can recycle the memory for screenshots
+ * instead of allocating anew for every save.
+ * Buffers are only handed out for requests they fit without wasting more than half their capacity,
+ * since whoever acquires one (i.e. a screenshot) may hold on to it for a long time.
+ * Disabled (capacity 0) by default, in which case acquire/release are plain allocation/deallocation
+ */
+class BufferPool {
+public:
+  static BufferPool &instance();
+
+  /* maximum number of bytes idle buffers may occupy together */
+  void setCapacity(size_t bytes);
+
+  /* get a buffer of exactly the requested size. Content is unspecified */
+  std::vector<uint8_t> acquire(size_t size);
+
+  /* return a buffer to the pool. Does nothing if the pool is full */
+  void release(std::vector<uint8_t> &&buffer);
+
+  /* free all idle buffers, returns the number of bytes freed */
+  size_t trim();
+
+private:
+
+  BufferPool() : m_Capacity(0), m_IdleBytes(0) {}
+
+private:
+
+  std::mutex m_Mutex;
+  size_t m_Capacity;
+  size_t m_IdleBytes;
+  std::vector<std::vector<uint8_t>> m_Idle;
+
+};
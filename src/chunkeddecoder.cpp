@@ -0,0 +1,209 @@
+#include "chunkeddecoder.h"
+#include "threadpool.h"
+#include "fmt/format.h"
+
+#include <zlib.h>
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <limits>
+
+namespace {
+
+// sanity limits for the container header
+const uint64_t MAX_CHUNK_SIZE = 64 * 1024 * 1024;
+const uint64_t MAX_CHUNK_COUNT = 1024 * 1024;
+
+template <typename T> T readValue(IDecoder &source) {
+  T value;
+  if (!source.read(reinterpret_cast<char*>(&value), sizeof(T))) {
+    source.clear();
+    throw std::runtime_error("unexpected end of file in container header");
+  }
+  return value;
+}
+
+}
+
+ChunkedDecoder::ChunkedDecoder(const std::shared_ptr<IDecoder> &source, Codec codec, std::vector<Chunk> &&chunks,
+                               uint64_t chunkSize, uint64_t totalSize)
+  : m_Source(source)
+  , m_Codec(codec)
+  , m_Chunks(std::move(chunks))
+  , m_ChunkSize(static_cast<size_t>(chunkSize))
+  , m_Size(static_cast<size_t>(totalSize))
+  , m_Data(m_Chunks.size())
+  , m_Pos(0)
+  , m_Failed(false)
+  , m_DecodeTime(0.0)
+{
+  if ((m_ChunkSize == 0) || ((totalSize + chunkSize - 1) / chunkSize != m_Chunks.size())) {
+    throw std::runtime_error("chunk table doesn't match the data size");
+  }
+}
+
+std::shared_ptr<ChunkedDecoder> ChunkedDecoder::openBCPS(const std::shared_ptr<IDecoder> &source)
+{
+  readValue<uint32_t>(*source); // version
+  uint64_t chunkTableOffset = readValue<uint64_t>(*source);
+  readValue<uint64_t>(*source);
+  uint64_t dataOffset = readValue<uint64_t>(*source);
+  uint64_t totalSize = readValue<uint64_t>(*source);
+  readValue<float>(*source);    // version of the content
+  readValue<uint32_t>(*source);
+  uint64_t chunkSize = readValue<uint64_t>(*source);
+  uint64_t alignment = readValue<uint64_t>(*source);
+  readValue<uint32_t>(*source);
+  char compression[4];
+  if (!source->read(compression, sizeof(compression))) {
+    source->clear();
+    throw std::runtime_error("unexpected end of file in container header");
+  }
+
+  Codec codec;
+  if (memcmp(compression, "ZIP ", 4) == 0) {
+    codec = Codec::ZLIB;
+  } else if (memcmp(compression, "NONE", 4) == 0) {
+    codec = Codec::STORED;
+  } else {
+    throw std::runtime_error(fmt::format("unsupported chunk compression \"{}\"", std::string(compression, 4)));
+  }
+
+  if ((chunkSize == 0) || (chunkSize > MAX_CHUNK_SIZE)
+      || ((totalSize + chunkSize - 1) / chunkSize > MAX_CHUNK_COUNT)
+      || (totalSize > (std::numeric_limits<size_t>::max)())) {
+    throw std::runtime_error("invalid chunk size");
+  }
+  if (alignment == 0) {
+    alignment = 1;
+  }
+
+  size_t count = static_cast<size_t>((totalSize + chunkSize - 1) / chunkSize);
+  if (!source->seek(static_cast<size_t>(chunkTableOffset))) {
+    source->clear();
+    throw std::runtime_error("invalid chunk table offset");
+  }
+  std::vector<Chunk> chunks(count);
+  uint64_t offset = dataOffset;
+  for (Chunk &chunk : chunks) {
+    chunk.offset = offset;
+    chunk.compressedSize = readValue<uint32_t>(*source);
+    // every chunk starts aligned
+    offset = (offset + chunk.compressedSize + alignment - 1) / alignment * alignment;
+  }
+
+  return std::make_shared<ChunkedDecoder>(source, codec, std::move(chunks), chunkSize, totalSize);
+}
+
+size_t ChunkedDecoder::tell()
+{
+  return m_Pos;
+}
+
+bool ChunkedDecoder::seek(size_t offset, std::ios_base::seekdir dir)
+{
+  size_t target = offset;
+  if (dir == std::ios::cur) {
+    target = m_Pos + offset;
+  } else if (dir == std::ios::end) {
+    target = m_Size + offset;
+  }
+  if (m_Failed || (target > m_Size)) {
+    m_Failed = true;
+    return false;
+  }
+  m_Pos = target;
+  return true;
+}
+
+bool ChunkedDecoder::read(char *buffer, size_t size)
+{
+  if (m_Failed || (size > m_Size - m_Pos)) {
+    m_Failed = true;
+    return false;
+  }
+  decode(m_Pos, m_Pos + size);
+  while (size > 0) {
+    size_t idx = m_Pos / m_ChunkSize;
+    size_t inChunk = m_Pos % m_ChunkSize;
+    size_t length = (std::min)(size, chunkLength(idx) - inChunk);
+    memcpy(buffer, m_Data[idx]->data() + inChunk, length);
+    buffer += length;
+    m_Pos += length;
+    size -= length;
+  }
+  return true;
+}
+
+void ChunkedDecoder::clear()
+{
+  m_Failed = false;
+}
+
+void ChunkedDecoder::prefetch(size_t offset, size_t size)
+{
+  size_t begin = (std::min)(offset, m_Size);
+  decode(begin, begin + (std::min)(size, m_Size - begin));
+}
+
+size_t ChunkedDecoder::chunkLength(size_t idx) const
+{
+  return (std::min)(m_ChunkSize, m_Size - idx * m_ChunkSize);
+}
+
+void ChunkedDecoder::decode(size_t begin, size_t end)
+{
+  if (begin >= end) {
+    return;
+  }
+
+  std::vector<size_t> missing;
+  for (size_t idx = begin / m_ChunkSize; idx <= (end - 1) / m_ChunkSize; ++idx) {
+    if (!m_Data[idx]) {
+      missing.push_back(idx);
+    }
+  }
+  if (missing.empty()) {
+    return;
+  }
+
+  auto start = std::chrono::steady_clock::now();
+
+  // the source can only be read from one thread, in order. The compressed data is only needed
+  // during this call so it stays out of the buffer pool
+  std::vector<std::vector<uint8_t>> compressed(missing.size());
+  std::vector<std::unique_ptr<ScratchBuffer>> decoded(missing.size());
+  for (size_t i = 0; i < missing.size(); ++i) {
+    const Chunk &chunk = m_Chunks[missing[i]];
+    compressed[i].resize(chunk.compressedSize);
+    decoded[i].reset(new ScratchBuffer(chunkLength(missing[i])));
+    if (!m_Source->seek(static_cast<size_t>(chunk.offset))
+        || !m_Source->read(reinterpret_cast<char*>(compressed[i].data()), chunk.compressedSize)) {
+      m_Source->clear();
+      throw std::runtime_error("unexpected end of file in compressed data");
+    }
+  }
+
+  ThreadPool::instance().parallelFor(missing.size(), [&](size_t i) {
+    size_t size = decoded[i]->size();
+    uint8_t *target = decoded[i]->data();
+    if (m_Codec == Codec::STORED) {
+      if (compressed[i].size() != size) {
+        throw std::runtime_error("invalid stored chunk");
+      }
+      memcpy(target, compressed[i].data(), size);
+      return;
+    }
+    uLongf length = static_cast<uLongf>(size);
+    int res = uncompress(target, &length, compressed[i].data(), static_cast<uLong>(compressed[i].size()));
+    if ((res != Z_OK) || (length != size)) {
+      throw std::runtime_error(fmt::format("failed to decompress chunk {}", missing[i]));
+    }
+  });
+
+  for (size_t i = 0; i < missing.size(); ++i) {
+    m_Data[missing[i]] = std::move(decoded[i]);
+  }
+
+  m_DecodeTime += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
@@ -0,0 +1,68 @@
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+#include "decoder.h"
+#include "scratchbuffer.h"
+
+/**
+ * One logical stream over a container of independently compressed chunks, like the BCPS container
+ * Starfield saves come in. Chunks get allocated and decompressed only once a read reaches them.
+ * The compressed data is read from the source in order on the calling thread, the chunks a read
+ * (or prefetch) needs are then decompressed in parallel on the thread pool
+ */
+class ChunkedDecoder : public IDecoder {
+public:
+  enum class Codec {
+    STORED,
+    ZLIB,
+  };
+
+  struct Chunk {
+    // position of the compressed data in the source
+    uint64_t offset;
+    uint32_t compressedSize;
+  };
+
+  /* all chunks decompress to chunkSize bytes except the last, which holds the rest of totalSize */
+  ChunkedDecoder(const std::shared_ptr<IDecoder> &source, Codec codec, std::vector<Chunk> &&chunks,
+                 uint64_t chunkSize, uint64_t totalSize);
+
+  /* read the chunk table of a BCPS container. The source has to be positioned right after the magic */
+  static std::shared_ptr<ChunkedDecoder> openBCPS(const std::shared_ptr<IDecoder> &source);
+
+  virtual size_t tell();
+  virtual bool seek(size_t offset, std::ios_base::seekdir dir = std::ios::beg);
+  virtual bool read(char *buffer, size_t size);
+  virtual void clear();
+
+  /* decompress the chunks covering a range ahead of reading it, so they get decompressed in parallel */
+  void prefetch(size_t offset, size_t size);
+
+  /* seconds spent decompressing so far */
+  double decodeTime() const { return m_DecodeTime; }
+
+private:
+
+  /* decompress the chunks covering [begin, end) that haven't been yet */
+  void decode(size_t begin, size_t end);
+
+  /* uncompressed size of a chunk */
+  size_t chunkLength(size_t idx) const;
+
+private:
+
+  std::shared_ptr<IDecoder> m_Source;
+  Codec m_Codec;
+  std::vector<Chunk> m_Chunks;
+  size_t m_ChunkSize;
+  size_t m_Size;
+  // decompressed data per chunk, nullptr until a read reaches it
+  std::vector<std::unique_ptr<ScratchBuffer>> m_Data;
+  size_t m_Pos;
+  bool m_Failed;
+  double m_DecodeTime;
+
+};
@@ -0,0 +1,445 @@
+#include "cpudispatch.h"
+
+#include <atomic>
+#include <mutex>
+#include <stdexcept>
+
+#include "fmt/format.h"
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#define CPU_X86
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#else
+#include <cpuid.h>
+#endif
+#elif defined(__aarch64__) || defined(_M_ARM64)
+#define CPU_NEON
+#include <arm_neon.h>
+#endif
+
+// gcc and clang only allow intrinsics of instruction sets enabled for the function using them,
+// msvc allows all of them anywhere
+#if defined(_MSC_VER) && !defined(__clang__)
+#define TARGET(isa)
+#else
+#define TARGET(isa) __attribute__((target(isa)))
+#endif
+
+namespace {
+
+const uint32_t OPAQUE = 0xFF000000;
+
+void expandRGBScalar(const uint8_t *in, uint8_t *out, size_t pixels) {
+  const uint8_t *end = in + pixels * 3;
+  for (; in < end; in += 3, out += 4) {
+    out[0] = in[0];
+    out[1] = in[1];
+    out[2] = in[2];
+    out[3] = 0xFF;
+  }
+}
+
+void convertBGRXScalar(uint8_t *pixels, size_t count) {
+  uint8_t *end = pixels + count * 4;
+  for (; pixels < end; pixels += 4) {
+    uint8_t temp = pixels[0];
+    pixels[0] = pixels[2];
+    pixels[2] = temp;
+    pixels[3] = 0xFF;
+  }
+}
+
+bool isASCIIScalar(const char *data, size_t size) {
+  uint8_t acc = 0;
+  for (size_t i = 0; i < size; ++i) {
+    acc |= static_cast<uint8_t>(data[i]);
+  }
+  return acc < 0x80;
+}
+
+void sumRGBAScalar(const uint8_t *in, size_t pixels, uint32_t sum[4]) {
+  const uint8_t *end = in + pixels * 4;
+  for (; in < end; in += 4) {
+    sum[0] += in[0];
+    sum[1] += in[1];
+    sum[2] += in[2];
+    sum[3] += in[3];
+  }
+}
+
+void remapFormIdsScalar(const uint32_t *in, uint32_t *out, size_t count,
+                        const uint32_t *__restrict table, const uint32_t *__restrict lightTable) {
+  if (lightTable == nullptr) {
+    for (size_t i = 0; i < count; ++i) {
+      uint32_t id = in[i];
+      out[i] = table[id >> 24] | (id & 0xFFFFFF);
+    }
+    return;
+  }
+  for (size_t i = 0; i < count; ++i) {
+    uint32_t id = in[i];
+    out[i] = ((id >> 24) == 0xFE) ? (lightTable[(id >> 12) & 0xFFF] | (id & 0xFFF))
+                                  : (table[id >> 24] | (id & 0xFFFFFF));
+  }
+}
+
+#ifdef CPU_X86
+
+TARGET("sse2") bool isASCIISSE2(const char *data, size_t size) {
+  __m128i acc = _mm_setzero_si128();
+  size_t i = 0;
+  for (; i + 16 <= size; i += 16) {
+    acc = _mm_or_si128(acc, _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + i)));
+  }
+  return (_mm_movemask_epi8(acc) == 0) && isASCIIScalar(data + i, size - i);
+}
+
+TARGET("sse2") void sumRGBASSE2(const uint8_t *in, size_t pixels, uint32_t sum[4]) {
+  const __m128i zero = _mm_setzero_si128();
+  __m128i acc = zero;
+  size_t i = 0;
+  for (; i + 4 <= pixels; i += 4) {
+    __m128i block = _mm_loadu_si128(reinterpret_cast<const __m128i*>(in + i * 4));
+    // 16 bit sums of pixels 0+2 and 1+3, then those added up as 32 bit
+    __m128i pairs = _mm_add_epi16(_mm_unpacklo_epi8(block, zero), _mm_unpackhi_epi8(block, zero));
+    acc = _mm_add_epi32(acc, _mm_add_epi32(_mm_unpacklo_epi16(pairs, zero), _mm_unpackhi_epi16(pairs, zero)));
+  }
+  uint32_t lanes[4];
+  _mm_storeu_si128(reinterpret_cast<__m128i*>(lanes), acc);
+  for (int c = 0; c < 4; ++c) {
+    sum[c] += lanes[c];
+  }
+  sumRGBAScalar(in + i * 4, pixels - i, sum);
+}
+
+TARGET("ssse3") void expandRGBSSSE3(const uint8_t *in, uint8_t *out, size_t pixels) {
+  const __m128i spread = _mm_setr_epi8(0, 1, 2, -1, 3, 4, 5, -1, 6, 7, 8, -1, 9, 10, 11, -1);
+  const __m128i alpha = _mm_set1_epi32(static_cast<int>(OPAQUE));
+  size_t i = 0;
+  // 16 pixels are exactly three loads, so this never reads past the input
+  for (; i + 16 <= pixels; i += 16, in += 48, out += 64) {
+    __m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i*>(in));
+    __m128i b = _mm_loadu_si128(reinterpret_cast<const __m128i*>(in + 16));
+    __m128i c = _mm_loadu_si128(reinterpret_cast<const __m128i*>(in + 32));
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(out),
+                     _mm_or_si128(_mm_shuffle_epi8(a, spread), alpha));
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(out + 16),
+                     _mm_or_si128(_mm_shuffle_epi8(_mm_alignr_epi8(b, a, 12), spread), alpha));
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(out + 32),
+                     _mm_or_si128(_mm_shuffle_epi8(_mm_alignr_epi8(c, b, 8), spread), alpha));
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(out + 48),
+                     _mm_or_si128(_mm_shuffle_epi8(_mm_srli_si128(c, 4), spread), alpha));
+  }
+  expandRGBScalar(in, out, pixels - i);
+}
+
+TARGET("ssse3") void convertBGRXSSSE3(uint8_t *pixels, size_t count) {
+  const __m128i swap = _mm_setr_epi8(2, 1, 0, 3, 6, 5, 4, 7, 10, 9, 8, 11, 14, 13, 12, 15);
+  const __m128i alpha = _mm_set1_epi32(static_cast<int>(OPAQUE));
+  size_t i = 0;
+  for (; i + 4 <= count; i += 4) {
+    __m128i *block = reinterpret_cast<__m128i*>(pixels + i * 4);
+    _mm_storeu_si128(block, _mm_or_si128(_mm_shuffle_epi8(_mm_loadu_si128(block), swap), alpha));
+  }
+  convertBGRXScalar(pixels + i * 4, count - i);
+}
+
+TARGET("avx2") bool isASCIIAVX2(const char *data, size_t size) {
+  __m256i acc = _mm256_setzero_si256();
+  size_t i = 0;
+  for (; i + 32 <= size; i += 32) {
+    acc = _mm256_or_si256(acc, _mm256_loadu_si256(reinterpret_cast<const __m256i*>(data + i)));
+  }
+  return (_mm256_movemask_epi8(acc) == 0) && isASCIISSE2(data + i, size - i);
+}
+
+TARGET("avx2") void convertBGRXAVX2(uint8_t *pixels, size_t count) {
+  // the shuffle works within 128 bit lanes, which is fine as pixels don't cross them
+  const __m256i swap = _mm256_setr_epi8(2, 1, 0, 3, 6, 5, 4, 7, 10, 9, 8, 11, 14, 13, 12, 15,
+                                        2, 1, 0, 3, 6, 5, 4, 7, 10, 9, 8, 11, 14, 13, 12, 15);
+  const __m256i alpha = _mm256_set1_epi32(static_cast<int>(OPAQUE));
+  size_t i = 0;
+  for (; i + 8 <= count; i += 8) {
+    __m256i *block = reinterpret_cast<__m256i*>(pixels + i * 4);
+    _mm256_storeu_si256(block, _mm256_or_si256(_mm256_shuffle_epi8(_mm256_loadu_si256(block), swap), alpha));
+  }
+  convertBGRXSSSE3(pixels + i * 4, count - i);
+}
+
+TARGET("avx2") void remapFormIdsAVX2(const uint32_t *in, uint32_t *out, size_t count,
+                                     const uint32_t *table, const uint32_t *lightTable) {
+  // the lookups are gathers from the widened tables, eight ids at a time
+  const __m256i lowMask = _mm256_set1_epi32(0xFFFFFF);
+  const int *base = reinterpret_cast<const int*>(table);
+  size_t i = 0;
+  if (lightTable == nullptr) {
+    for (; i + 8 <= count; i += 8) {
+      __m256i id = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(in + i));
+      __m256i plugin = _mm256_i32gather_epi32(base, _mm256_srli_epi32(id, 24), 4);
+      _mm256_storeu_si256(reinterpret_cast<__m256i*>(out + i),
+                          _mm256_or_si256(plugin, _mm256_and_si256(id, lowMask)));
+    }
+  } else {
+    const int *lightBase = reinterpret_cast<const int*>(lightTable);
+    const __m256i lightIndex = _mm256_set1_epi32(0xFE);
+    const __m256i lightMask = _mm256_set1_epi32(0xFFF);
+    for (; i + 8 <= count; i += 8) {
+      __m256i id = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(in + i));
+      __m256i index = _mm256_srli_epi32(id, 24);
+      __m256i regular = _mm256_or_si256(_mm256_i32gather_epi32(base, index, 4), _mm256_and_si256(id, lowMask));
+      __m256i lightIdx = _mm256_and_si256(_mm256_srli_epi32(id, 12), lightMask);
+      __m256i light = _mm256_or_si256(_mm256_i32gather_epi32(lightBase, lightIdx, 4), _mm256_and_si256(id, lightMask));
+      _mm256_storeu_si256(reinterpret_cast<__m256i*>(out + i),
+                          _mm256_blendv_epi8(regular, light, _mm256_cmpeq_epi32(index, lightIndex)));
+    }
+  }
+  remapFormIdsScalar(in + i, out + i, count - i, table, lightTable);
+}
+
+TARGET("avx512f,avx512bw") bool isASCIIAVX512(const char *data, size_t size) {
+  __m512i acc = _mm512_setzero_si512();
+  size_t i = 0;
+  for (; i + 64 <= size; i += 64) {
+    acc = _mm512_or_si512(acc, _mm512_loadu_si512(data + i));
+  }
+  // masked load for the rest, masked out bytes aren't accessed
+  __mmask64 rest = (size - i) == 0 ? 0 : (~0ULL >> (64 - (size - i)));
+  acc = _mm512_or_si512(acc, _mm512_maskz_loadu_epi8(rest, data + i));
+  return _mm512_movepi8_mask(acc) == 0;
+}
+
+void cpuid(uint32_t leaf, uint32_t subLeaf, uint32_t regs[4]) {
+#ifdef _MSC_VER
+  int info[4];
+  __cpuidex(info, static_cast<int>(leaf), static_cast<int>(subLeaf));
+  for (int i = 0; i < 4; ++i) {
+    regs[i] = static_cast<uint32_t>(info[i]);
+  }
+#else
+  __cpuid_count(leaf, subLeaf, regs[0], regs[1], regs[2], regs[3]);
+#endif
+}
+
+/* register states the os saves on context switches */
+uint64_t enabledStates() {
+#ifdef _MSC_VER
+  return _xgetbv(0);
+#else
+  uint32_t eax, edx;
+  __asm__ volatile("xgetbv" : "=a"(eax), "=d"(edx) : "c"(0));
+  return (static_cast<uint64_t>(edx) << 32) | eax;
+#endif
+}
+
+CpuDispatch::Level probe() {
+  uint32_t regs[4];
+  cpuid(0, 0, regs);
+  uint32_t maxLeaf = regs[0];
+  if (maxLeaf < 1) {
+    return CpuDispatch::Level::SCALAR;
+  }
+
+  cpuid(1, 0, regs);
+  bool sse2 = (regs[3] & (1u << 26)) != 0;
+  bool ssse3 = (regs[2] & (1u << 9)) != 0;
+  // the wider registers are only usable if the os saves them
+  bool osxsave = (regs[2] & (1u << 27)) != 0;
+  bool avx = (regs[2] & (1u << 28)) != 0;
+  uint64_t states = osxsave ? enabledStates() : 0;
+  bool ymm = (states & 0x06) == 0x06;
+  bool zmm = (states & 0xE6) == 0xE6;
+
+  bool avx2 = false;
+  bool avx512 = false;
+  if (maxLeaf >= 7) {
+    cpuid(7, 0, regs);
+    avx2 = (regs[1] & (1u << 5)) != 0;
+    // foundation and byte/word instructions
+    avx512 = ((regs[1] & (1u << 16)) != 0) && ((regs[1] & (1u << 30)) != 0);
+  }
+
+  if (avx && avx2 && avx512 && zmm) {
+    return CpuDispatch::Level::AVX512;
+  } else if (avx && avx2 && ymm) {
+    return CpuDispatch::Level::AVX2;
+  } else if (sse2 && ssse3) {
+    return CpuDispatch::Level::SSSE3;
+  } else if (sse2) {
+    return CpuDispatch::Level::SSE2;
+  }
+  return CpuDispatch::Level::SCALAR;
+}
+
+#elif defined(CPU_NEON)
+
+void expandRGBNEON(const uint8_t *in, uint8_t *out, size_t pixels) {
+  size_t i = 0;
+  for (; i + 16 <= pixels; i += 16, in += 48, out += 64) {
+    uint8x16x3_t rgb = vld3q_u8(in);
+    uint8x16x4_t rgba;
+    rgba.val[0] = rgb.val[0];
+    rgba.val[1] = rgb.val[1];
+    rgba.val[2] = rgb.val[2];
+    rgba.val[3] = vdupq_n_u8(0xFF);
+    vst4q_u8(out, rgba);
+  }
+  expandRGBScalar(in, out, pixels - i);
+}
+
+void convertBGRXNEON(uint8_t *pixels, size_t count) {
+  size_t i = 0;
+  for (; i + 16 <= count; i += 16) {
+    uint8x16x4_t block = vld4q_u8(pixels + i * 4);
+    uint8x16_t temp = block.val[0];
+    block.val[0] = block.val[2];
+    block.val[2] = temp;
+    block.val[3] = vdupq_n_u8(0xFF);
+    vst4q_u8(pixels + i * 4, block);
+  }
+  convertBGRXScalar(pixels + i * 4, count - i);
+}
+
+bool isASCIINEON(const char *data, size_t size) {
+  uint8x16_t acc = vdupq_n_u8(0);
+  size_t i = 0;
+  for (; i + 16 <= size; i += 16) {
+    acc = vorrq_u8(acc, vld1q_u8(reinterpret_cast<const uint8_t*>(data + i)));
+  }
+  return (vmaxvq_u8(acc) < 0x80) && isASCIIScalar(data + i, size - i);
+}
+
+void sumRGBANEON(const uint8_t *in, size_t pixels, uint32_t sum[4]) {
+  uint32x4_t acc = vdupq_n_u32(0);
+  size_t i = 0;
+  for (; i + 4 <= pixels; i += 4) {
+    uint8x16_t block = vld1q_u8(in + i * 4);
+    uint16x8_t pairs = vaddl_u8(vget_low_u8(block), vget_high_u8(block));
+    acc = vaddq_u32(acc, vaddl_u16(vget_low_u16(pairs), vget_high_u16(pairs)));
+  }
+  uint32_t lanes[4];
+  vst1q_u32(lanes, acc);
+  for (int c = 0; c < 4; ++c) {
+    sum[c] += lanes[c];
+  }
+  sumRGBAScalar(in + i * 4, pixels - i, sum);
+}
+
+CpuDispatch::Level probe() {
+  // part of the baseline on 64 bit arm
+  return CpuDispatch::Level::NEON;
+}
+
+#else
+
+CpuDispatch::Level probe() {
+  return CpuDispatch::Level::SCALAR;
+}
+
+#endif
+
+const size_t LEVEL_COUNT = static_cast<size_t>(CpuDispatch::Level::NEON) + 1;
+
+const char *LEVEL_NAMES[LEVEL_COUNT] = { "scalar", "sse2", "ssse3", "avx2", "avx512", "neon" };
+
+CpuDispatch::Kernels kernelsFor(CpuDispatch::Level level) {
+  CpuDispatch::Kernels result = { &expandRGBScalar, &convertBGRXScalar, &isASCIIScalar, &sumRGBAScalar,
+                                   &remapFormIdsScalar };
+#ifdef CPU_X86
+  if ((level >= CpuDispatch::Level::SSE2) && (level <= CpuDispatch::Level::AVX512)) {
+    result.isASCII = &isASCIISSE2;
+    result.sumRGBA = &sumRGBASSE2;
+  }
+  if ((level >= CpuDispatch::Level::SSSE3) && (level <= CpuDispatch::Level::AVX512)) {
+    result.expandRGB = &expandRGBSSSE3;
+    result.convertBGRX = &convertBGRXSSSE3;
+  }
+  if ((level >= CpuDispatch::Level::AVX2) && (level <= CpuDispatch::Level::AVX512)) {
+    result.isASCII = &isASCIIAVX2;
+    result.convertBGRX = &convertBGRXAVX2;
+    result.remapFormIds = &remapFormIdsAVX2;
+  }
+  if (level == CpuDispatch::Level::AVX512) {
+    result.isASCII = &isASCIIAVX512;
+  }
+#elif defined(CPU_NEON)
+  if (level == CpuDispatch::Level::NEON) {
+    // no gather instruction, the table lookups stay scalar
+    result = { &expandRGBNEON, &convertBGRXNEON, &isASCIINEON, &sumRGBANEON, &remapFormIdsScalar };
+  }
+#endif
+  return result;
+}
+
+bool supported(CpuDispatch::Level level, CpuDispatch::Level detected) {
+  if ((level == CpuDispatch::Level::SCALAR) || (level == detected)) {
+    return true;
+  }
+  // the x86 levels build on each other
+  return (detected != CpuDispatch::Level::NEON) && (level != CpuDispatch::Level::NEON) && (level < detected);
+}
+
+std::once_flag s_Probed;
+CpuDispatch::Level s_Detected = CpuDispatch::Level::SCALAR;
+CpuDispatch::Kernels s_Tables[LEVEL_COUNT];
+std::atomic<const CpuDispatch::Kernels*> s_Active{ nullptr };
+
+}
+
+void CpuDispatch::init()
+{
+  std::call_once(s_Probed, [] {
+    s_Detected = probe();
+    for (size_t i = 0; i < LEVEL_COUNT; ++i) {
+      s_Tables[i] = kernelsFor(static_cast<Level>(i));
+    }
+    s_Active = &s_Tables[static_cast<size_t>(s_Detected)];
+  });
+}
+
+CpuDispatch::Level CpuDispatch::detected()
+{
+  init();
+  return s_Detected;
+}
+
+CpuDispatch::Level CpuDispatch::level()
+{
+  return static_cast<Level>(&kernels() - s_Tables);
+}
+
+void CpuDispatch::setLevel(Level level)
+{
+  init();
+  if (!supported(level, s_Detected)) {
+    throw std::runtime_error(fmt::format("cpu doesn't support \"{}\"", levelName(level)));
+  }
+  s_Active = &s_Tables[static_cast<size_t>(level)];
+}
+
+const CpuDispatch::Kernels &CpuDispatch::kernels()
+{
+  const Kernels *active = s_Active.load(std::memory_order_acquire);
+  if (active == nullptr) {
+    init();
+    active = s_Active.load(std::memory_order_acquire);
+  }
+  return *active;
+}
+
+const char *CpuDispatch::levelName(Level level)
+{
+  return LEVEL_NAMES[static_cast<size_t>(level)];
+}
+
+bool CpuDispatch::parseLevel(const std::string &name, Level &level)
+{
+  for (size_t i = 0; i < LEVEL_COUNT; ++i) {
+    if (name == LEVEL_NAMES[i]) {
+      level = static_cast<Level>(i);
+      return true;
+    }
+  }
+  return false;
+}
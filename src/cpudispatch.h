@@ -0,0 +1,56 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+/**
+ * Picks the implementation of the vectorized kernels (pixel conversion, ascii checks, image
+ * downscaling, form id remapping) once at startup based on the instruction sets the cpu supports, since the binaries
+ * we ship can't assume anything past the baseline of the architecture. Every kernel has a scalar
+ * version, levels without a dedicated version of a kernel use the one of the next lower level.
+ * The level can be lowered (i.e. to compare performance) but not raised above what was detected
+ */
+class CpuDispatch {
+public:
+  enum class Level {
+    SCALAR,
+    SSE2,
+    SSSE3,
+    AVX2,
+    AVX512,
+    NEON,
+  };
+
+  struct Kernels {
+    /* rgb to rgba with opaque alpha. in and out must not overlap */
+    void (*expandRGB)(const uint8_t *in, uint8_t *out, size_t pixels);
+    /* bgr with an unused fourth byte to rgba with opaque alpha, in place */
+    void (*convertBGRX)(uint8_t *pixels, size_t count);
+    /* true if none of the bytes has the high bit set */
+    bool (*isASCII)(const char *data, size_t size);
+    /* add the channels of a row of rgba pixels to sum */
+    void (*sumRGBA)(const uint8_t *in, size_t pixels, uint32_t sum[4]);
+    /* replace the plugin index of form ids by looking up the upper byte in table (new index << 24 for
+     * each of the 256 old ones). If lightTable is set, ids in the FE space look up bits 12-23 in it
+     * instead (0xFE000000 | new light index << 12 for each of the 4096). in and out may be the same */
+    void (*remapFormIds)(const uint32_t *in, uint32_t *out, size_t count,
+                         const uint32_t *table, const uint32_t *lightTable);
+  };
+
+  /* probe the cpu and bind the best kernels. Only has an effect the first time */
+  static void init();
+
+  static Level detected();
+  static Level level();
+
+  /* use the kernels of a different level, throws if the cpu doesn't support it */
+  static void setLevel(Level level);
+
+  /* the kernels of the current level */
+  static const Kernels &kernels();
+
+  static const char *levelName(Level level);
+  /* false if the name isn't a known level */
+  static bool parseLevel(const std::string &name, Level &level);
+};
@@ -0,0 +1,22 @@
+#pragma once
+
+#include <cstddef>
+#include <ios>
+#include <stdexcept>
+
+class DataInvalid : public std::runtime_error {
+public:
+  DataInvalid(const char* message, size_t offset) : std::runtime_error(message), m_Offset(offset) {}
+  size_t offset() const { return m_Offset; }
+private:
+  size_t m_Offset;
+};
+
+class IDecoder {
+public:
+  virtual ~IDecoder() {};
+  virtual bool seek(size_t offset, std::ios_base::seekdir dir = std::ios::beg) = 0;
+  virtual size_t tell() = 0;
+  virtual bool read(char *buffer, size_t size) = 0;
+  virtual void clear() = 0;
+};
@@ -0,0 +1,232 @@
+#include "fileops.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <stdexcept>
+#include <vector>
+
+#include "string_cast.h"
+#include "fmt/format.h"
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace {
+
+const size_t COPY_BLOCK = 4 * 1024 * 1024;
+
+std::atomic<uint64_t> s_TempCounter{ 0 };
+
+void appendBlocks(const std::string &source, uint64_t offset, uint64_t length, const std::string &target) {
+  std::ifstream in(toWC(source.c_str(), CodePage::UTF8, source.length()).c_str(), std::ios::in | std::ios::binary);
+  if (!in.is_open()) {
+    throw std::runtime_error(fmt::format("failed to open \"{}\": {}", source, strerror(errno)));
+  }
+  std::ofstream out(toWC(target.c_str(), CodePage::UTF8, target.length()).c_str(),
+                    std::ios::out | std::ios::binary | std::ios::app);
+  if (!out.is_open()) {
+    throw std::runtime_error(fmt::format("failed to open \"{}\": {}", target, strerror(errno)));
+  }
+
+  in.seekg(offset);
+  std::vector<char> buffer(static_cast<size_t>((std::min<uint64_t>)(length, COPY_BLOCK)));
+  while (length > 0) {
+    size_t chunk = static_cast<size_t>((std::min<uint64_t>)(length, buffer.size()));
+    if (!in.read(buffer.data(), chunk)) {
+      throw std::runtime_error(fmt::format("unexpected end of file in \"{}\"", source));
+    }
+    if (!out.write(buffer.data(), chunk)) {
+      throw std::runtime_error(fmt::format("failed to write \"{}\": {}", target, strerror(errno)));
+    }
+    length -= chunk;
+  }
+
+  out.close();
+  if (out.fail()) {
+    throw std::runtime_error(fmt::format("failed to write \"{}\": {}", target, strerror(errno)));
+  }
+}
+
+#ifdef __linux__
+/* returns false if copy_file_range isn't possible between these files before anything was copied */
+bool appendKernel(const std::string &source, uint64_t offset, uint64_t length, const std::string &target) {
+  int in = ::open(source.c_str(), O_RDONLY);
+  if (in == -1) {
+    throw std::runtime_error(fmt::format("failed to open \"{}\": {}", source, strerror(errno)));
+  }
+  // O_APPEND isn't allowed with copy_file_range, position at the end manually
+  int out = ::open(target.c_str(), O_WRONLY);
+  if ((out == -1) || (::lseek(out, 0, SEEK_END) == -1)) {
+    int error = errno;
+    ::close(in);
+    if (out != -1) {
+      ::close(out);
+    }
+    throw std::runtime_error(fmt::format("failed to open \"{}\": {}", target, strerror(error)));
+  }
+
+  loff_t inOffset = static_cast<loff_t>(offset);
+  bool first = true;
+  bool result = true;
+  while (length > 0) {
+    ssize_t copied = ::copy_file_range(in, &inOffset, out, nullptr, static_cast<size_t>((std::min<uint64_t>)(length, 1ULL << 30)), 0);
+    if (copied < 0) {
+      int error = errno;
+      if (first && ((error == EXDEV) || (error == ENOSYS) || (error == EINVAL) || (error == EOPNOTSUPP))) {
+        result = false;
+        break;
+      }
+      ::close(in);
+      ::close(out);
+      throw std::runtime_error(fmt::format("failed to copy \"{}\" to \"{}\": {}", source, target, strerror(error)));
+    } else if (copied == 0) {
+      ::close(in);
+      ::close(out);
+      throw std::runtime_error(fmt::format("unexpected end of file in \"{}\"", source));
+    }
+    length -= static_cast<uint64_t>(copied);
+    first = false;
+  }
+
+  ::close(in);
+  if (::close(out) != 0) {
+    throw std::runtime_error(fmt::format("failed to write \"{}\": {}", target, strerror(errno)));
+  }
+  return result;
+}
+#endif
+
+}
+
+bool statFile(const std::string &fileName, uint64_t &size, int64_t &modified)
+{
+#ifdef _WIN32
+  WIN32_FILE_ATTRIBUTE_DATA data;
+  if (!::GetFileAttributesExW(toWC(fileName.c_str(), CodePage::UTF8, fileName.length()).c_str(),
+                              GetFileExInfoStandard, &data)) {
+    return false;
+  }
+  size = (static_cast<uint64_t>(data.nFileSizeHigh) << 32) | data.nFileSizeLow;
+  // 100ns intervals since 1601
+  int64_t ticks = static_cast<int64_t>((static_cast<uint64_t>(data.ftLastWriteTime.dwHighDateTime) << 32)
+                                       | data.ftLastWriteTime.dwLowDateTime);
+  modified = (ticks - 116444736000000000LL) * 100;
+#else
+  struct stat fileStat;
+  if (::stat(fileName.c_str(), &fileStat) != 0) {
+    return false;
+  }
+  size = static_cast<uint64_t>(fileStat.st_size);
+#ifdef __APPLE__
+  modified = static_cast<int64_t>(fileStat.st_mtimespec.tv_sec) * 1000000000LL + fileStat.st_mtimespec.tv_nsec;
+#else
+  modified = static_cast<int64_t>(fileStat.st_mtim.tv_sec) * 1000000000LL + fileStat.st_mtim.tv_nsec;
+#endif
+#endif
+  return true;
+}
+
+void createDirectory(const std::string &path)
+{
+#ifdef _WIN32
+  if (!::CreateDirectoryW(toWC(path.c_str(), CodePage::UTF8, path.length()).c_str(), nullptr)
+      && (::GetLastError() != ERROR_ALREADY_EXISTS)) {
+    throw std::runtime_error(fmt::format("failed to create \"{}\" (error {})", path, ::GetLastError()));
+  }
+#else
+  if ((::mkdir(path.c_str(), 0755) != 0) && (errno != EEXIST)) {
+    throw std::runtime_error(fmt::format("failed to create \"{}\": {}", path, strerror(errno)));
+  }
+#endif
+}
+
+void writeFile(const std::string &fileName, const void *data, size_t size)
+{
+  std::ofstream out(toWC(fileName.c_str(), CodePage::UTF8, fileName.length()).c_str(),
+                    std::ios::out | std::ios::binary | std::ios::trunc);
+  if (!out.is_open()) {
+    throw std::runtime_error(fmt::format("failed to open \"{}\": {}", fileName, strerror(errno)));
+  }
+  out.write(static_cast<const char*>(data), size);
+  out.close();
+  if (out.fail()) {
+    throw std::runtime_error(fmt::format("failed to write \"{}\": {}", fileName, strerror(errno)));
+  }
+}
+
+bool syncFile(const std::string &fileName)
+{
+#ifdef _WIN32
+  HANDLE file = ::CreateFileW(toWC(fileName.c_str(), CodePage::UTF8, fileName.length()).c_str(),
+                              GENERIC_WRITE, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE,
+                              nullptr, OPEN_EXISTING, FILE_FLAG_BACKUP_SEMANTICS, nullptr);
+  if (file == INVALID_HANDLE_VALUE) {
+    return false;
+  }
+  bool result = ::FlushFileBuffers(file) != 0;
+  ::CloseHandle(file);
+  return result;
+#else
+  int fd = ::open(fileName.c_str(), O_RDONLY);
+  if (fd == -1) {
+    return false;
+  }
+  bool result = ::fsync(fd) == 0;
+  ::close(fd);
+  return result;
+#endif
+}
+
+std::string tempFileName(const std::string &target)
+{
+#ifdef _WIN32
+  unsigned long pid = ::GetCurrentProcessId();
+#else
+  long pid = static_cast<long>(::getpid());
+#endif
+  return fmt::format("{}.{}-{}.tmp", target, pid, s_TempCounter++);
+}
+
+void replaceFile(const std::string &source, const std::string &target)
+{
+#ifdef _WIN32
+  if (!::MoveFileExW(toWC(source.c_str(), CodePage::UTF8, source.length()).c_str(),
+                     toWC(target.c_str(), CodePage::UTF8, target.length()).c_str(),
+                     MOVEFILE_REPLACE_EXISTING)) {
+    throw std::runtime_error(fmt::format("failed to replace \"{}\" (error {})", target, ::GetLastError()));
+  }
+#else
+  if (::rename(source.c_str(), target.c_str()) != 0) {
+    throw std::runtime_error(fmt::format("failed to replace \"{}\": {}", target, strerror(errno)));
+  }
+#endif
+}
+
+void removeFile(const std::string &fileName)
+{
+#ifdef _WIN32
+  ::DeleteFileW(toWC(fileName.c_str(), CodePage::UTF8, fileName.length()).c_str());
+#else
+  ::remove(fileName.c_str());
+#endif
+}
+
+void appendFileRange(const std::string &source, uint64_t offset, uint64_t length, const std::string &target)
+{
+  if (length == 0) {
+    return;
+  }
+#ifdef __linux__
+  if (appendKernel(source, offset, length, target)) {
+    return;
+  }
+#endif
+  appendBlocks(source, offset, length, target);
+}
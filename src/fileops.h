@@ -0,0 +1,42 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+/**
+ * identifies one version of a file without looking at its content, for use as a cache key
+ */
+struct FileKey {
+  std::string path;
+  uint64_t fileSize;
+  int64_t modified;
+};
+
+/* size and modification time of a file, false if it doesn't exist. The time is in nanoseconds
+ * since the epoch but the actual resolution depends on the platform and file system */
+bool statFile(const std::string &fileName, uint64_t &size, int64_t &modified);
+
+/* create a directory, doing nothing if it exists already */
+void createDirectory(const std::string &path);
+
+/* write data to a new file or replace the content of an existing one */
+void writeFile(const std::string &fileName, const void *data, size_t size);
+
+/* flush a file (or directory) to disk. Returns false if that failed, which is
+ * expected for directories on windows */
+bool syncFile(const std::string &fileName);
+
+/* name for a temporary file next to target (so it can be moved over it) that no other thread or
+ * process writing the same target will use */
+std::string tempFileName(const std::string &target);
+
+/* move source over target, replacing it if it exists */
+void replaceFile(const std::string &source, const std::string &target);
+
+/* delete a file, ignoring errors */
+void removeFile(const std::string &fileName);
+
+/* append length bytes of source, starting at offset, to the end of target. The data is copied
+ * in the kernel where possible (copy_file_range), otherwise in large blocks */
+void appendFileRange(const std::string &source, uint64_t offset, uint64_t length, const std::string &target);
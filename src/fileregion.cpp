@@ -0,0 +1,154 @@
+#include "fileregion.h"
+#include "fileops.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <stdexcept>
+
+#include "string_cast.h"
+#include "fmt/format.h"
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+FileRegion::FileRegion(const std::string &fileName, uint64_t offset, size_t length)
+  : m_FileName(fileName)
+  , m_Offset(offset)
+  , m_Size(length)
+  , m_FileSize(0)
+  , m_Modified(0)
+  , m_Loaded(false)
+{
+  if (!statFile(fileName, m_FileSize, m_Modified)) {
+    throw std::runtime_error(fmt::format("failed to open \"{}\"", fileName));
+  }
+  if (m_FileSize < offset + length) {
+    throw std::runtime_error(fmt::format("unexpected end of file at \"{}\" (read of \"{}\" bytes)", offset, length));
+  }
+}
+
+uint8_t *FileRegion::data()
+{
+  std::lock_guard<std::mutex> lock(m_Mutex);
+  if (!m_Loaded) {
+    load();
+    m_Loaded = true;
+  }
+  return m_Data.data();
+}
+
+size_t FileRegion::residentSize() const
+{
+  std::lock_guard<std::mutex> lock(m_Mutex);
+  return m_Data.size();
+}
+
+void FileRegion::load()
+{
+  if (m_Size == 0) {
+    return;
+  }
+
+  const char *changed = "the file changed since it was read";
+
+#ifdef _WIN32
+  HANDLE file = ::CreateFileW(toWC(m_FileName.c_str(), CodePage::UTF8, m_FileName.length()).c_str(),
+                              GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE,
+                              nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+  if (file == INVALID_HANDLE_VALUE) {
+    throw std::runtime_error(fmt::format("failed to open \"{}\" (error {})", m_FileName, ::GetLastError()));
+  }
+
+  // same units as statFile
+  BY_HANDLE_FILE_INFORMATION info;
+  if (!::GetFileInformationByHandle(file, &info)) {
+    DWORD error = ::GetLastError();
+    ::CloseHandle(file);
+    throw std::runtime_error(fmt::format("failed to open \"{}\" (error {})", m_FileName, error));
+  }
+  uint64_t fileSize = (static_cast<uint64_t>(info.nFileSizeHigh) << 32) | info.nFileSizeLow;
+  int64_t ticks = static_cast<int64_t>((static_cast<uint64_t>(info.ftLastWriteTime.dwHighDateTime) << 32)
+                                       | info.ftLastWriteTime.dwLowDateTime);
+  if ((fileSize != m_FileSize) || ((ticks - 116444736000000000LL) * 100 != m_Modified)) {
+    ::CloseHandle(file);
+    throw std::runtime_error(changed);
+  }
+
+  std::vector<uint8_t> data(m_Size);
+  size_t done = 0;
+  while (done < m_Size) {
+    // positioned read through the handle that was just checked
+    uint64_t offset = m_Offset + done;
+    OVERLAPPED position;
+    memset(&position, 0, sizeof(OVERLAPPED));
+    position.Offset = static_cast<DWORD>(offset & 0xFFFFFFFF);
+    position.OffsetHigh = static_cast<DWORD>(offset >> 32);
+    DWORD chunk = static_cast<DWORD>((std::min<size_t>)(m_Size - done, 1 << 30));
+    DWORD read = 0;
+    if (!::ReadFile(file, data.data() + done, chunk, &read, &position)) {
+      DWORD error = ::GetLastError();
+      ::CloseHandle(file);
+      if (error == ERROR_HANDLE_EOF) {
+        throw std::runtime_error(changed);
+      }
+      throw std::runtime_error(fmt::format("failed to read \"{}\" (error {})", m_FileName, error));
+    }
+    if (read == 0) {
+      // truncated since the check
+      ::CloseHandle(file);
+      throw std::runtime_error(changed);
+    }
+    done += read;
+  }
+  ::CloseHandle(file);
+#else
+  int fd = ::open(m_FileName.c_str(), O_RDONLY | O_CLOEXEC);
+  if (fd == -1) {
+    throw std::runtime_error(fmt::format("failed to open \"{}\": {}", m_FileName, strerror(errno)));
+  }
+
+  // compare through the descriptor we read from, the path may refer to a different file by now
+  struct stat fileStat;
+  if (::fstat(fd, &fileStat) != 0) {
+    int error = errno;
+    ::close(fd);
+    throw std::runtime_error(fmt::format("failed to open \"{}\": {}", m_FileName, strerror(error)));
+  }
+#ifdef __APPLE__
+  int64_t modified = static_cast<int64_t>(fileStat.st_mtimespec.tv_sec) * 1000000000LL + fileStat.st_mtimespec.tv_nsec;
+#else
+  int64_t modified = static_cast<int64_t>(fileStat.st_mtim.tv_sec) * 1000000000LL + fileStat.st_mtim.tv_nsec;
+#endif
+  if ((static_cast<uint64_t>(fileStat.st_size) != m_FileSize) || (modified != m_Modified)) {
+    ::close(fd);
+    throw std::runtime_error(changed);
+  }
+
+  std::vector<uint8_t> data(m_Size);
+  size_t done = 0;
+  while (done < m_Size) {
+    ssize_t read = ::pread(fd, data.data() + done, m_Size - done, static_cast<off_t>(m_Offset + done));
+    if (read < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      int error = errno;
+      ::close(fd);
+      throw std::runtime_error(fmt::format("failed to read \"{}\": {}", m_FileName, strerror(error)));
+    }
+    if (read == 0) {
+      // truncated since the check
+      ::close(fd);
+      throw std::runtime_error(changed);
+    }
+    done += static_cast<size_t>(read);
+  }
+  ::close(fd);
+#endif
+
+  m_Data.swap(data);
+}
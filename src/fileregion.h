@@ -0,0 +1,46 @@
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+#include <mutex>
+#include <string>
+#include <vector>
+
+/**
+ * Region of a file that only gets loaded the first time it's used.
+ * It's read into memory (one copy) then, provided size and modification time of the file are
+ * still what they were when this object was created. This deliberately doesn't map the file:
+ * a mapped file getting truncated crashes the process (SIGBUS) on posix systems and on windows
+ * the file can't be overwritten while mapped, which would keep the game from saving.
+ */
+class FileRegion {
+public:
+  FileRegion(const std::string &fileName, uint64_t offset, size_t length);
+
+  FileRegion(const FileRegion&) = delete;
+  FileRegion &operator=(const FileRegion&) = delete;
+
+  /* the content of the region, loaded if necessary. Throws if the file changed in the meantime */
+  uint8_t *data();
+  size_t size() const { return m_Size; }
+
+  /* number of bytes held in memory, 0 until the region is first used */
+  size_t residentSize() const;
+
+private:
+
+  void load();
+
+private:
+
+  std::string m_FileName;
+  uint64_t m_Offset;
+  size_t m_Size;
+  uint64_t m_FileSize;
+  int64_t m_Modified;
+
+  mutable std::mutex m_Mutex;
+  bool m_Loaded;
+  std::vector<uint8_t> m_Data;
+
+};
@@ -0,0 +1,55 @@
+#include "fingerprint.h"
+
+namespace {
+
+const uint64_t FNV_OFFSET = 0xcbf29ce484222325ULL;
+const uint64_t FNV_PRIME = 0x100000001b3ULL;
+
+uint64_t fnvByte(uint64_t hash, uint8_t value) {
+  return (hash ^ value) * FNV_PRIME;
+}
+
+uint8_t foldCase(uint8_t ch) {
+  return ((ch >= 'A') && (ch <= 'Z')) ? static_cast<uint8_t>(ch + ('a' - 'A')) : ch;
+}
+
+/* splitmix64 finalizer, spreads the bits of the per-name hash before they get summed up */
+uint64_t mix(uint64_t value) {
+  value = (value ^ (value >> 30)) * 0xbf58476d1ce4e5b9ULL;
+  value = (value ^ (value >> 27)) * 0x94d049bb133111ebULL;
+  return value ^ (value >> 31);
+}
+
+}
+
+PluginFingerprint::PluginFingerprint()
+  : m_LoadOrder(FNV_OFFSET)
+  , m_PluginSet(0)
+{
+}
+
+void PluginFingerprint::add(const std::string &pluginName)
+{
+  uint64_t nameHash = FNV_OFFSET;
+  for (char ch : pluginName) {
+    uint8_t folded = foldCase(static_cast<uint8_t>(ch));
+    nameHash = fnvByte(nameHash, folded);
+    m_LoadOrder = fnvByte(m_LoadOrder, folded);
+  }
+  // separator so that "a.esp","b.esp" doesn't hash like "a.espb.esp"
+  m_LoadOrder = fnvByte(m_LoadOrder, 0);
+
+  // addition is commutative so the order of plugins doesn't matter
+  m_PluginSet += mix(nameHash);
+}
+
+std::string PluginFingerprint::toHex(uint64_t value)
+{
+  static const char digits[] = "0123456789abcdef";
+  std::string result(16, '0');
+  for (int i = 15; i >= 0; --i) {
+    result[i] = digits[value & 0x0F];
+    value >>= 4;
+  }
+  return result;
+}
@@ -0,0 +1,27 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+
+/**
+ * 64-bit fingerprints of a plugin list, both order-sensitive (the load order) and order-insensitive
+ * (the set of plugins). Names are compared case-insensitively, as the games do
+ */
+class PluginFingerprint {
+public:
+  PluginFingerprint();
+
+  void add(const std::string &pluginName);
+
+  uint64_t loadOrder() const { return m_LoadOrder; }
+  uint64_t pluginSet() const { return m_PluginSet; }
+
+  /* fingerprint as a fixed length hex string, for use in js which can't represent it as a number */
+  static std::string toHex(uint64_t value);
+
+private:
+
+  uint64_t m_LoadOrder;
+  uint64_t m_PluginSet;
+
+};
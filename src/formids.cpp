@@ -0,0 +1,42 @@
+#include "formids.h"
+#include "cpudispatch.h"
+#include "threadpool.h"
+
+#include <algorithm>
+#include <vector>
+
+namespace {
+
+// below this it's not worth handing the work to the pool
+const size_t REMAP_CHUNK = 64 * 1024;
+
+}
+
+void remapFormIds(const uint32_t *ids, uint32_t *out, size_t count, const uint8_t *map, const uint16_t *lightMap)
+{
+  // widen the maps to the final bits of the id so a lookup is a single load (or gather)
+  uint32_t table[256];
+  for (uint32_t i = 0; i < 256; ++i) {
+    table[i] = static_cast<uint32_t>(map[i]) << 24;
+  }
+  std::vector<uint32_t> lightTable;
+  if (lightMap != nullptr) {
+    lightTable.resize(4096);
+    for (uint32_t i = 0; i < 4096; ++i) {
+      lightTable[i] = (static_cast<uint32_t>(LIGHT_PLUGIN_INDEX) << 24) | (static_cast<uint32_t>(lightMap[i] & 0xFFF) << 12);
+    }
+  }
+  const uint32_t *light = lightTable.empty() ? nullptr : lightTable.data();
+  auto kernel = CpuDispatch::kernels().remapFormIds;
+
+  size_t chunks = (count + REMAP_CHUNK - 1) / REMAP_CHUNK;
+  if (chunks <= 1) {
+    kernel(ids, out, count, table, light);
+    return;
+  }
+
+  ThreadPool::instance().parallelFor(chunks, [&](size_t chunk) {
+    size_t offset = chunk * REMAP_CHUNK;
+    kernel(ids + offset, out + offset, (std::min)(REMAP_CHUNK, count - offset), table, light);
+  });
+}
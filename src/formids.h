@@ -0,0 +1,12 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+/* index byte of esl (light) plugins, their forms are addressed as FE xxx yyy */
+const uint8_t LIGHT_PLUGIN_INDEX = 0xFE;
+
+/* write the form ids with their plugin index rewritten to out, which may be the same as ids.
+ * map holds the new index for each of the 256 old ones. If lightMap is not null it holds the new
+ * index of each of the 4096 light plugins and is applied to ids in the FE space instead of map */
+void remapFormIds(const uint32_t *ids, uint32_t *out, size_t count, const uint8_t *map, const uint16_t *lightMap);
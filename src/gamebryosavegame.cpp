@@ -1,6 +1,21 @@
 #include "gamebryosavegame.h"
+#include "atlas.h"
+#include "bufferpool.h"
+#include "chunkeddecoder.h"
+#include "scratchbuffer.h"
+#include "fileops.h"
+#include "formids.h"
+#include "readscheduler.h"
+#include "recompress.h"
+#include "rewrite.h"
+#include "slowlog.h"
+#include "streamcodec.h"
+#include "threadpool.h"
 
 #include <sys/stat.h>
+#include <algorithm>
+#include <cctype>
+#include <chrono>
 #include <stdexcept>
 #include <vector>
 #include <ctime>
@@ -11,6 +26,17 @@
 #include <thread>
 #include <fstream>
 
+// hand out outdated shared cache entries right away and read the save again in the background
+static std::atomic<bool> s_StaleWhileRevalidate{ false };
+
+static const char *compressionName(uint16_t format) {
+  switch (format) {
+    case COMPRESSION_ZLIB: return "zlib";
+    case COMPRESSION_LZ4: return "lz4";
+    default: return "none";
+  }
+}
+
 uint32_t windowsTicksToEpoch(int64_t windowsTicks)
 {
   // windows tick is in 100ns
@@ -70,87 +96,185 @@ private:
   std::ifstream m_File;
 };
 
-class LZ4Decoder : public IDecoder {
+// decompress in reasonably large steps so sequential reads don't cause lots of tiny calls
+static const size_t DECODE_STEP = 256 * 1024;
+// size of the chunks compressed data is read in
+static const size_t INPUT_CHUNK = 64 * 1024;
+
+/**
+ * Base class for decoders of compressed bodies. Data only gets decompressed as far as
+ * reads actually reach so looking at something near the start of the body doesn't require
+ * unpacking all of it, or allocating memory for it
+ */
+class LazyDecoder : public IDecoder {
 public:
-  LZ4Decoder(std::shared_ptr<IDecoder> &wrapee, unsigned long compressedSize, unsigned long uncompressedSize)
+  LazyDecoder(unsigned long uncompressedSize)
+    : m_Buffer(uncompressedSize, true)
+    , m_Decoded(0)
+    , m_Pos(0)
+    , m_Failed(false)
+    , m_DecodeTime(0.0)
   {
-    std::string tempCompressed;
-    tempCompressed.resize(compressedSize);
-    std::string tempUncompressed;
-    tempUncompressed.resize(uncompressedSize);
-
-    wrapee->read(&tempCompressed[0], compressedSize);
-    LZ4_decompress_safe(&tempCompressed[0], &tempUncompressed[0], compressedSize, uncompressedSize);
-    m_Buffer = std::istringstream(tempUncompressed);
   }
 
   virtual size_t tell() {
-    return m_Buffer.tellg();
+    return m_Pos;
   }
 
   virtual bool seek(size_t offset, std::ios_base::seekdir dir = std::ios::beg) {
-    return static_cast<bool>(m_Buffer.seekg(offset, dir));
+    size_t target = offset;
+    if (dir == std::ios::cur) {
+      target = m_Pos + offset;
+    } else if (dir == std::ios::end) {
+      target = m_Buffer.size() + offset;
+    }
+    if (m_Failed || (target > m_Buffer.size())) {
+      m_Failed = true;
+      return false;
+    }
+    m_Pos = target;
+    return true;
   }
 
   virtual bool read(char *buffer, size_t size) {
-    return static_cast<bool>(m_Buffer.read(buffer, size));
+    if (m_Failed || (size > m_Buffer.size() - m_Pos)) {
+      m_Failed = true;
+      return false;
+    }
+    if (m_Pos + size > m_Decoded) {
+      auto start = std::chrono::steady_clock::now();
+      decodeUntil(m_Pos + size);
+      m_DecodeTime += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    }
+    memcpy(buffer, m_Buffer.data() + m_Pos, size);
+    m_Pos += size;
+    return true;
   }
 
   virtual void clear() {
-    m_Buffer.clear();
+    m_Failed = false;
+  }
+
+  /* seconds spent decompressing so far */
+  double decodeTime() const {
+    return m_DecodeTime;
   }
+
+protected:
+
+  /* decompress at least up to the specified offset, advancing m_Decoded. m_Buffer has to be
+   * grown before writing to it */
+  virtual void decodeUntil(size_t end) = 0;
+
+protected:
+
+  // grows along with m_Decoded, may move to a temporary file if the body is very large
+  ScratchBuffer m_Buffer;
+  size_t m_Decoded;
+
 private:
-  std::istringstream m_Buffer;
+
+  size_t m_Pos;
+  bool m_Failed;
+  double m_DecodeTime;
+
 };
 
-class ZlibDecoder : public IDecoder {
+class LZ4Decoder : public LazyDecoder {
 public:
-  ZlibDecoder(std::shared_ptr<IDecoder> &wrapee, unsigned long compressedSize, unsigned long uncompressedSize)
+  LZ4Decoder(std::shared_ptr<IDecoder> &wrapee, unsigned long compressedSize, unsigned long uncompressedSize)
+    : LazyDecoder(uncompressedSize)
+    , m_Compressed(compressedSize)
   {
-    std::string tempCompressed;
-    tempCompressed.resize(compressedSize);
+    if (!wrapee->read(reinterpret_cast<char*>(m_Compressed.data()), compressedSize)) {
+      throw std::runtime_error("unexpected end of file in compressed data");
+    }
+  }
+
+protected:
+
+  virtual void decodeUntil(size_t end) {
+    // the block format only allows decoding from the start so grow geometrically to
+    // keep the total work linear
+    size_t target = (std::min)(m_Buffer.size(), (std::max)(end, (std::max)(m_Decoded * 2, DECODE_STEP)));
+    m_Buffer.grow(target);
+    int res = LZ4_decompress_safe_partial(reinterpret_cast<const char*>(m_Compressed.data()),
+                                          reinterpret_cast<char*>(m_Buffer.data()),
+                                          static_cast<int>(m_Compressed.size()), static_cast<int>(target),
+                                          static_cast<int>(target));
+    if ((res < 0) || (static_cast<size_t>(res) < end)) {
+      throw std::runtime_error("failed to decompress lz4 data");
+    }
+    m_Decoded = res;
+  }
 
-    std::string tempUncompressed;
-    tempUncompressed.resize(uncompressedSize);
+private:
 
-    wrapee->read(&tempCompressed[0], compressedSize);
+  ScratchBuffer m_Compressed;
 
-    z_stream infstream;
-    infstream.zalloc = Z_NULL;
-    infstream.zfree = Z_NULL;
-    infstream.opaque = Z_NULL;
-    infstream.avail_in = compressedSize;
-    infstream.next_in = reinterpret_cast<Bytef*>(&tempCompressed[0]);
-    infstream.avail_out = uncompressedSize;
-    infstream.next_out = reinterpret_cast<Bytef*>(&tempUncompressed[0]);
+};
 
-    int res = inflateInit(&infstream);
+class ZlibDecoder : public LazyDecoder {
+public:
+  ZlibDecoder(std::shared_ptr<IDecoder> &wrapee, unsigned long compressedSize, unsigned long uncompressedSize)
+    : LazyDecoder(uncompressedSize)
+    , m_Source(wrapee)
+    , m_CompressedLeft(compressedSize)
+    , m_Input(INPUT_CHUNK)
+  {
+    memset(&m_Stream, 0, sizeof(z_stream));
+    int res = inflateInit(&m_Stream);
     if (res != Z_OK) {
       throw std::runtime_error("failed to initialize zlib inflate");
     }
-    inflate(&infstream, Z_NO_FLUSH);
-    inflateEnd(&infstream);
-
-    m_Buffer = std::istringstream(tempUncompressed);
   }
 
-  virtual size_t tell() {
-    return m_Buffer.tellg();
+  virtual ~ZlibDecoder() {
+    inflateEnd(&m_Stream);
   }
 
-  virtual bool seek(size_t offset, std::ios_base::seekdir dir = std::ios::beg) {
-    return static_cast<bool>(m_Buffer.seekg(offset, dir));
-  }
+protected:
+
+  virtual void decodeUntil(size_t end) {
+    size_t target = (std::min)(m_Buffer.size(), (std::max)(end, m_Decoded + DECODE_STEP));
+    m_Buffer.grow(target);
+    m_Stream.next_out = m_Buffer.data() + m_Decoded;
+    m_Stream.avail_out = static_cast<uInt>(target - m_Decoded);
+
+    while (m_Stream.avail_out > 0) {
+      if (m_Stream.avail_in == 0) {
+        size_t chunk = (std::min)(m_CompressedLeft, m_Input.size());
+        if (chunk == 0) {
+          break;
+        }
+        if (!m_Source->read(reinterpret_cast<char*>(m_Input.data()), chunk)) {
+          throw std::runtime_error("unexpected end of file in compressed data");
+        }
+        m_CompressedLeft -= chunk;
+        m_Stream.next_in = m_Input.data();
+        m_Stream.avail_in = static_cast<uInt>(chunk);
+      }
+      int res = inflate(&m_Stream, Z_NO_FLUSH);
+      if (res == Z_STREAM_END) {
+        break;
+      } else if ((res != Z_OK) && (res != Z_BUF_ERROR)) {
+        throw std::runtime_error("failed to decompress zlib data");
+      }
+    }
 
-  virtual bool read(char *buffer, size_t size) {
-    return static_cast<bool>(m_Buffer.read(buffer, size));
+    m_Decoded = target - m_Stream.avail_out;
+    if (m_Decoded < end) {
+      throw std::runtime_error("compressed data ended unexpectedly");
+    }
   }
 
-  virtual void clear() {
-    m_Buffer.clear();
-  }
 private:
-  std::istringstream m_Buffer;
+
+  std::shared_ptr<IDecoder> m_Source;
+  size_t m_CompressedLeft;
+  std::vector<uint8_t> m_Input;
+  z_stream m_Stream;
+
 };
 
 bool isCharInRange(wchar_t ch, wchar_t low, wchar_t high) {
@@ -170,37 +294,343 @@ void GamebryoSaveGame::readAsync(const Napi::Env &env, const std::string &fileNa
   m_FileName = fileName;
   m_QuickRead = quick;
 
-  std::thread* loadThread;
+  struct ReadJob : public Completion {
+    ReadJob(GamebryoSaveGame *save, const Napi::Function &cb)
+      : save(save)
+      , saveRef(Napi::Persistent(save->Value()))
+      , callback(Napi::Persistent(cb))
+      , failed(false)
+    {}
+
+    void deliver(Napi::Env env) override {
+      if (!failed) {
+        save->revalidate(env);
+        callback.Call({ env.Null(), saveRef.Value() });
+        return;
+      }
+      Napi::Error errRef = Napi::Error::New(env, error);
+      Napi::Value parseError = save->parseErrorToJS(env);
+      if (parseError.IsUndefined()) {
+        callback.Call({ static_cast<napi_value>(errRef.Value()) });
+      } else {
+        // whatever was read before the error is still of use
+        errRef.Value().Set("section", parseError.As<Napi::Object>().Get("section"));
+        errRef.Value().Set("offset", parseError.As<Napi::Object>().Get("offset"));
+        callback.Call({ static_cast<napi_value>(errRef.Value()), saveRef.Value() });
+      }
+    }
+
+    GamebryoSaveGame *save;
+    // keeps the object alive until it has been handed to the callback
+    Napi::ObjectReference saveRef;
+    Napi::FunctionReference callback;
+    bool failed;
+    std::string error;
+  };
 
-  m_ThreadCB = Napi::ThreadSafeFunction::New(env, cb,
-    "AsyncLoadCB", 0, 1, [loadThread](Napi::Env) {
-    loadThread->join();
-    delete loadThread;
+  std::shared_ptr<ResultDelivery> delivery = env.GetInstanceData<AddonData>()->results;
+  ReadJob *job = new ReadJob(this, cb);
+  delivery->expect(env);
+
+  ReadScheduler::instance().submit([job, delivery]() {
+    try {
+      job->save->read();
+    }
+    catch (const std::exception& e) {
+      job->failed = true;
+      job->error = e.what();
+      job->save->failRead(e.what());
+    }
+    delivery->push(job);
   });
+}
+
+void GamebryoSaveGame::openAsync(const Napi::Env &env, const std::string &fileName, bool quick) {
+  m_FileName = fileName;
+  m_QuickRead = quick;
+
+  struct OpenJob : public Completion {
+    OpenJob(GamebryoSaveGame *save)
+      : save(save)
+      , saveRef(Napi::Persistent(save->Value()))
+    {}
+
+    void deliver(Napi::Env env) override {
+      save->m_PhaseDelivery.reset();
+      save->revalidate(env);
+      save->settlePhasePromises(env);
+    }
 
-  loadThread = new std::thread{ [this, env]() {
-    auto callback = [](Napi::Env env, Napi::Function jsCallback, GamebryoSaveGame* result) {
-      jsCallback.Call({ env.Null(), result->Value() });
-    };
+    GamebryoSaveGame *save;
+    // keeps the object alive until reading is done, phase notifications rely on that too
+    Napi::ObjectReference saveRef;
+  };
 
-    auto callbackError = [](Napi::Env env, Napi::Function jsCallback, std::string* err = nullptr) {
-      Napi::Error errRef = Napi::Error::New(env, err->c_str());
-      jsCallback.Call({ static_cast<napi_value>(errRef.Value()) });
-    };
+  std::shared_ptr<ResultDelivery> delivery = env.GetInstanceData<AddonData>()->results;
+  OpenJob *job = new OpenJob(this);
+  m_PhaseDelivery = delivery;
+  delivery->expect(env);
 
+  ReadScheduler::instance().submit([job, delivery]() {
     try {
-      read();
-      m_ThreadCB.Acquire();
-      m_ThreadCB.BlockingCall(this, callback);
+      job->save->read();
     }
     catch (const std::exception& e) {
-      std::string* err = new std::string{ e.what() };
-      m_ThreadCB.Acquire();
-      m_ThreadCB.BlockingCall(err, callbackError);
+      job->save->failRead(e.what());
+    }
+    delivery->push(job);
+  });
+}
+
+void GamebryoSaveGame::revalidate(Napi::Env env)
+{
+  AddonData *data = env.GetInstanceData<AddonData>();
+  if (!m_Stale || !data->revalidating.insert(m_FileName).second) {
+    return;
+  }
+
+  struct RevalidateJob : public Completion {
+    RevalidateJob(const Napi::Object &obj, const std::string &fileName)
+      : save(GamebryoSaveGame::Unwrap(obj))
+      , saveRef(Napi::Persistent(obj))
+      , fileName(fileName)
+      , failed(false)
+    {}
+
+    void deliver(Napi::Env env) override {
+      AddonData *data = env.GetInstanceData<AddonData>();
+      data->revalidating.erase(fileName);
+      if (data->updateCallback.IsEmpty()) {
+        return;
+      }
+      Napi::String path = Napi::String::New(env, fileName);
+      if (failed) {
+        data->updateCallback.Call({ Napi::Error::New(env, error).Value(), path });
+      } else {
+        data->updateCallback.Call({ env.Null(), path, saveRef.Value() });
+      }
+    }
+
+    GamebryoSaveGame *save;
+    Napi::ObjectReference saveRef;
+    std::string fileName;
+    bool failed;
+    std::string error;
+  };
+
+  Napi::Object obj = CreateNewItem(env);
+  RevalidateJob *job = new RevalidateJob(obj, m_FileName);
+  job->save->m_FileName = m_FileName;
+  job->save->m_QuickRead = m_QuickRead;
+  job->save->m_Revalidation = true;
+
+  std::shared_ptr<ResultDelivery> delivery = data->results;
+  delivery->expect(env);
+
+  // the stale result is good enough for now, don't hold up reads someone is waiting for
+  ReadScheduler::instance().submitBackground([job, delivery]() {
+    try {
+      job->save->read();
+    }
+    catch (const std::exception &e) {
+      job->failed = true;
+      job->error = e.what();
+      job->save->failRead(e.what());
+    }
+    delivery->push(job);
+  });
+}
+
+namespace {
+
+struct PhaseCompletion : public Completion {
+  PhaseCompletion(GamebryoSaveGame *save) : save(save) {}
+
+  void deliver(Napi::Env env) override {
+    save->settlePhasePromises(env);
+  }
+
+  GamebryoSaveGame *save;
+};
+
+const char *phaseName(int phase) {
+  switch (phase) {
+    case GamebryoSaveGame::PHASE_HEADER: return "header";
+    case GamebryoSaveGame::PHASE_SCREENSHOT: return "screenshot";
+    case GamebryoSaveGame::PHASE_COMPLETE: return "complete";
+    default: return "reading";
+  }
+}
+
+}
+
+void GamebryoSaveGame::setPhase(Phase phase)
+{
+  {
+    std::lock_guard<std::mutex> lock(m_PhaseMutex);
+    if (phase <= m_Phase) {
+      return;
+    }
+    m_Phase = phase;
+  }
+  if (m_Timing) {
+    m_Timing->phases[phase] = std::chrono::steady_clock::now();
+  }
+  m_PhaseChanged.notify_all();
+  if (m_PhaseDelivery) {
+    m_PhaseDelivery->post(new PhaseCompletion(this));
+  }
+}
+
+void GamebryoSaveGame::failRead(const std::string &error)
+{
+  {
+    std::lock_guard<std::mutex> lock(m_PhaseMutex);
+    m_ReadFailed = true;
+    m_ReadError = error;
+  }
+  m_PhaseChanged.notify_all();
+}
+
+void GamebryoSaveGame::recordParseError(FileWrapper &file, const std::exception &error)
+{
+  ParseError parseError;
+  const DataInvalid *invalid = dynamic_cast<const DataInvalid*>(&error);
+  if (invalid != nullptr) {
+    parseError.offset = invalid->offset();
+  } else {
+    // after running into the end of the file this is the file size
+    try {
+      parseError.offset = file.tell();
+    }
+    catch (const std::exception&) {
+      parseError.offset = 0;
+    }
+  }
+  parseError.compressed = file.compressed();
+  parseError.message = error.what();
+
+  // the section is whatever comes after the last phase completed. A section that failed half way
+  // may have left incomplete data behind, don't hand that out
+  std::lock_guard<std::mutex> lock(m_PhaseMutex);
+  switch (m_Phase) {
+    case PHASE_READING: {
+      parseError.section = "header";
+    } break;
+    case PHASE_HEADER: {
+      parseError.section = "screenshot";
+    } break;
+    default: {
+      parseError.section = "plugins";
+      m_Plugins.clear();
+      m_PluginFingerprint = PluginFingerprint();
+    } break;
+  }
+  m_ParseError = parseError;
+}
+
+bool GamebryoSaveGame::awaitPhase(Phase phase) const
+{
+  if (m_Phase.load() >= phase) {
+    return true;
+  }
+  std::unique_lock<std::mutex> lock(m_PhaseMutex);
+  m_PhaseChanged.wait(lock, [this, phase]() { return (m_Phase >= phase) || m_ReadFailed; });
+  return m_Phase >= phase;
+}
+
+void GamebryoSaveGame::waitForPhase(Phase phase) const
+{
+  if (!awaitPhase(phase)) {
+    std::lock_guard<std::mutex> lock(m_PhaseMutex);
+    throw std::runtime_error(m_ReadError);
+  }
+}
+
+void GamebryoSaveGame::settlePhasePromises(Napi::Env env)
+{
+  int phase;
+  bool failed;
+  std::string error;
+  {
+    std::lock_guard<std::mutex> lock(m_PhaseMutex);
+    phase = m_Phase;
+    failed = m_ReadFailed;
+    error = m_ReadError;
+  }
+
+  // settling may call into js which could add more promises, so take the ones due out first
+  std::vector<Napi::Promise::Deferred> resolve;
+  std::vector<Napi::Promise::Deferred> reject;
+  for (auto iter = m_PhasePromises.begin(); iter != m_PhasePromises.end();) {
+    if (iter->first <= phase) {
+      resolve.push_back(iter->second);
+    } else if (failed) {
+      reject.push_back(iter->second);
+    } else {
+      ++iter;
+      continue;
+    }
+    iter = m_PhasePromises.erase(iter);
+  }
+
+  for (const Napi::Promise::Deferred &deferred : resolve) {
+    deferred.Resolve(Value());
+  }
+  for (const Napi::Promise::Deferred &deferred : reject) {
+    deferred.Reject(Napi::Error::New(env, error).Value());
+  }
+}
+
+Napi::Value GamebryoSaveGame::parseErrorToJS(Napi::Env env) const
+{
+  ParseError parseError;
+  {
+    std::lock_guard<std::mutex> lock(m_PhaseMutex);
+    // errors from the header section leave nothing worth returning
+    if (m_ParseError.section.empty() || (m_Phase < PHASE_HEADER)) {
+      return env.Undefined();
+    }
+    parseError = m_ParseError;
+  }
+  Napi::Object result = Napi::Object::New(env);
+  result.Set("section", Napi::String::New(env, parseError.section));
+  result.Set("offset", Napi::Number::New(env, static_cast<double>(parseError.offset)));
+  result.Set("compressed", Napi::Boolean::New(env, parseError.compressed));
+  result.Set("message", Napi::String::New(env, parseError.message));
+  return result;
+}
+
+Napi::Value GamebryoSaveGame::readyState(const Napi::CallbackInfo &info)
+{
+  std::lock_guard<std::mutex> lock(m_PhaseMutex);
+  if (m_ReadFailed) {
+    return Napi::String::New(info.Env(), "failed");
+  }
+  return Napi::String::New(info.Env(), phaseName(m_Phase));
+}
+
+Napi::Value GamebryoSaveGame::whenReady(const Napi::CallbackInfo &info)
+{
+  Phase phase = PHASE_COMPLETE;
+  if ((info.Length() > 0) && !info[0].IsUndefined()) {
+    std::string name = info[0].ToString().Utf8Value();
+    if (name == "header") {
+      phase = PHASE_HEADER;
+    } else if (name == "screenshot") {
+      phase = PHASE_SCREENSHOT;
+    } else if ((name == "plugins") || (name == "complete")) {
+      phase = PHASE_COMPLETE;
+    } else {
+      throw Napi::Error::New(info.Env(), fmt::format("invalid phase \"{}\"", name));
     }
+  }
 
-    m_ThreadCB.Release();
-  } };
+  Napi::Promise::Deferred deferred = Napi::Promise::Deferred::New(info.Env());
+  m_PhasePromises.push_back(std::make_pair(phase, deferred));
+  // settles right away if the phase was reached already
+  settlePhasePromises(info.Env());
+  return deferred.Promise();
 }
 
 GamebryoSaveGame::GamebryoSaveGame(const Napi::CallbackInfo &info)
@@ -208,8 +638,17 @@ GamebryoSaveGame::GamebryoSaveGame(const Napi::CallbackInfo &info)
   , m_PCLevel(0)
   , m_SaveNumber()
   , m_CreationTime(0)
+  , m_HeaderVersion(0)
+  , m_ContentOffset(0)
+  , m_ContentReader(nullptr)
+  , m_ContentLocated(false)
+  , m_Stale(false)
+  , m_Revalidation(false)
+  , m_Phase(PHASE_READING)
+  , m_ReadFailed(false)
 {
-  Ref();
+  m_Body.format = BodyFormat::NONE;
+  memset(&m_ScreenshotLayout, 0, sizeof(ScreenshotLayout));
 
   if ((info.Length() == 1) && (info[0] == info.Env().Null())) {
     // allow reading asynchronously later
@@ -218,6 +657,7 @@ GamebryoSaveGame::GamebryoSaveGame(const Napi::CallbackInfo &info)
       m_FileName = info[0].ToString();
       m_QuickRead = info[1].ToBoolean();
       read();
+      revalidate(info.Env());
     }
     catch (const std::exception& e) {
       throw Napi::Error::New(info.Env(), e.what());
@@ -226,26 +666,95 @@ GamebryoSaveGame::GamebryoSaveGame(const Napi::CallbackInfo &info)
 }
 
 void GamebryoSaveGame::read() {
+  if (!SlowLog::instance().enabled()) {
+    parse();
+    return;
+  }
+
+  m_Timing.reset(new ParseTiming());
+  m_Timing->start = std::chrono::steady_clock::now();
+  try {
+    parse();
+  }
+  catch (const std::exception &e) {
+    logSlowParse(e.what());
+    throw;
+  }
+  logSlowParse(nullptr);
+}
+
+void GamebryoSaveGame::parse() {
+  std::shared_ptr<SharedCache> cache = SharedCache::instance();
+  // quick reads don't have the screenshot
+  std::shared_ptr<ThumbnailStore> thumbnails = m_QuickRead ? std::shared_ptr<ThumbnailStore>() : ThumbnailStore::instance();
+  FileKey fileKey;
+  if ((cache || thumbnails) && statFile(m_FileName, fileKey.fileSize, fileKey.modified)) {
+    fileKey.path = m_FileName;
+  } else {
+    cache.reset();
+    thumbnails.reset();
+  }
+
+  if (cache) {
+    std::vector<uint8_t> entry;
+    bool complete = false;
+    bool stale = false;
+    bool allowStale = s_StaleWhileRevalidate && !m_Revalidation;
+    // entries from a quick read lack the screenshot and plugins
+    if (cache->lookup(fileKey, entry, complete, allowStale ? &stale : nullptr)
+        && (complete || m_QuickRead) && restoreCached(entry)) {
+      m_Stale = stale;
+      setPhase(PHASE_COMPLETE);
+      // the screenshot of a stale entry may not be the one in the file now
+      if (thumbnails && !stale) {
+        storeThumbnail(*thumbnails, fileKey);
+      }
+      return;
+    }
+  }
+
   CodePage encoding = determineEncoding(m_FileName);
   {
     FileWrapper file(this, encoding);
+    if (m_Timing) {
+      m_Timing->opened = std::chrono::steady_clock::now();
+    }
+
+    // Starfield saves are wrapped in a container of compressed chunks
+    file.unwrapContainer();
 
     bool found = false;
     for (auto hdr : {
       std::make_pair("TES4SAVEGAME", &GamebryoSaveGame::readOblivion),
       std::make_pair("TESV_SAVEGAME", &GamebryoSaveGame::readSkyrim),
       std::make_pair("FO3SAVEGAME", &GamebryoSaveGame::readFO3),
-      std::make_pair("FO4_SAVEGAME", &GamebryoSaveGame::readFO4)
+      std::make_pair("FO4_SAVEGAME", &GamebryoSaveGame::readFO4),
+      std::make_pair("TES3", &GamebryoSaveGame::readMorrowind),
+      std::make_pair("SFS_SAVEGAME", &GamebryoSaveGame::readStarfield)
     }) {
       if (file.header(hdr.first)) {
         found = true;
-        (this->*hdr.second)(file);
+        try {
+          (this->*hdr.second)(file);
+        }
+        catch (const std::exception &e) {
+          recordParseError(file, e);
+          if (m_Timing) {
+            m_Timing->decompressTime = file.decompressTime();
+          }
+          throw;
+        }
       }
     }
 
+    if (m_Timing) {
+      m_Timing->decompressTime = file.decompressTime();
+    }
+
     if (!found) {
       throw std::runtime_error("invalid file header");
     }
+    m_ContentLocated = !m_QuickRead;
   }
 
   if (m_CreationTime == 0) {
@@ -260,100 +769,518 @@ void GamebryoSaveGame::read() {
       m_CreationTime = static_cast<uint32_t>(fileStat.st_mtime);
     }
   }
+
+  setPhase(PHASE_COMPLETE);
+
+  if (cache) {
+    storeCached(*cache, fileKey);
+  }
+  if (thumbnails) {
+    storeThumbnail(*thumbnails, fileKey);
+  }
 }
 
-GamebryoSaveGame::~GamebryoSaveGame()
+void GamebryoSaveGame::logSlowParse(const char *error)
 {
-  Unref();
-}
+  typedef std::chrono::steady_clock Clock;
+  std::unique_ptr<ParseTiming> timing(std::move(m_Timing));
+  Clock::time_point end = Clock::now();
+  auto ms = [](Clock::time_point from, Clock::time_point to) {
+    return std::chrono::duration<double, std::milli>(to - from).count();
+  };
+
+  double total = ms(timing->start, end);
+  SlowLog &log = SlowLog::instance();
+  if (!log.exceeds(total)) {
+    return;
+  }
 
-// don't want no dependency on windows header
-struct WINSYSTEMTIME {
-  uint16_t wYear;
-  uint16_t wMonth;
-  uint16_t wDayOfWeek;
-  uint16_t wDay;
-  uint16_t wHour;
-  uint16_t wMinute;
-  uint16_t wSecond;
-  uint16_t wMilliseconds;
-};
+  SlowLog::Entry entry;
+  entry.path = m_FileName;
+  int64_t modified;
+  if (!statFile(m_FileName, entry.fileSize, modified)) {
+    entry.fileSize = 0;
+  }
+  entry.time = std::chrono::duration_cast<std::chrono::milliseconds>(
+    std::chrono::system_clock::now().time_since_epoch()).count();
+  entry.game = gameName();
+  entry.compression = compressionName(m_Body.compression);
+  entry.quick = m_QuickRead;
+  // the file only gets opened if the save wasn't found in the shared cache
+  entry.cached = (error == nullptr) && (timing->opened == Clock::time_point());
+  entry.error = error != nullptr ? error : "";
+  entry.totalMs = total;
+  entry.decompressMs = timing->decompressTime * 1000.0;
+
+  // each part lasts from the end of the previous one that was reached. The part a failed parse
+  // stopped in gets the remaining time, parts skipped (the screenshot in quick reads) get none.
+  // For cached saves lookup and restore count as opening
+  const Clock::time_point *marks[] = { &timing->opened, &timing->phases[PHASE_HEADER],
+                                       &timing->phases[PHASE_SCREENSHOT], &timing->phases[PHASE_COMPLETE] };
+  double *durations[] = { &entry.openMs, &entry.headerMs, &entry.imageMs, &entry.pluginsMs };
+  Clock::time_point previous = timing->start;
+  bool failureAssigned = error == nullptr;
+  for (size_t i = 0; i < 4; ++i) {
+    if (entry.cached) {
+      *durations[i] = i == 0 ? total : 0.0;
+    } else if (*marks[i] != Clock::time_point()) {
+      *durations[i] = ms(previous, *marks[i]);
+      previous = *marks[i];
+    } else if (!failureAssigned) {
+      *durations[i] = ms(previous, end);
+      previous = end;
+      failureAssigned = true;
+    } else {
+      *durations[i] = 0.0;
+    }
+  }
 
-CodePage GamebryoSaveGame::determineEncoding(const std::string &fileName) {
-  // determine code page based on file-name. Currently only supporting cyrillic
-  // This is a heuristic: if more than 50% of the file name (which is unicode) are cyrillic characters,
-  // we assume the file _content_ (which is single-byte characters) is in the corresponding code page
-#ifdef _WIN32
-  // pretty hacky way to reduce the file path to just the name without extension
-  size_t nameOffset = fileName.find_last_of("/\\");
-  nameOffset = nameOffset == std::string::npos ? 0 : nameOffset + 1;
-  std::wstring fileNameW = toWC(fileName.c_str() + nameOffset, CodePage::UTF8, fileName.size() - nameOffset - 4);
+  log.add(std::move(entry));
+}
 
-  // filter out numbers and symbols that are identical across code pages anyway
-  std::wstring relevantChars;
-  std::copy_if(fileNameW.begin(), fileNameW.end(), std::back_inserter(relevantChars), [](wchar_t ch) { return !ignoreChar(ch); });
+bool GamebryoSaveGame::contentSupported() const
+{
+  return m_ContentReader != &GamebryoSaveGame::readStarfieldContent;
+}
 
-  // determine percentage of cyrillic characters, if > 50%, assume the file is encoded cyrillic
-  int cyrillicChars = std::count_if(relevantChars.begin(), relevantChars.end(),
-    [](wchar_t ch) { return isCharCyrillic(ch); });
+const char *GamebryoSaveGame::gameName() const
+{
+  if (m_ContentReader == &GamebryoSaveGame::readOblivionContent) {
+    return "oblivion";
+  } else if (m_ContentReader == &GamebryoSaveGame::readSkyrimContent) {
+    return m_HeaderVersion >= 0x0c ? "skyrimse" : "skyrim";
+  } else if (m_ContentReader == &GamebryoSaveGame::readFO3Content) {
+    return "fallout3";
+  } else if (m_ContentReader == &GamebryoSaveGame::readFO4Content) {
+    return "fallout4";
+  } else if (m_ContentReader == &GamebryoSaveGame::readMorrowindContent) {
+    return "morrowind";
+  } else if (m_ContentReader == &GamebryoSaveGame::readStarfieldContent) {
+    return "starfield";
+  }
+  return "unknown";
+}
 
-  if ((relevantChars.length() > 0)
-      && ((cyrillicChars * 100) / relevantChars.length() > 50)) {
-    return CodePage::CYRILLIC;
+void GamebryoSaveGame::locateContent()
+{
+  if (m_Stale) {
+    // offsets from the cache entry don't apply to the file as it is now
+    throw std::runtime_error("the file changed since it was read, use the updated save");
   }
-#endif
-  // the chinese version at least seems to use unicode.
-  // Just in case decoding as utf8 doesn't work, assume it's latin1
-  return CodePage::UTF8ORLATIN1;
+  if (m_ContentLocated) {
+    return;
+  }
+  if ((m_ContentReader == nullptr) || !contentSupported()) {
+    throw std::runtime_error("not supported for this game");
+  }
+  FileWrapper file(this, determineEncoding(m_FileName));
+  file.setDiscard(true);
+  file.unwrapContainer();
+  file.seek(m_ContentOffset);
+  (this->*m_ContentReader)(file);
+  m_ContentLocated = true;
 }
 
-void GamebryoSaveGame::readOblivion(GamebryoSaveGame::FileWrapper &file)
+std::shared_ptr<IDecoder> GamebryoSaveGame::openBody(BodyFormat &format)
 {
-  file.setBZString(true);
+  waitForPhase(PHASE_COMPLETE);
 
-  file.skip<unsigned char>(); //Major version
-  file.skip<unsigned char>(); //Minor version
+  BodyLocation location;
+  {
+    std::lock_guard<std::mutex> lock(m_BodyMutex);
+    locateContent();
+    if (m_Body.format == BodyFormat::NONE) {
+      throw std::runtime_error("not supported for this game");
+    }
+    location = m_Body;
+  }
 
-  file.skip<WINSYSTEMTIME>();  // exe last modified (!)
+  FileWrapper file(this, determineEncoding(m_FileName));
+  if (location.compression != 0) {
+    file.seek(location.compressedOffset);
+    file.setCompression(location.compression, location.compressedSize, location.uncompressedSize);
+  }
+  file.seek(location.tableOffset);
+  format = location.format;
+  return file.decoder();
+}
 
-  file.skip<unsigned long>(); //Header version
-  file.skip<unsigned long>(); //Header size
+std::shared_ptr<const std::vector<uint8_t>> GamebryoSaveGame::globalData(uint32_t type)
+{
+  {
+    std::lock_guard<std::mutex> lock(m_GlobalDataMutex);
+    auto iter = m_GlobalData.find(type);
+    if (iter != m_GlobalData.end()) {
+      return iter->second;
+    }
+  }
 
-  file.read(m_SaveNumber);
+  BodyFormat format;
+  std::shared_ptr<IDecoder> decoder = openBody(format);
+  FileLocationTable table = readFileLocationTable(*decoder, format);
+  std::shared_ptr<std::vector<uint8_t>> data = std::make_shared<std::vector<uint8_t>>();
+  if (!readGlobalData(*decoder, table, type, *data)) {
+    data.reset();
+  }
 
-  file.read(m_PCName);
-  file.read(m_PCLevel);
-  file.read(m_PCLocation);
+  std::lock_guard<std::mutex> lock(m_GlobalDataMutex);
+  m_GlobalData[type] = data;
+  return data;
+}
 
-  float gameDays;
-  file.read(gameDays); //game days
-  m_Playtime =
-    std::to_string(static_cast<int>(floor(gameDays))) + " days, "
-    + std::to_string(static_cast<int>(static_cast<int>(gameDays * 24) % 24)) + " hours";
-  file.skip<unsigned long>(); //game ticks
+GamebryoSaveGame::~GamebryoSaveGame()
+{
+}
 
-  WINSYSTEMTIME winTime;
-  file.read(winTime);
-  tm timeStruct;
-  timeStruct.tm_year = winTime.wYear - 1900;
-  timeStruct.tm_mon = winTime.wMonth - 1;
-  timeStruct.tm_mday = winTime.wDay;
-  timeStruct.tm_hour = winTime.wHour;
-  timeStruct.tm_min = winTime.wMinute;
-  timeStruct.tm_sec = winTime.wSecond; 
-  m_CreationTime = mktime(&timeStruct);
+namespace {
 
-  if (!m_QuickRead) {
-    //Note that screenshot size, width, height and data are apparently the same
-    //structure
-    file.skip<unsigned long>(); //Screenshot size.
+const uint32_t SERIALIZE_VERSION = 1;
+const size_t SERIALIZE_HEADER_SIZE = 48;
 
-    file.readImage();
+void writeU32(uint8_t *out, size_t offset, uint32_t value) {
+  // all platforms we build for are little endian, which is what the layout specifies
+  memcpy(out + offset, &value, sizeof(uint32_t));
+}
+
+size_t writeString(uint8_t *out, size_t offset, const std::string &value) {
+  if (out != nullptr) {
+    writeU32(out, offset, static_cast<uint32_t>(value.size()));
+    memcpy(out + offset + sizeof(uint32_t), value.data(), value.size());
+  }
+  return offset + sizeof(uint32_t) + value.size();
+}
+
+}
+
+size_t GamebryoSaveGame::serialize(uint8_t *out, size_t capacity) const
+{
+  size_t offset = SERIALIZE_HEADER_SIZE;
+  for (const std::string *str : { &m_PCName, &m_PCLocation, &m_Playtime, &m_FileName }) {
+    offset = writeString(out, offset, *str);
+  }
+  for (const std::string &plugin : m_Plugins) {
+    offset = writeString(out, offset, plugin);
+  }
+
+  // align the pixels so they can be viewed through any typed array
+  size_t screenshotOffset = (offset + 15) & ~static_cast<size_t>(15);
+  size_t total = screenshotOffset + m_Screenshot.size();
+
+  if ((out == nullptr) || (capacity < total)) {
+    return total;
+  }
+
+  memcpy(out, "GBSV", 4);
+  writeU32(out, 4, SERIALIZE_VERSION);
+  writeU32(out, 8, static_cast<uint32_t>(total));
+  writeU32(out, 12, m_SaveNumber);
+  writeU32(out, 16, m_CreationTime);
+  writeU32(out, 20, m_PCLevel);
+  writeU32(out, 24, m_ScreenshotDim.width());
+  writeU32(out, 28, m_ScreenshotDim.height());
+  writeU32(out, 32, static_cast<uint32_t>(m_Plugins.size()));
+  writeU32(out, 36, static_cast<uint32_t>(screenshotOffset));
+  writeU32(out, 40, static_cast<uint32_t>(m_Screenshot.size()));
+  writeU32(out, 44, 0);
+
+  memset(out + offset, 0, screenshotOffset - offset);
+  m_Screenshot.copyTo(out + screenshotOffset);
+
+  return total;
+}
+
+namespace {
+
+// bump whenever the layout of CachedState or of the serialized record changes
+const uint32_t CACHE_ENTRY_VERSION = 1;
+
+/**
+ * parser state stored in shared cache entries in front of the (lz4 compressed) serialized record,
+ * so that the body can still be located in objects restored from the cache
+ */
+struct CachedState {
+  uint32_t version;
+  uint32_t game;
+  uint64_t headerVersion;
+  uint64_t contentOffset;
+  uint32_t serializedSize;
+  uint32_t compressedSize;
+  ScreenshotLayout screenshotLayout;
+};
+
+uint32_t readU32(const uint8_t *in, size_t offset) {
+  uint32_t value;
+  memcpy(&value, in + offset, sizeof(uint32_t));
+  return value;
+}
+
+bool readString(const uint8_t *in, size_t size, size_t &offset, std::string &value) {
+  if (offset + sizeof(uint32_t) > size) {
+    return false;
+  }
+  uint32_t length = readU32(in, offset);
+  offset += sizeof(uint32_t);
+  if (length > size - offset) {
+    return false;
+  }
+  value.assign(reinterpret_cast<const char*>(in + offset), length);
+  offset += length;
+  return true;
+}
+
+}
+
+bool GamebryoSaveGame::restoreCached(const std::vector<uint8_t> &entry)
+{
+  static void (GamebryoSaveGame::*const contentReaders[])(FileWrapper &file) = {
+    &GamebryoSaveGame::readOblivionContent,
+    &GamebryoSaveGame::readSkyrimContent,
+    &GamebryoSaveGame::readFO3Content,
+    &GamebryoSaveGame::readFO4Content,
+    &GamebryoSaveGame::readMorrowindContent,
+    &GamebryoSaveGame::readStarfieldContent,
+  };
+
+  CachedState state;
+  if (entry.size() < sizeof(CachedState)) {
+    return false;
+  }
+  memcpy(&state, entry.data(), sizeof(CachedState));
+  if ((state.version != CACHE_ENTRY_VERSION)
+      || (state.game >= sizeof(contentReaders) / sizeof(contentReaders[0]))
+      || (state.compressedSize != entry.size() - sizeof(CachedState))
+      || (state.serializedSize < SERIALIZE_HEADER_SIZE)) {
+    return false;
+  }
+
+  std::vector<uint8_t> record(state.serializedSize);
+  int res = LZ4_decompress_safe(reinterpret_cast<const char*>(entry.data() + sizeof(CachedState)),
+                                reinterpret_cast<char*>(record.data()),
+                                static_cast<int>(state.compressedSize), static_cast<int>(state.serializedSize));
+  if ((res != static_cast<int>(state.serializedSize))
+      || (memcmp(record.data(), "GBSV", 4) != 0)
+      || (readU32(record.data(), 4) != SERIALIZE_VERSION)
+      || (readU32(record.data(), 8) != state.serializedSize)) {
+    return false;
+  }
+
+  const uint8_t *in = record.data();
+  size_t size = record.size();
+  uint32_t pluginCount = readU32(in, 32);
+  uint32_t screenshotOffset = readU32(in, 36);
+  uint32_t screenshotSize = readU32(in, 40);
+  if ((screenshotOffset > size) || (screenshotSize > size - screenshotOffset)) {
+    return false;
+  }
+
+  size_t offset = SERIALIZE_HEADER_SIZE;
+  std::string fileName;
+  std::vector<std::string> plugins(std::min<size_t>(pluginCount, size / sizeof(uint32_t)));
+  if (plugins.size() != pluginCount) {
+    return false;
+  }
+  for (std::string *str : { &m_PCName, &m_PCLocation, &m_Playtime, &fileName }) {
+    if (!readString(in, size, offset, *str)) {
+      return false;
+    }
+  }
+  for (std::string &plugin : plugins) {
+    if (!readString(in, size, offset, plugin)) {
+      return false;
+    }
+  }
+
+  m_SaveNumber = readU32(in, 12);
+  m_CreationTime = readU32(in, 16);
+  m_PCLevel = static_cast<uint16_t>(readU32(in, 20));
+  m_ScreenshotDim = Dimensions(readU32(in, 24), readU32(in, 28));
+  m_Plugins = std::move(plugins);
+  for (const std::string &plugin : m_Plugins) {
+    m_PluginFingerprint.add(plugin);
+  }
+  if (screenshotSize > 0) {
+    std::vector<uint8_t> pixels = BufferPool::instance().acquire(screenshotSize);
+    memcpy(pixels.data(), in + screenshotOffset, screenshotSize);
+    m_Screenshot.assign(std::move(pixels));
+  }
+
+  m_HeaderVersion = static_cast<unsigned long>(state.headerVersion);
+  m_ContentOffset = state.contentOffset;
+  m_ContentReader = contentReaders[state.game];
+  m_ScreenshotLayout = state.screenshotLayout;
+  // the body location isn't cached, it gets determined again when needed
+  m_ContentLocated = false;
+  return true;
+}
+
+void GamebryoSaveGame::storeCached(SharedCache &cache, const SharedCache::Key &key) const
+{
+  CachedState state;
+  memset(&state, 0, sizeof(CachedState));
+  state.version = CACHE_ENTRY_VERSION;
+  if (m_ContentReader == &GamebryoSaveGame::readOblivionContent) {
+    state.game = 0;
+  } else if (m_ContentReader == &GamebryoSaveGame::readSkyrimContent) {
+    state.game = 1;
+  } else if (m_ContentReader == &GamebryoSaveGame::readFO3Content) {
+    state.game = 2;
+  } else if (m_ContentReader == &GamebryoSaveGame::readFO4Content) {
+    state.game = 3;
+  } else if (m_ContentReader == &GamebryoSaveGame::readMorrowindContent) {
+    state.game = 4;
+  } else if (m_ContentReader == &GamebryoSaveGame::readStarfieldContent) {
+    state.game = 5;
+  } else {
+    return;
+  }
+  state.headerVersion = m_HeaderVersion;
+  state.contentOffset = m_ContentOffset;
+  state.screenshotLayout = m_ScreenshotLayout;
+
+  std::vector<uint8_t> record(serialize(nullptr, 0));
+  try {
+    serialize(record.data(), record.size());
+  }
+  catch (const std::exception&) {
+    // the screenshot is loaded from a file that changed since it was read
+    return;
+  }
+
+  int bound = LZ4_compressBound(static_cast<int>(record.size()));
+  std::vector<uint8_t> entry(sizeof(CachedState) + bound);
+  int compressedSize = LZ4_compress_default(reinterpret_cast<const char*>(record.data()),
+                                            reinterpret_cast<char*>(entry.data() + sizeof(CachedState)),
+                                            static_cast<int>(record.size()), bound);
+  if (compressedSize <= 0) {
+    return;
+  }
+  state.serializedSize = static_cast<uint32_t>(record.size());
+  state.compressedSize = static_cast<uint32_t>(compressedSize);
+  memcpy(entry.data(), &state, sizeof(CachedState));
+
+  // without content support a full read has no more data than a quick one, don't claim otherwise
+  cache.store(key, entry.data(), sizeof(CachedState) + compressedSize, !m_QuickRead && contentSupported());
+}
+
+void GamebryoSaveGame::storeThumbnail(ThumbnailStore &store, const FileKey &key) const
+{
+  if ((m_Screenshot.size() == 0) || store.has(key)) {
+    return;
+  }
+  std::vector<uint8_t> pixels = BufferPool::instance().acquire(m_Screenshot.size());
+  try {
+    m_Screenshot.copyTo(pixels.data());
+  }
+  catch (const std::exception&) {
+    // the screenshot is loaded from a file that changed since it was read
+    BufferPool::instance().release(std::move(pixels));
+    return;
+  }
+  store.add(key, pixels.data(), m_ScreenshotDim.width(), m_ScreenshotDim.height());
+  BufferPool::instance().release(std::move(pixels));
+}
+
+// don't want no dependency on windows header
+struct WINSYSTEMTIME {
+  uint16_t wYear;
+  uint16_t wMonth;
+  uint16_t wDayOfWeek;
+  uint16_t wDay;
+  uint16_t wHour;
+  uint16_t wMinute;
+  uint16_t wSecond;
+  uint16_t wMilliseconds;
+};
+
+CodePage GamebryoSaveGame::determineEncoding(const std::string &fileName) {
+  // determine code page based on file-name. Currently only supporting cyrillic
+  // This is a heuristic: if more than 50% of the file name (which is unicode) are cyrillic characters,
+  // we assume the file _content_ (which is single-byte characters) is in the corresponding code page
+#ifdef _WIN32
+  // pretty hacky way to reduce the file path to just the name without extension
+  size_t nameOffset = fileName.find_last_of("/\\");
+  nameOffset = nameOffset == std::string::npos ? 0 : nameOffset + 1;
+  std::wstring fileNameW = toWC(fileName.c_str() + nameOffset, CodePage::UTF8, fileName.size() - nameOffset - 4);
+
+  // filter out numbers and symbols that are identical across code pages anyway
+  std::wstring relevantChars;
+  std::copy_if(fileNameW.begin(), fileNameW.end(), std::back_inserter(relevantChars), [](wchar_t ch) { return !ignoreChar(ch); });
+
+  // determine percentage of cyrillic characters, if > 50%, assume the file is encoded cyrillic
+  int cyrillicChars = std::count_if(relevantChars.begin(), relevantChars.end(),
+    [](wchar_t ch) { return isCharCyrillic(ch); });
+
+  if ((relevantChars.length() > 0)
+      && ((cyrillicChars * 100) / relevantChars.length() > 50)) {
+    return CodePage::CYRILLIC;
+  }
+#endif
+  // the chinese version at least seems to use unicode.
+  // Just in case decoding as utf8 doesn't work, assume it's latin1
+  return CodePage::UTF8ORLATIN1;
+}
+
+void GamebryoSaveGame::readOblivion(GamebryoSaveGame::FileWrapper &file)
+{
+  file.setBZString(true);
+
+  file.skip<unsigned char>(); //Major version
+  file.skip<unsigned char>(); //Minor version
+
+  file.skip<WINSYSTEMTIME>();  // exe last modified (!)
+
+  file.skip<unsigned long>(); //Header version
+  m_ScreenshotLayout.headerSizeOffset = file.tell();
+  file.skip<unsigned long>(); //Header size (including the screenshot)
+
+  file.read(m_SaveNumber);
+
+  file.read(m_PCName);
+  file.read(m_PCLevel);
+  file.read(m_PCLocation);
+
+  float gameDays;
+  file.read(gameDays); //game days
+  m_Playtime =
+    std::to_string(static_cast<int>(floor(gameDays))) + " days, "
+    + std::to_string(static_cast<int>(static_cast<int>(gameDays * 24) % 24)) + " hours";
+  file.skip<unsigned long>(); //game ticks
+
+  WINSYSTEMTIME winTime;
+  file.read(winTime);
+  tm timeStruct;
+  timeStruct.tm_year = winTime.wYear - 1900;
+  timeStruct.tm_mon = winTime.wMonth - 1;
+  timeStruct.tm_mday = winTime.wDay;
+  timeStruct.tm_hour = winTime.wHour;
+  timeStruct.tm_min = winTime.wMinute;
+  timeStruct.tm_sec = winTime.wSecond; 
+  m_CreationTime = mktime(&timeStruct);
 
-    file.readPlugins(true);
+  m_ContentOffset = file.tell();
+  m_ContentReader = &GamebryoSaveGame::readOblivionContent;
+  setPhase(PHASE_HEADER);
+
+  if (!m_QuickRead) {
+    readOblivionContent(file);
   }
 }
 
+void GamebryoSaveGame::readOblivionContent(GamebryoSaveGame::FileWrapper &file)
+{
+  // again, in case this is a new wrapper revisiting the content
+  file.setBZString(true);
+
+  //Note that screenshot size, width, height and data are apparently the same
+  //structure
+  m_ScreenshotLayout.sizeOffset = file.tell();
+  file.skip<unsigned long>(); //Screenshot size.
+
+  file.readImage();
+
+  file.readPlugins(true);
+}
+
 void GamebryoSaveGame::readSkyrim(GamebryoSaveGame::FileWrapper &file)
 {
   file.skip<unsigned long>(); // header size
@@ -380,39 +1307,53 @@ void GamebryoSaveGame::readSkyrim(GamebryoSaveGame::FileWrapper &file)
   file.read(ftime);
   m_CreationTime = windowsTicksToEpoch(ftime);
 
-  if (!m_QuickRead) {
-    if (version < 0x0c) {
-      // original skyrim format
-      file.readImage();
-    }
-    else {
-      // Skyrim SE - same header, different version
-      unsigned long width;
-      file.read(width);
-      unsigned long height;
-      file.read(height);
-      unsigned short compressionFormat;
-      file.read(compressionFormat);
+  m_HeaderVersion = version;
+  m_ContentOffset = file.tell();
+  m_ContentReader = &GamebryoSaveGame::readSkyrimContent;
+  setPhase(PHASE_HEADER);
 
-      file.readImage(width, height, true);
-
-      // the rest of the file is compressed in Skyrim SE
-      unsigned long compressed, uncompressed;
-      file.read(uncompressed);
-      file.read(compressed);
+  if (!m_QuickRead) {
+    readSkyrimContent(file);
+  }
+}
 
-      file.setCompression(compressionFormat, compressed, uncompressed);
-    }
+void GamebryoSaveGame::readSkyrimContent(GamebryoSaveGame::FileWrapper &file)
+{
+  if (m_HeaderVersion < 0x0c) {
+    // original skyrim format
+    file.readImage();
+  }
+  else {
+    // Skyrim SE - same header, different version
+    unsigned long width;
+    m_ScreenshotLayout.widthOffset = file.tell();
+    file.read(width);
+    unsigned long height;
+    m_ScreenshotLayout.heightOffset = file.tell();
+    file.read(height);
+    unsigned short compressionFormat;
+    file.read(compressionFormat);
+
+    file.readImage(width, height, true);
+
+    // the rest of the file is compressed in Skyrim SE
+    unsigned long compressed, uncompressed;
+    file.read(uncompressed);
+    file.read(compressed);
+
+    file.setCompression(compressionFormat, compressed, uncompressed);
+  }
 
-    unsigned char formVersion;
-    file.read(formVersion); // form version
-    file.skip<unsigned long>(); // plugin info size
-    file.readPlugins();
+  unsigned char formVersion;
+  file.read(formVersion); // form version
+  file.skip<unsigned long>(); // plugin info size
+  file.readPlugins();
 
-    if (formVersion >= 0x4e) {
-      file.readLightPlugins();
-    }
+  if (formVersion >= 0x4e) {
+    file.readLightPlugins();
   }
+
+  m_Body = file.bodyLocation(BodyFormat::SKYRIM);
 }
 
 void GamebryoSaveGame::readFO3(GamebryoSaveGame::FileWrapper &file)
@@ -440,10 +1381,14 @@ void GamebryoSaveGame::readFO3(GamebryoSaveGame::FileWrapper &file)
   file.setHasFieldMarkers(true);
 
   unsigned long width;
+  m_ScreenshotLayout.widthOffset = file.tell();
   file.read(width);
+  m_ScreenshotLayout.width = width;
 
   unsigned long height;
+  m_ScreenshotLayout.heightOffset = file.tell();
   file.read(height);
+  m_ScreenshotLayout.height = height;
 
   file.read(m_SaveNumber);
 
@@ -460,13 +1405,25 @@ void GamebryoSaveGame::readFO3(GamebryoSaveGame::FileWrapper &file)
 
   file.read(m_Playtime);
 
+  m_ContentOffset = file.tell();
+  m_ContentReader = &GamebryoSaveGame::readFO3Content;
+  setPhase(PHASE_HEADER);
+
   if (!m_QuickRead) {
-    file.readImage(width, height);
+    readFO3Content(file);
+  }
+}
+
+void GamebryoSaveGame::readFO3Content(GamebryoSaveGame::FileWrapper &file)
+{
+  // again, in case this is a new wrapper revisiting the content
+  file.setHasFieldMarkers(true);
 
-    file.skip<char>(5); // unknown byte, size of plugin data
+  file.readImage(m_ScreenshotLayout.width, m_ScreenshotLayout.height);
 
-    file.readPlugins();
-  }
+  file.skip<char>(5); // unknown byte, size of plugin data
+
+  file.readPlugins();
 }
 
 void GamebryoSaveGame::readFO4(GamebryoSaveGame::FileWrapper &file)
@@ -492,22 +1449,218 @@ void GamebryoSaveGame::readFO4(GamebryoSaveGame::FileWrapper &file)
   uint64_t ftime;
   file.read(ftime);
   m_CreationTime = windowsTicksToEpoch(ftime);
-  
+
+  m_ContentOffset = file.tell();
+  m_ContentReader = &GamebryoSaveGame::readFO4Content;
+  setPhase(PHASE_HEADER);
+
   if (!m_QuickRead) {
-    file.readImage(true);
+    readFO4Content(file);
+  }
+}
 
-    uint8_t formVersion;
-    file.read(formVersion);
-    file.read(ignore);          // game version
-    file.skip<uint32_t>(); // plugin info size
+void GamebryoSaveGame::readFO4Content(GamebryoSaveGame::FileWrapper &file)
+{
+  std::string ignore;
+  file.readImage(true);
 
-    file.readPlugins();
+  uint8_t formVersion;
+  file.read(formVersion);
+  file.read(ignore);          // game version
+  file.skip<uint32_t>(); // plugin info size
 
-    if (formVersion >= 0x44) {
-      // lazy: just read the esls into the existing plugin list
-      file.readLightPlugins();
+  file.readPlugins();
+
+  if (formVersion >= 0x44) {
+    // lazy: just read the esls into the existing plugin list
+    file.readLightPlugins();
+  }
+
+  m_Body = file.bodyLocation(BodyFormat::FALLOUT4);
+}
+
+namespace {
+
+// header of records and subrecords in Morrowind saves, which use the plugin format. Records have
+// another 8 bytes (unused, flags) after this
+struct TES3Tag {
+  char type[4];
+  uint32_t size;
+
+  bool is(const char *expected) const {
+    return memcmp(type, expected, 4) == 0;
+  }
+};
+
+const uint32_t TES3_RECORD_HEADER_SIZE = 16;
+const uint32_t TES3_GAME_DATA_SIZE = 124;
+const unsigned long TES3_SCREENSHOT_SIZE = 128;
+
+bool equalsCaseInsensitive(const std::string &lhs, const char *rhs) {
+  size_t length = strlen(rhs);
+  if (lhs.length() != length) {
+    return false;
+  }
+  for (size_t i = 0; i < length; ++i) {
+    if (tolower(static_cast<unsigned char>(lhs[i])) != tolower(static_cast<unsigned char>(rhs[i]))) {
+      return false;
     }
   }
+  return true;
+}
+
+}
+
+void GamebryoSaveGame::readMorrowind(GamebryoSaveGame::FileWrapper &file)
+{
+  // the TES3 record holds masters, game data (name, location) and screenshot. The level is only
+  // found in the record of the player character further in, records are skipped by their size
+  // without reading the payload to get there. The content (masters and screenshot) gets read
+  // from the TES3 record afterwards
+  uint64_t fileSize = file.size();
+  m_ContentOffset = file.tell();
+
+  uint32_t recordSize;
+  file.read(recordSize);
+  file.skip<uint32_t>(2); // unused, flags
+  uint64_t recordEnd = file.tell() + recordSize;
+  file.sanityCheck(recordEnd <= fileSize, "invalid header size");
+
+  while (file.tell() < recordEnd) {
+    TES3Tag sub;
+    file.read(sub);
+    uint64_t subEnd = file.tell() + sub.size;
+    file.sanityCheck(subEnd <= recordEnd, "invalid subrecord size");
+    if (sub.is("GMDT")) {
+      file.sanityCheck(sub.size >= TES3_GAME_DATA_SIZE, "invalid game data size");
+      file.skip<float>(3); // health, maximum health, hour
+      file.skip<uint8_t>(12);
+      file.readFixedString(m_PCLocation, 64);
+      file.skip<uint8_t>(4);
+      file.readFixedString(m_PCName, 32);
+    }
+    file.seek(subEnd);
+  }
+
+  // in-game time is kept in globals, which come first
+  float daysPassed = 0.0f;
+  float gameHour = 0.0f;
+  bool playerFound = false;
+  while (!playerFound && (file.tell() + TES3_RECORD_HEADER_SIZE <= fileSize)) {
+    TES3Tag record;
+    file.read(record);
+    file.skip<uint32_t>(2);
+    uint64_t end = file.tell() + record.size;
+    file.sanityCheck(end <= fileSize, "invalid record size");
+
+    bool global = record.is("GLOB");
+    if (global || record.is("NPC_")) {
+      std::string id;
+      while (!playerFound && (file.tell() + sizeof(TES3Tag) <= end)) {
+        TES3Tag sub;
+        file.read(sub);
+        uint64_t subEnd = file.tell() + sub.size;
+        file.sanityCheck(subEnd <= end, "invalid subrecord size");
+        if (sub.is("NAME")) {
+          file.readFixedString(id, sub.size);
+        } else if (global && sub.is("FLTV") && (sub.size >= sizeof(float))) {
+          float value;
+          file.read(value);
+          if (equalsCaseInsensitive(id, "DaysPassed")) {
+            daysPassed = value;
+          } else if (equalsCaseInsensitive(id, "GameHour")) {
+            gameHour = value;
+          }
+        } else if (!global && sub.is("NPDT") && (sub.size >= sizeof(int16_t))
+                   && equalsCaseInsensitive(id, "player")) {
+          int16_t level;
+          file.read(level);
+          m_PCLevel = static_cast<uint16_t>(level);
+          playerFound = true;
+        }
+        file.seek(subEnd);
+      }
+    }
+    file.seek(end);
+  }
+
+  m_Playtime =
+    std::to_string(static_cast<int>(daysPassed)) + " days, "
+    + std::to_string(static_cast<int>(gameHour)) + " hours";
+
+  m_ContentReader = &GamebryoSaveGame::readMorrowindContent;
+  setPhase(PHASE_HEADER);
+
+  if (!m_QuickRead) {
+    file.seek(m_ContentOffset);
+    readMorrowindContent(file);
+  }
+}
+
+void GamebryoSaveGame::readMorrowindContent(GamebryoSaveGame::FileWrapper &file)
+{
+  uint32_t recordSize;
+  file.read(recordSize);
+  file.skip<uint32_t>(2);
+  uint64_t recordEnd = file.tell() + recordSize;
+
+  while (file.tell() < recordEnd) {
+    TES3Tag sub;
+    file.read(sub);
+    uint64_t subEnd = file.tell() + sub.size;
+    file.sanityCheck(subEnd <= recordEnd, "invalid subrecord size");
+    if (sub.is("MAST")) {
+      file.readPlugin(sub.size);
+    } else if (sub.is("SCRS")) {
+      file.sanityCheck(sub.size == TES3_SCREENSHOT_SIZE * TES3_SCREENSHOT_SIZE * 4, "invalid screenshot size");
+      file.readImageBGRX(TES3_SCREENSHOT_SIZE, TES3_SCREENSHOT_SIZE);
+    }
+    file.seek(subEnd);
+  }
+}
+
+void GamebryoSaveGame::readStarfield(GamebryoSaveGame::FileWrapper &file)
+{
+  // same layout as fallout 4, read from the decompressed container
+  uint32_t headerSize;
+  file.read(headerSize);
+  // the fields are read a few bytes at a time, get the chunks they span decompressed together
+  file.prefetch(headerSize);
+  file.skip<uint32_t>(); // header version
+  file.skip<uint8_t>();
+  file.read(m_SaveNumber);
+
+  file.read(m_PCName);
+
+  uint32_t temp;
+  file.read(temp);
+  m_PCLevel = static_cast<uint16_t>(temp);
+  file.read(m_PCLocation);
+
+  file.read(m_Playtime);
+  std::string ignore;
+  file.read(ignore);   // race name
+
+  file.skip<uint16_t>(); // Player gender (0 = male)
+  file.skip<float>(2);         // experience gathered, experience required
+
+  uint64_t ftime;
+  file.read(ftime);
+  m_CreationTime = windowsTicksToEpoch(ftime);
+
+  m_ContentOffset = file.tell();
+  m_ContentReader = &GamebryoSaveGame::readStarfieldContent;
+  setPhase(PHASE_HEADER);
+
+  if (!m_QuickRead) {
+    readStarfieldContent(file);
+  }
+}
+
+void GamebryoSaveGame::readStarfieldContent(GamebryoSaveGame::FileWrapper&)
+{
+  // the content isn't parsed (yet), only the header fields are supported for Starfield. The saves
+  // have no screenshot, plugins and body are reported as unsupported (see contentSupported)
 }
 
 GamebryoSaveGame::FileWrapper::FileWrapper(GamebryoSaveGame *game, CodePage encoding)
@@ -515,6 +1668,12 @@ GamebryoSaveGame::FileWrapper::FileWrapper(GamebryoSaveGame *game, CodePage enco
   , m_Decoder(new DirectDecoder(game->m_FileName))
   , m_HasFieldMarkers(false)
   , m_BZString(false)
+  , m_Discard(false)
+  , m_Compressed(false)
+  , m_CompressionFormat(0)
+  , m_CompressedOffset(0)
+  , m_CompressedSize(0)
+  , m_UncompressedSize(0)
   , m_Encoding(encoding)
 {
 }
@@ -539,6 +1698,11 @@ void GamebryoSaveGame::FileWrapper::setBZString(bool state)
   m_BZString = state;
 }
 
+void GamebryoSaveGame::FileWrapper::setDiscard(bool state)
+{
+  m_Discard = state;
+}
+
 void GamebryoSaveGame::FileWrapper::readBString(std::string &value)
 {
   unsigned char length;
@@ -577,6 +1741,12 @@ template <> void GamebryoSaveGame::FileWrapper::read(std::string &value)
     }
   }
 
+  if (CpuDispatch::kernels().isASCII(buffer.data(), buffer.size())) {
+    // reads the same in every code page, no need to convert
+    value = buffer.c_str();
+    return;
+  }
+
   value = toMB(toWC(buffer.c_str(), m_Encoding, length).c_str(), CodePage::UTF8, length);
 }
 
@@ -592,8 +1762,10 @@ void GamebryoSaveGame::FileWrapper::read(void *buff, std::size_t length)
 void GamebryoSaveGame::FileWrapper::readImage(bool alpha)
 {
   unsigned long width;
+  m_Game->m_ScreenshotLayout.widthOffset = tell();
   read(width);
   unsigned long height;
+  m_Game->m_ScreenshotLayout.heightOffset = tell();
   read(height);
   readImage(width, height, alpha);
 }
@@ -608,31 +1780,48 @@ void GamebryoSaveGame::FileWrapper::readImage(unsigned long width, unsigned long
 
   int bytes = width * height * bpp;
 
-  std::vector<uint8_t> buffer;
-  buffer.resize(bytes);
+  m_Game->m_ScreenshotLayout.pixelOffset = tell();
+  m_Game->m_ScreenshotLayout.width = width;
+  m_Game->m_ScreenshotLayout.height = height;
+  m_Game->m_ScreenshotLayout.bytesPerPixel = bpp;
+
+  if (m_Discard) {
+    skip<uint8_t>(bytes);
+    return;
+  }
 
   m_Game->m_ScreenshotDim = Dimensions(width, height);
 
+  if (bytes == 0) {
+    // screenshot removed through rewriteScreenshot, nothing to read
+    m_Game->m_Screenshot.assign(std::vector<uint8_t>());
+    m_Game->setPhase(PHASE_SCREENSHOT);
+    return;
+  }
+
+  if (alpha && !m_Compressed && Screenshot::deferLoading()) {
+    // the pixels are stored in the file exactly the way we need them, load them only once they're used
+    m_Game->m_Screenshot.assignDeferred(std::make_shared<FileRegion>(m_Game->m_FileName, tell(), bytes));
+    skip<uint8_t>(bytes);
+    m_Game->setPhase(PHASE_SCREENSHOT);
+    return;
+  }
+
+  std::vector<uint8_t> buffer = BufferPool::instance().acquire(bytes);
+
   read(&buffer[0], bytes);
 
   if (alpha) {
     // no postprocessing necessary
-    m_Game->m_Screenshot = std::move(buffer);
+    m_Game->m_Screenshot.assign(std::move(buffer));
   } else {
-    // begin scary
-    std::vector<uint8_t> rgba;
-    rgba.resize(width * height * 4);
-    uint8_t *in = &buffer[0];
-    uint8_t *out = &rgba[0];
-    uint8_t *end = in + bytes;
-    for (; in < end; in += 3, out += 4) {
-      memcpy(out, in, 3);
-      out[3] = 0xFF;
-    }
-    // end scary
+    std::vector<uint8_t> rgba = BufferPool::instance().acquire(width * height * 4);
+    CpuDispatch::kernels().expandRGB(&buffer[0], &rgba[0], width * height);
 
-    m_Game->m_Screenshot = std::move(rgba);
+    BufferPool::instance().release(std::move(buffer));
+    m_Game->m_Screenshot.assign(std::move(rgba));
   }
+  m_Game->setPhase(PHASE_SCREENSHOT);
 }
 
 void GamebryoSaveGame::FileWrapper::readPlugins(bool bStrings)
@@ -648,7 +1837,10 @@ void GamebryoSaveGame::FileWrapper::readPlugins(bool bStrings)
       read(name);
     }
     sanityCheck(name.length() <= 256, "Invalid plugin name");
-    m_Game->m_Plugins.push_back(name);
+    if (!m_Discard) {
+      m_Game->m_Plugins.push_back(name);
+      m_Game->m_PluginFingerprint.add(name);
+    }
   }
 }
 
@@ -660,12 +1852,79 @@ void GamebryoSaveGame::FileWrapper::readLightPlugins()
     std::string name;
     read(name);
     sanityCheck(name.length() <= 256, "Invalid light plugin name");
+    if (!m_Discard) {
+      m_Game->m_Plugins.push_back(name);
+      m_Game->m_PluginFingerprint.add(name);
+    }
+  }
+}
+
+void GamebryoSaveGame::FileWrapper::readFixedString(std::string &value, size_t length)
+{
+  std::string buffer;
+  buffer.resize(length);
+  if (length > 0) {
+    read(&buffer[0], length);
+  }
+  size_t end = buffer.find('\0');
+  if (end != std::string::npos) {
+    buffer.resize(end);
+  }
+
+  value = toMB(toWC(buffer.c_str(), m_Encoding, buffer.length()).c_str(), CodePage::UTF8, buffer.length());
+}
+
+void GamebryoSaveGame::FileWrapper::readPlugin(size_t length)
+{
+  std::string name;
+  readFixedString(name, length);
+  sanityCheck(name.length() <= 256, "Invalid plugin name");
+  if (!m_Discard) {
     m_Game->m_Plugins.push_back(name);
+    m_Game->m_PluginFingerprint.add(name);
   }
 }
 
+void GamebryoSaveGame::FileWrapper::readImageBGRX(unsigned long width, unsigned long height)
+{
+  int bytes = width * height * 4;
+
+  m_Game->m_ScreenshotLayout.pixelOffset = tell();
+  m_Game->m_ScreenshotLayout.width = width;
+  m_Game->m_ScreenshotLayout.height = height;
+  // there are no size fields to adjust, so this can't be rewritten
+  m_Game->m_ScreenshotLayout.bytesPerPixel = 0;
+
+  if (m_Discard) {
+    skip<uint8_t>(bytes);
+    return;
+  }
+
+  m_Game->m_ScreenshotDim = Dimensions(width, height);
+
+  std::vector<uint8_t> rgba = BufferPool::instance().acquire(bytes);
+  read(&rgba[0], bytes);
+  CpuDispatch::kernels().convertBGRX(&rgba[0], width * height);
+  m_Game->m_Screenshot.assign(std::move(rgba));
+  m_Game->setPhase(PHASE_SCREENSHOT);
+}
+
+uint64_t GamebryoSaveGame::FileWrapper::size()
+{
+  size_t pos = m_Decoder->tell();
+  m_Decoder->seek(0, std::ios::end);
+  size_t result = m_Decoder->tell();
+  m_Decoder->seek(pos);
+  return result;
+}
+
 void GamebryoSaveGame::FileWrapper::setCompression(unsigned short format, unsigned long compressedSize, unsigned long uncompressedSize)
 {
+  m_Compressed = true;
+  m_CompressionFormat = format;
+  m_CompressedOffset = tell();
+  m_CompressedSize = compressedSize;
+  m_UncompressedSize = uncompressedSize;
   if (format == 1) {
     m_Decoder.reset(new ZlibDecoder(m_Decoder, compressedSize, uncompressedSize));
   } else if (format == 2) {
@@ -673,12 +1932,176 @@ void GamebryoSaveGame::FileWrapper::setCompression(unsigned short format, unsign
   }
 }
 
+GamebryoSaveGame::BodyLocation GamebryoSaveGame::FileWrapper::bodyLocation(BodyFormat format)
+{
+  BodyLocation result;
+  result.format = format;
+  result.compression = m_Compressed ? m_CompressionFormat : 0;
+  result.compressedOffset = m_CompressedOffset;
+  result.compressedSize = m_CompressedSize;
+  result.uncompressedSize = m_UncompressedSize;
+  result.tableOffset = tell();
+  return result;
+}
+
+bool GamebryoSaveGame::FileWrapper::unwrapContainer()
+{
+  if (!header("BCPS")) {
+    return false;
+  }
+  m_Decoder = ChunkedDecoder::openBCPS(m_Decoder);
+  m_Compressed = true;
+  return true;
+}
+
+void GamebryoSaveGame::FileWrapper::prefetch(uint64_t size)
+{
+  if (ChunkedDecoder *decoder = dynamic_cast<ChunkedDecoder*>(m_Decoder.get())) {
+    decoder->prefetch(decoder->tell(), static_cast<size_t>(size));
+  }
+}
+
+double GamebryoSaveGame::FileWrapper::decompressTime() const
+{
+  if (const LazyDecoder *decoder = dynamic_cast<const LazyDecoder*>(m_Decoder.get())) {
+    return decoder->decodeTime();
+  }
+  if (const ChunkedDecoder *decoder = dynamic_cast<const ChunkedDecoder*>(m_Decoder.get())) {
+    return decoder->decodeTime();
+  }
+  return 0.0;
+}
+
 void GamebryoSaveGame::FileWrapper::sanityCheck(bool conditionMatch, const char* message) {
   if (!conditionMatch) {
     throw DataInvalid(message, m_Decoder->tell());
   }
 }
 
+Napi::Value configure(const Napi::CallbackInfo &info) {
+  Napi::Object options = info[0].ToObject();
+
+  if (options.Has("screenshotRetention") || options.Has("screenshotCacheSize")) {
+    Screenshot::Retention retention = Screenshot::retention();
+    if (options.Has("screenshotRetention")) {
+      std::string value = options.Get("screenshotRetention").ToString();
+      if (value == "raw") {
+        retention = Screenshot::Retention::RAW;
+      } else if (value == "compressed") {
+        retention = Screenshot::Retention::COMPRESSED;
+      } else {
+        throw Napi::Error::New(info.Env(), fmt::format("invalid screenshot retention \"{}\"", value));
+      }
+    }
+    uint32_t cacheSize = options.Has("screenshotCacheSize")
+      ? options.Get("screenshotCacheSize").ToNumber().Uint32Value()
+      : 8;
+    Screenshot::setRetention(retention, cacheSize);
+  }
+
+  if (options.Has("bufferPoolSize")) {
+    BufferPool::instance().setCapacity(static_cast<size_t>(options.Get("bufferPoolSize").ToNumber().Int64Value()));
+  }
+
+  if (options.Has("mapScreenshots")) {
+    Screenshot::setDeferLoading(options.Get("mapScreenshots").ToBoolean());
+  }
+
+  if (options.Has("decompressMemoryLimit")) {
+    ScratchBuffer::setMemoryLimit(static_cast<size_t>(options.Get("decompressMemoryLimit").ToNumber().Int64Value()));
+  }
+
+  if (options.Has("scratchDirectory")) {
+    ScratchBuffer::setDirectory(options.Get("scratchDirectory").ToString().Utf8Value());
+  }
+
+  if (options.Has("deliveryBatchSize")) {
+    ResultDelivery::setBatchSize(options.Get("deliveryBatchSize").ToNumber().Uint32Value());
+  }
+
+  if (options.Has("readConcurrency") || options.Has("maxReadConcurrency")) {
+    ReadScheduler::Stats current = ReadScheduler::instance().stats();
+    uint32_t limit = options.Has("readConcurrency")
+      ? options.Get("readConcurrency").ToNumber().Uint32Value()
+      : (current.adaptive ? 0 : current.limit);
+    uint32_t maxLimit = options.Has("maxReadConcurrency")
+      ? options.Get("maxReadConcurrency").ToNumber().Uint32Value()
+      : 0;
+    ReadScheduler::instance().configure(limit, maxLimit);
+  }
+
+  if (options.Has("thumbnailDirectory")) {
+    uint32_t size = options.Has("thumbnailSize")
+      ? options.Get("thumbnailSize").ToNumber().Uint32Value()
+      : 256;
+    try {
+      ThumbnailStore::configure(options.Get("thumbnailDirectory").ToString().Utf8Value(), size);
+    }
+    catch (const std::exception &e) {
+      throw Napi::Error::New(info.Env(), e.what());
+    }
+  }
+
+  if (options.Has("trimOnMemoryPressure")) {
+    MemoryPressure::instance().setMonitoring(options.Get("trimOnMemoryPressure").ToBoolean());
+  }
+
+  if (options.Has("slowLogThreshold") || options.Has("slowLogSize")) {
+    SlowLog::instance().configure(
+      options.Has("slowLogThreshold") ? options.Get("slowLogThreshold").ToNumber().DoubleValue() : 0.0,
+      options.Has("slowLogSize") ? options.Get("slowLogSize").ToNumber().Uint32Value() : 0);
+  }
+
+  if (options.Has("cpuLevel")) {
+    std::string value = options.Get("cpuLevel").ToString();
+    CpuDispatch::Level level = CpuDispatch::detected();
+    if ((value != "auto") && !CpuDispatch::parseLevel(value, level)) {
+      throw Napi::Error::New(info.Env(), fmt::format("invalid cpu level \"{}\"", value));
+    }
+    try {
+      CpuDispatch::setLevel(level);
+    }
+    catch (const std::exception &e) {
+      throw Napi::Error::New(info.Env(), e.what());
+    }
+  }
+
+  if (options.Has("staleWhileRevalidate")) {
+    s_StaleWhileRevalidate = options.Get("staleWhileRevalidate").ToBoolean();
+  }
+
+  if (options.Has("sharedCache")) {
+    uint64_t size = options.Has("sharedCacheSize")
+      ? static_cast<uint64_t>(options.Get("sharedCacheSize").ToNumber().Int64Value())
+      : 64 * 1024 * 1024;
+    uint32_t slotSize = options.Has("sharedCacheSlotSize")
+      ? options.Get("sharedCacheSlotSize").ToNumber().Uint32Value()
+      : 256 * 1024;
+    try {
+      SharedCache::configure(options.Get("sharedCache").ToString().Utf8Value(), size, slotSize);
+    }
+    catch (const std::exception &e) {
+      throw Napi::Error::New(info.Env(), e.what());
+    }
+  }
+
+  return info.Env().Undefined();
+}
+
+Napi::Value openSave(const Napi::CallbackInfo &info) {
+  try {
+    std::string fileName = info[0].ToString().Utf8Value();
+    bool quick = info[1].ToBoolean();
+
+    Napi::Object obj = GamebryoSaveGame::CreateNewItem(info.Env());
+    GamebryoSaveGame::Unwrap(obj)->openAsync(info.Env(), fileName, quick);
+    return obj;
+  }
+  catch (const std::exception& e) {
+    throw Napi::Error::New(info.Env(), e.what());
+  }
+}
+
 Napi::Value create(const Napi::CallbackInfo &info) {
   try {
     Napi::String fileName = info[0].ToString();
@@ -700,3 +2123,679 @@ Napi::Value create(const Napi::CallbackInfo &info) {
   */
 }
 
+template <typename T>
+Napi::TypedArrayOf<T> toTypedArray(Napi::Env env, const std::vector<T> &data) {
+  Napi::ArrayBuffer buffer = Napi::ArrayBuffer::New(env, data.size() * sizeof(T));
+  if (!data.empty()) {
+    memcpy(buffer.Data(), data.data(), data.size() * sizeof(T));
+  }
+  return Napi::TypedArrayOf<T>::New(env, data.size(), buffer, 0);
+}
+
+/**
+ * run work on the thread pool and hand its result to callback on the main thread, after
+ * converting it to a js value with convert. Objects in keepAlive are referenced until then
+ */
+template <typename WorkT, typename ConvertT>
+void runAsync(Napi::Env env, const Napi::Function &callback,
+              std::vector<Napi::ObjectReference> &&keepAlive, WorkT work, ConvertT convert) {
+  typedef decltype(work()) ResultT;
+  struct Job : public Completion {
+    Job(std::vector<Napi::ObjectReference> &&keepAlive, const Napi::Function &callback, WorkT &&work, ConvertT &&convert)
+      : keepAlive(std::move(keepAlive))
+      , callback(Napi::Persistent(callback))
+      , work(std::move(work))
+      , convert(std::move(convert))
+      , result()
+      , failed(false)
+    {}
+
+    void deliver(Napi::Env env) override {
+      if (!failed) {
+        Napi::Value value;
+        try {
+          value = convert(env, result);
+        }
+        catch (const std::exception &e) {
+          failed = true;
+          error = e.what();
+        }
+        if (!failed) {
+          callback.Call({ env.Null(), value });
+          return;
+        }
+      }
+      Napi::Error errRef = Napi::Error::New(env, error);
+      callback.Call({ static_cast<napi_value>(errRef.Value()) });
+    }
+
+    std::vector<Napi::ObjectReference> keepAlive;
+    Napi::FunctionReference callback;
+    WorkT work;
+    ConvertT convert;
+    ResultT result;
+    bool failed;
+    std::string error;
+  };
+
+  std::shared_ptr<ResultDelivery> delivery = env.GetInstanceData<AddonData>()->results;
+  Job *job = new Job(std::move(keepAlive), callback, std::move(work), std::move(convert));
+  delivery->expect(env);
+
+  ThreadPool::instance().submit([job, delivery]() {
+    try {
+      job->result = job->work();
+    }
+    catch (const std::exception &e) {
+      job->failed = true;
+      job->error = e.what();
+    }
+    delivery->push(job);
+  });
+}
+
+Napi::Value createAtlas(const Napi::CallbackInfo &info) {
+  Napi::Array saves = info[0].As<Napi::Array>();
+  uint32_t cellWidth = info[1].ToNumber().Uint32Value();
+  uint32_t cellHeight = info[2].ToNumber().Uint32Value();
+  Napi::Function callback = info[3].As<Napi::Function>();
+
+  std::vector<Napi::ObjectReference> keepAlive;
+  std::vector<GamebryoSaveGame*> saveList;
+
+  for (uint32_t i = 0; i < saves.Length(); ++i) {
+    Napi::Object obj = saves.Get(i).ToObject();
+    GamebryoSaveGame *save = GamebryoSaveGame::Unwrap(obj);
+    if (save == nullptr) {
+      throw Napi::TypeError::New(info.Env(), "expected an array of save games");
+    }
+    // keep the saves alive while the atlas gets built in the background
+    keepAlive.push_back(Napi::Persistent(obj));
+    saveList.push_back(save);
+  }
+
+  runAsync(info.Env(), callback, std::move(keepAlive),
+    [saveList, cellWidth, cellHeight]() {
+      std::vector<AtlasSource> sources;
+      for (GamebryoSaveGame *save : saveList) {
+        // saves from open() may still be reading
+        save->waitForPhase(GamebryoSaveGame::PHASE_SCREENSHOT);
+        sources.push_back(AtlasSource{ &save->screenshotData(),
+                                       save->screenshotDimensions().width(),
+                                       save->screenshotDimensions().height() });
+      }
+      return buildAtlas(sources, cellWidth, cellHeight);
+    },
+    [](Napi::Env env, Atlas &atlas) -> Napi::Value {
+      Napi::Object result = Napi::Object::New(env);
+      result.Set("width", Napi::Number::New(env, atlas.width));
+      result.Set("height", Napi::Number::New(env, atlas.height));
+
+      Napi::Array rects = Napi::Array::New(env, atlas.rects.size());
+      for (size_t i = 0; i < atlas.rects.size(); ++i) {
+        const AtlasRect &rect = atlas.rects[i];
+        Napi::Object rectObj = Napi::Object::New(env);
+        rectObj.Set("x", Napi::Number::New(env, rect.x));
+        rectObj.Set("y", Napi::Number::New(env, rect.y));
+        rectObj.Set("width", Napi::Number::New(env, rect.width));
+        rectObj.Set("height", Napi::Number::New(env, rect.height));
+        rects.Set(static_cast<uint32_t>(i), rectObj);
+      }
+      result.Set("rects", rects);
+
+      // hand the pixels to js without copying them
+      std::vector<uint8_t> *pixels = new std::vector<uint8_t>(std::move(atlas.pixels));
+      result.Set("atlas", externalBuffer(env, pixels->data(), pixels->size(), pixels));
+      return result;
+    });
+
+  return info.Env().Undefined();
+}
+
+Napi::Value GamebryoSaveGame::readChangeForms(const Napi::CallbackInfo &info) {
+  Napi::Function callback = info[0].As<Napi::Function>();
+
+  std::vector<Napi::ObjectReference> keepAlive;
+  keepAlive.push_back(Napi::Persistent(Value()));
+
+  runAsync(info.Env(), callback, std::move(keepAlive),
+    [this]() {
+      BodyFormat format;
+      std::shared_ptr<IDecoder> decoder = openBody(format);
+      FileLocationTable table = readFileLocationTable(*decoder, format);
+      return ::readChangeForms(*decoder, table);
+    },
+    [](Napi::Env env, ChangeForms &forms) -> Napi::Value {
+      Napi::Object result = Napi::Object::New(env);
+      result.Set("count", Napi::Number::New(env, static_cast<double>(forms.refIds.size())));
+      result.Set("refIds", toTypedArray(env, forms.refIds));
+      result.Set("changeFlags", toTypedArray(env, forms.changeFlags));
+      result.Set("types", toTypedArray(env, forms.types));
+      result.Set("versions", toTypedArray(env, forms.versions));
+      result.Set("offsets", toTypedArray(env, forms.offsets));
+      std::vector<uint8_t> *data = new std::vector<uint8_t>(std::move(forms.data));
+      result.Set("data", externalBuffer(env, data->data(), data->size(), data));
+      return result;
+    });
+
+  return info.Env().Undefined();
+}
+
+Napi::Value GamebryoSaveGame::scanScripts(const Napi::CallbackInfo &info) {
+  std::vector<std::string> knownScripts;
+  if (info[0].IsArray()) {
+    Napi::Array known = info[0].As<Napi::Array>();
+    for (uint32_t i = 0; i < known.Length(); ++i) {
+      knownScripts.push_back(known.Get(i).ToString().Utf8Value());
+    }
+  }
+  Napi::Function callback = info[1].As<Napi::Function>();
+
+  std::vector<Napi::ObjectReference> keepAlive;
+  keepAlive.push_back(Napi::Persistent(Value()));
+
+  runAsync(info.Env(), callback, std::move(keepAlive),
+    [this, knownScripts]() {
+      BodyFormat format;
+      std::shared_ptr<IDecoder> decoder = openBody(format);
+      FileLocationTable table = readFileLocationTable(*decoder, format);
+      // 64-bit instance ids since Skyrim SE
+      bool wideIds = (format == BodyFormat::FALLOUT4) || (m_HeaderVersion >= 0x0c);
+      return scanPapyrus(*decoder, table, format, wideIds, knownScripts);
+    },
+    [](Napi::Env env, PapyrusScan &scan) -> Napi::Value {
+      Napi::Object result = Napi::Object::New(env);
+      result.Set("instanceCount", Napi::Number::New(env, scan.instanceCount));
+      result.Set("orphanedCount", Napi::Number::New(env, scan.orphanedCount));
+      Napi::Array scripts = Napi::Array::New(env, scan.scripts.size());
+      uint32_t idx = 0;
+      for (const ScriptUsage &usage : scan.scripts) {
+        Napi::Object item = Napi::Object::New(env);
+        item.Set("name", Napi::String::New(env, usage.name));
+        item.Set("instances", Napi::Number::New(env, usage.instances));
+        item.Set("undefined", Napi::Boolean::New(env, usage.undefined));
+        item.Set("missing", Napi::Boolean::New(env, usage.missing));
+        scripts.Set(idx++, item);
+      }
+      result.Set("scripts", scripts);
+      return result;
+    });
+
+  return info.Env().Undefined();
+}
+
+Napi::Value GamebryoSaveGame::rewriteScreenshot(const Napi::CallbackInfo &info) {
+  std::string output = info[0].ToString().Utf8Value();
+  uint32_t maxWidth = info[1].ToNumber().Uint32Value();
+  uint32_t maxHeight = info[2].ToNumber().Uint32Value();
+  Napi::Function callback = info[3].As<Napi::Function>();
+
+  std::vector<Napi::ObjectReference> keepAlive;
+  keepAlive.push_back(Napi::Persistent(Value()));
+
+  runAsync(info.Env(), callback, std::move(keepAlive),
+    [this, output, maxWidth, maxHeight]() {
+      waitForPhase(PHASE_COMPLETE);
+      ScreenshotLayout layout;
+      {
+        std::lock_guard<std::mutex> lock(m_BodyMutex);
+        locateContent();
+        layout = m_ScreenshotLayout;
+      }
+      return ::rewriteScreenshot(m_FileName, output, layout, maxWidth, maxHeight);
+    },
+    [](Napi::Env env, RewriteResult &result) -> Napi::Value {
+      Napi::Object obj = Napi::Object::New(env);
+      obj.Set("width", Napi::Number::New(env, result.width));
+      obj.Set("height", Napi::Number::New(env, result.height));
+      obj.Set("inputSize", Napi::Number::New(env, static_cast<double>(result.inputSize)));
+      obj.Set("outputSize", Napi::Number::New(env, static_cast<double>(result.outputSize)));
+      return obj;
+    });
+
+  return info.Env().Undefined();
+}
+
+Napi::Value GamebryoSaveGame::globalDataToJS(const Napi::CallbackInfo &info, size_t callbackIdx, uint32_t type,
+                                             std::function<Napi::Value(Napi::Env, const std::vector<uint8_t>&)> convert) {
+  if ((info.Length() > callbackIdx) && info[callbackIdx].IsFunction()) {
+    // finding the entry may mean decompressing a good part of the body, keep that off the main thread
+    std::vector<Napi::ObjectReference> keepAlive;
+    keepAlive.push_back(Napi::Persistent(Value()));
+
+    runAsync(info.Env(), info[callbackIdx].As<Napi::Function>(), std::move(keepAlive),
+      [this, type]() {
+        return globalData(type);
+      },
+      [convert](Napi::Env env, std::shared_ptr<const std::vector<uint8_t>> &data) -> Napi::Value {
+        if (!data) {
+          return env.Undefined();
+        }
+        return convert(env, *data);
+      });
+
+    return info.Env().Undefined();
+  }
+
+  try {
+    std::shared_ptr<const std::vector<uint8_t>> data = globalData(type);
+    if (!data) {
+      return info.Env().Undefined();
+    }
+    return convert(info.Env(), *data);
+  }
+  catch (const std::exception &e) {
+    throw Napi::Error::New(info.Env(), e.what());
+  }
+}
+
+Napi::Value GamebryoSaveGame::getGlobalData(const Napi::CallbackInfo &info) {
+  return globalDataToJS(info, 1, info[0].ToNumber().Uint32Value(),
+    [](Napi::Env env, const std::vector<uint8_t> &data) -> Napi::Value {
+      return Napi::Buffer<uint8_t>::Copy(env, data.data(), data.size());
+    });
+}
+
+Napi::Value GamebryoSaveGame::getMiscStats(const Napi::CallbackInfo &info) {
+  return globalDataToJS(info, 0, GLOBAL_MISC_STATS,
+    [](Napi::Env env, const std::vector<uint8_t> &data) -> Napi::Value {
+      Napi::Array result = Napi::Array::New(env);
+      uint32_t idx = 0;
+      for (const MiscStat &stat : parseMiscStats(data)) {
+        Napi::Object item = Napi::Object::New(env);
+        item.Set("name", Napi::String::New(env, stat.name));
+        item.Set("category", Napi::Number::New(env, stat.category));
+        item.Set("value", Napi::Number::New(env, stat.value));
+        result.Set(idx++, item);
+      }
+      return result;
+    });
+}
+
+Napi::Value GamebryoSaveGame::getPlayerLocation(const Napi::CallbackInfo &info) {
+  return globalDataToJS(info, 0, GLOBAL_PLAYER_LOCATION,
+    [](Napi::Env env, const std::vector<uint8_t> &data) -> Napi::Value {
+      PlayerLocation location = parsePlayerLocation(data);
+      Napi::Object result = Napi::Object::New(env);
+      result.Set("nextObjectId", Napi::Number::New(env, location.nextObjectId));
+      result.Set("worldSpace1", Napi::Number::New(env, location.worldSpace1));
+      result.Set("coorX", Napi::Number::New(env, location.coorX));
+      result.Set("coorY", Napi::Number::New(env, location.coorY));
+      result.Set("worldSpace2", Napi::Number::New(env, location.worldSpace2));
+      result.Set("x", Napi::Number::New(env, location.posX));
+      result.Set("y", Napi::Number::New(env, location.posY));
+      result.Set("z", Napi::Number::New(env, location.posZ));
+      return result;
+    });
+}
+
+Napi::Value GamebryoSaveGame::getGlobalVariables(const Napi::CallbackInfo &info) {
+  return globalDataToJS(info, 0, GLOBAL_VARIABLES,
+    [](Napi::Env env, const std::vector<uint8_t> &data) -> Napi::Value {
+      Napi::Array result = Napi::Array::New(env);
+      uint32_t idx = 0;
+      for (const GlobalVariable &var : parseGlobalVariables(data)) {
+        Napi::Object item = Napi::Object::New(env);
+        item.Set("refId", Napi::Number::New(env, var.refId));
+        item.Set("value", Napi::Number::New(env, var.value));
+        result.Set(idx++, item);
+      }
+      return result;
+    });
+}
+
+Napi::Value GamebryoSaveGame::getGameTime(const Napi::CallbackInfo &info) {
+  return globalDataToJS(info, 0, GLOBAL_VARIABLES,
+    [](Napi::Env env, const std::vector<uint8_t> &data) -> Napi::Value {
+      // the time globals are hard coded in the engine and have the same ids in all games
+      static const std::pair<uint32_t, const char*> timeGlobals[] = {
+        { 0x35, "year" },
+        { 0x36, "month" },
+        { 0x37, "day" },
+        { 0x38, "hour" },
+        { 0x39, "daysPassed" },
+        { 0x3A, "timeScale" },
+      };
+
+      Napi::Object result = Napi::Object::New(env);
+      for (const GlobalVariable &var : parseGlobalVariables(data)) {
+        // only look at ref ids pointing directly to a form in the master (type 1)
+        if ((var.refId >> 22) != 1) {
+          continue;
+        }
+        for (const auto &timeGlobal : timeGlobals) {
+          if ((var.refId & 0x3FFFFF) == timeGlobal.first) {
+            result.Set(timeGlobal.second, Napi::Number::New(env, var.value));
+          }
+        }
+      }
+      return result;
+    });
+}
+
+Napi::Value GamebryoSaveGame::getWeather(const Napi::CallbackInfo &info) {
+  return globalDataToJS(info, 0, GLOBAL_WEATHER,
+    [](Napi::Env env, const std::vector<uint8_t> &data) -> Napi::Value {
+      Weather weather = parseWeather(data);
+      Napi::Object result = Napi::Object::New(env);
+      result.Set("climate", Napi::Number::New(env, weather.climate));
+      result.Set("weather", Napi::Number::New(env, weather.weather));
+      result.Set("previousWeather", Napi::Number::New(env, weather.previousWeather));
+      result.Set("unknownWeather1", Napi::Number::New(env, weather.unknownWeather1));
+      result.Set("unknownWeather2", Napi::Number::New(env, weather.unknownWeather2));
+      result.Set("regionWeather", Napi::Number::New(env, weather.regionWeather));
+      result.Set("currentTime", Napi::Number::New(env, weather.currentTime));
+      result.Set("beginTime", Napi::Number::New(env, weather.beginTime));
+      result.Set("weatherPercent", Napi::Number::New(env, weather.weatherPercent));
+      return result;
+    });
+}
+
+std::shared_ptr<const std::vector<uint32_t>> GamebryoSaveGame::formIdArray() {
+  std::shared_ptr<const std::vector<uint32_t>> formIds;
+  {
+    std::lock_guard<std::mutex> lock(m_GlobalDataMutex);
+    formIds = m_FormIds;
+  }
+
+  if (!formIds) {
+    BodyFormat format;
+    std::shared_ptr<IDecoder> decoder = openBody(format);
+    FileLocationTable table = readFileLocationTable(*decoder, format);
+    formIds = std::make_shared<const std::vector<uint32_t>>(readFormIdArray(*decoder, table));
+    std::lock_guard<std::mutex> lock(m_GlobalDataMutex);
+    m_FormIds = formIds;
+  }
+  return formIds;
+}
+
+static Napi::Value formIdArrayToJS(Napi::Env env, const std::shared_ptr<const std::vector<uint32_t>> &formIds) {
+  // the array views the cached data directly, the reference held by the finalizer keeps it alive.
+  // js can't be kept from writing to it so it's documented as read-only, remapFormIds writes to a
+  // separate array by default
+  Napi::ArrayBuffer buffer = externalArrayBuffer(env,
+    const_cast<uint32_t*>(formIds->data()), formIds->size() * sizeof(uint32_t),
+    new std::shared_ptr<const std::vector<uint32_t>>(formIds));
+  return Napi::Uint32Array::New(env, formIds->size(), buffer, 0);
+}
+
+Napi::Value GamebryoSaveGame::getFormIdArray(const Napi::CallbackInfo &info) {
+  if ((info.Length() > 0) && info[0].IsFunction()) {
+    std::vector<Napi::ObjectReference> keepAlive;
+    keepAlive.push_back(Napi::Persistent(Value()));
+
+    runAsync(info.Env(), info[0].As<Napi::Function>(), std::move(keepAlive),
+      [this]() {
+        return formIdArray();
+      },
+      [](Napi::Env env, std::shared_ptr<const std::vector<uint32_t>> &formIds) -> Napi::Value {
+        return formIdArrayToJS(env, formIds);
+      });
+
+    return info.Env().Undefined();
+  }
+
+  try {
+    return formIdArrayToJS(info.Env(), formIdArray());
+  }
+  catch (const std::exception &e) {
+    throw Napi::Error::New(info.Env(), e.what());
+  }
+}
+
+Napi::Value remapFormIds(const Napi::CallbackInfo &info) {
+  if (!info[0].IsTypedArray() || (info[0].As<Napi::TypedArray>().TypedArrayType() != napi_uint32_array)) {
+    throw Napi::TypeError::New(info.Env(), "expected a Uint32Array of form ids");
+  }
+  if (!info[1].IsTypedArray() || (info[1].As<Napi::TypedArray>().TypedArrayType() != napi_uint8_array)
+      || (info[1].As<Napi::Uint8Array>().ElementLength() != 256)) {
+    throw Napi::TypeError::New(info.Env(), "expected a Uint8Array with 256 entries as the plugin index map");
+  }
+
+  const uint16_t *lightMap = nullptr;
+  if ((info.Length() > 2) && !info[2].IsUndefined() && !info[2].IsNull()) {
+    if (!info[2].IsTypedArray() || (info[2].As<Napi::TypedArray>().TypedArrayType() != napi_uint16_array)
+        || (info[2].As<Napi::Uint16Array>().ElementLength() != 4096)) {
+      throw Napi::TypeError::New(info.Env(), "expected a Uint16Array with 4096 entries as the light plugin index map");
+    }
+    lightMap = info[2].As<Napi::Uint16Array>().Data();
+  }
+
+  Napi::Uint32Array ids = info[0].As<Napi::Uint32Array>();
+  Napi::Uint32Array output;
+  if ((info.Length() > 3) && !info[3].IsUndefined() && !info[3].IsNull()) {
+    if (!info[3].IsTypedArray() || (info[3].As<Napi::TypedArray>().TypedArrayType() != napi_uint32_array)
+        || (info[3].As<Napi::Uint32Array>().ElementLength() != ids.ElementLength())) {
+      throw Napi::TypeError::New(info.Env(), "expected a Uint32Array of the same length as the form ids as the output");
+    }
+    output = info[3].As<Napi::Uint32Array>();
+  } else {
+    output = Napi::Uint32Array::New(info.Env(), ids.ElementLength());
+  }
+  ::remapFormIds(ids.Data(), output.Data(), ids.ElementLength(), info[1].As<Napi::Uint8Array>().Data(), lightMap);
+  return output;
+}
+
+static uint16_t compressionFromJS(const Napi::Value &value) {
+  std::string name = value.ToString().Utf8Value();
+  if (name == "zlib") {
+    return COMPRESSION_ZLIB;
+  } else if (name == "lz4") {
+    return COMPRESSION_LZ4;
+  }
+  throw Napi::TypeError::New(value.Env(), "compression has to be \"zlib\" or \"lz4\"");
+}
+
+static Napi::Object recompressResultToJS(Napi::Env env, const RecompressResult &result) {
+  Napi::Object obj = Napi::Object::New(env);
+  obj.Set("sourceCompression", Napi::String::New(env, compressionName(result.sourceFormat)));
+  obj.Set("inputSize", Napi::Number::New(env, static_cast<double>(result.inputSize)));
+  obj.Set("outputSize", Napi::Number::New(env, static_cast<double>(result.outputSize)));
+  return obj;
+}
+
+Napi::Value recompress(const Napi::CallbackInfo &info) {
+  std::string input = info[0].ToString().Utf8Value();
+  std::string output = info[1].ToString().Utf8Value();
+  uint16_t format = compressionFromJS(info[2]);
+  Napi::Function callback = info[3].As<Napi::Function>();
+
+  runAsync(info.Env(), callback, std::vector<Napi::ObjectReference>(),
+    [input, output, format]() {
+      return recompressSave(input, output, format);
+    },
+    [](Napi::Env env, RecompressResult &result) -> Napi::Value {
+      return recompressResultToJS(env, result);
+    });
+
+  return info.Env().Undefined();
+}
+
+Napi::Value recompressBatch(const Napi::CallbackInfo &info) {
+  Napi::Array jobs = info[0].As<Napi::Array>();
+  uint16_t format = compressionFromJS(info[1]);
+  Napi::Function callback = info[2].As<Napi::Function>();
+
+  std::vector<std::pair<std::string, std::string>> files;
+  for (uint32_t i = 0; i < jobs.Length(); ++i) {
+    Napi::Object job = jobs.Get(i).ToObject();
+    files.push_back(std::make_pair(job.Get("input").ToString().Utf8Value(),
+                                   job.Get("output").ToString().Utf8Value()));
+  }
+
+  struct BatchItem {
+    RecompressResult result;
+    std::string error;
+  };
+
+  runAsync(info.Env(), callback, std::vector<Napi::ObjectReference>(),
+    [files, format]() {
+      // every file streams through its own small buffers so converting them all at once is fine
+      std::vector<BatchItem> items(files.size());
+      ReadScheduler::instance().runAll(files.size(), [&](size_t idx) {
+        try {
+          items[idx].result = recompressSave(files[idx].first, files[idx].second, format);
+        }
+        catch (const std::exception &e) {
+          items[idx].error = e.what();
+        }
+      });
+      return items;
+    },
+    [](Napi::Env env, std::vector<BatchItem> &items) -> Napi::Value {
+      Napi::Array result = Napi::Array::New(env, items.size());
+      for (uint32_t i = 0; i < items.size(); ++i) {
+        if (items[i].error.empty()) {
+          result.Set(i, recompressResultToJS(env, items[i].result));
+        } else {
+          Napi::Object obj = Napi::Object::New(env);
+          obj.Set("error", Napi::String::New(env, items[i].error));
+          result.Set(i, obj);
+        }
+      }
+      return result;
+    });
+
+  return info.Env().Undefined();
+}
+
+Napi::Value fingerprintPlugins(const Napi::CallbackInfo &info) {
+  Napi::Array plugins = info[0].As<Napi::Array>();
+  PluginFingerprint fingerprint;
+  for (uint32_t i = 0; i < plugins.Length(); ++i) {
+    fingerprint.add(plugins.Get(i).ToString().Utf8Value());
+  }
+
+  Napi::Object result = Napi::Object::New(info.Env());
+  result.Set("loadOrder", Napi::String::New(info.Env(), PluginFingerprint::toHex(fingerprint.loadOrder())));
+  result.Set("pluginSet", Napi::String::New(info.Env(), PluginFingerprint::toHex(fingerprint.pluginSet())));
+  return result;
+}
+
+namespace {
+
+bool thumbnailKey(const Napi::CallbackInfo &info, std::shared_ptr<ThumbnailStore> &store, FileKey &key) {
+  key.path = info[0].ToString().Utf8Value();
+  store = ThumbnailStore::instance();
+  return store && statFile(key.path, key.fileSize, key.modified);
+}
+
+}
+
+Napi::Value getThumbnail(const Napi::CallbackInfo &info) {
+  std::shared_ptr<ThumbnailStore> store;
+  FileKey key;
+  std::vector<uint8_t> png;
+  if (!thumbnailKey(info, store, key) || !store->read(key, png)) {
+    return info.Env().Undefined();
+  }
+  return Napi::Buffer<uint8_t>::Copy(info.Env(), png.data(), png.size());
+}
+
+Napi::Value getThumbnailPath(const Napi::CallbackInfo &info) {
+  std::shared_ptr<ThumbnailStore> store;
+  FileKey key;
+  if (!thumbnailKey(info, store, key)) {
+    return info.Env().Undefined();
+  }
+  std::string path = store->path(key);
+  if (path.empty()) {
+    return info.Env().Undefined();
+  }
+  return Napi::String::New(info.Env(), path);
+}
+
+namespace {
+
+Napi::Object trimResultToJS(Napi::Env env, const MemoryPressure::TrimResult &result) {
+  Napi::Object obj = Napi::Object::New(env);
+  obj.Set("screenshotCache", Napi::Number::New(env, static_cast<double>(result.screenshotCache)));
+  obj.Set("bufferPool", Napi::Number::New(env, static_cast<double>(result.bufferPool)));
+  obj.Set("inflaters", Napi::Number::New(env, static_cast<double>(result.inflaters)));
+  obj.Set("total", Napi::Number::New(env, static_cast<double>(result.total())));
+  return obj;
+}
+
+}
+
+Napi::Value onUpdate(const Napi::CallbackInfo &info) {
+  AddonData *data = info.Env().GetInstanceData<AddonData>();
+  if ((info.Length() > 0) && info[0].IsFunction()) {
+    data->updateCallback = Napi::Persistent(info[0].As<Napi::Function>());
+  } else {
+    data->updateCallback.Reset();
+  }
+  return info.Env().Undefined();
+}
+
+Napi::Value trim(const Napi::CallbackInfo &info) {
+  return trimResultToJS(info.Env(), MemoryPressure::instance().trim());
+}
+
+Napi::Value getStats(const Napi::CallbackInfo &info) {
+  Napi::Env env = info.Env();
+  ReadScheduler::Stats stats = ReadScheduler::instance().stats();
+
+  Napi::Object reads = Napi::Object::New(env);
+  reads.Set("limit", Napi::Number::New(env, stats.limit));
+  reads.Set("maxLimit", Napi::Number::New(env, stats.maxLimit));
+  reads.Set("adaptive", Napi::Boolean::New(env, stats.adaptive));
+  reads.Set("reason", Napi::String::New(env, stats.reason));
+  reads.Set("inFlight", Napi::Number::New(env, stats.inFlight));
+  reads.Set("queued", Napi::Number::New(env, static_cast<double>(stats.queued)));
+  reads.Set("queuedBackground", Napi::Number::New(env, static_cast<double>(stats.queuedBackground)));
+  reads.Set("completed", Napi::Number::New(env, static_cast<double>(stats.completed)));
+  reads.Set("throughput", Napi::Number::New(env, stats.throughput));
+  reads.Set("latencyMs", Napi::Number::New(env, stats.latencyMs));
+  reads.Set("queueMs", Napi::Number::New(env, stats.queueMs));
+
+  MemoryPressure::Stats memoryStats = MemoryPressure::instance().stats();
+  Napi::Object memory = Napi::Object::New(env);
+  memory.Set("monitor", Napi::String::New(env, memoryStats.monitor));
+  memory.Set("pressureEvents", Napi::Number::New(env, static_cast<double>(memoryStats.pressureEvents)));
+  memory.Set("trims", Napi::Number::New(env, static_cast<double>(memoryStats.trims)));
+  memory.Set("freedTotal", Napi::Number::New(env, static_cast<double>(memoryStats.freedTotal)));
+  memory.Set("lastTrim", trimResultToJS(env, memoryStats.lastTrim));
+
+  Napi::Object cpu = Napi::Object::New(env);
+  cpu.Set("detected", Napi::String::New(env, CpuDispatch::levelName(CpuDispatch::detected())));
+  cpu.Set("active", Napi::String::New(env, CpuDispatch::levelName(CpuDispatch::level())));
+
+  Napi::Object result = Napi::Object::New(env);
+  result.Set("reads", reads);
+  result.Set("memory", memory);
+  result.Set("cpu", cpu);
+  return result;
+}
+
+Napi::Value getSlowLog(const Napi::CallbackInfo &info) {
+  Napi::Env env = info.Env();
+  std::vector<SlowLog::Entry> entries = SlowLog::instance().entries();
+  if ((info.Length() > 0) && info[0].ToBoolean()) {
+    SlowLog::instance().clear();
+  }
+
+  Napi::Array result = Napi::Array::New(env, entries.size());
+  for (size_t i = 0; i < entries.size(); ++i) {
+    const SlowLog::Entry &entry = entries[i];
+    Napi::Object obj = Napi::Object::New(env);
+    obj.Set("path", Napi::String::New(env, entry.path));
+    obj.Set("fileSize", Napi::Number::New(env, static_cast<double>(entry.fileSize)));
+    obj.Set("time", Napi::Number::New(env, static_cast<double>(entry.time)));
+    obj.Set("game", Napi::String::New(env, entry.game));
+    obj.Set("compression", Napi::String::New(env, entry.compression));
+    obj.Set("quick", Napi::Boolean::New(env, entry.quick));
+    obj.Set("cached", Napi::Boolean::New(env, entry.cached));
+    if (!entry.error.empty()) {
+      obj.Set("error", Napi::String::New(env, entry.error));
+    }
+    obj.Set("totalMs", Napi::Number::New(env, entry.totalMs));
+    obj.Set("openMs", Napi::Number::New(env, entry.openMs));
+    obj.Set("headerMs", Napi::Number::New(env, entry.headerMs));
+    obj.Set("imageMs", Napi::Number::New(env, entry.imageMs));
+    obj.Set("decompressMs", Napi::Number::New(env, entry.decompressMs));
+    obj.Set("pluginsMs", Napi::Number::New(env, entry.pluginsMs));
+    result.Set(static_cast<uint32_t>(i), obj);
+  }
+  return result;
+}
@@ -3,28 +3,30 @@
 #include <string>
 #include <fstream>
 #include <vector>
+#include <cstring>
+#include <map>
+#include <set>
 #include <memory>
+#include <mutex>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <functional>
 #include <napi.h>
 #include "fmt/format.h"
 
 #include "string_cast.h"
-
-class DataInvalid : public std::runtime_error {
-public:
-  DataInvalid(const char* message, size_t offset) : std::runtime_error(message), m_Offset(offset) {}
-  size_t offset() const { return m_Offset; }
-private:
-  size_t m_Offset;
-};
-
-class IDecoder {
-public:
-  virtual ~IDecoder() {};
-  virtual bool seek(size_t offset, std::ios_base::seekdir dir = std::ios::beg) = 0;
-  virtual size_t tell() = 0;
-  virtual bool read(char *buffer, size_t size) = 0;
-  virtual void clear() = 0;
-};
+#include "screenshot.h"
+#include "fileregion.h"
+#include "decoder.h"
+#include "savebody.h"
+#include "resultdelivery.h"
+#include "rewrite.h"
+#include "fingerprint.h"
+#include "sharedcache.h"
+#include "thumbnails.h"
+#include "memorypressure.h"
+#include "cpudispatch.h"
 
 /**
  * Stores a screenshot in 32-bit rgba format
@@ -47,7 +49,66 @@ private:
   uint32_t m_Height;
 };
 
+/* create a buffer that takes over memory kept alive by owner, falling back to a copy on runtimes
+ * that don't allow external buffers (like electron with the v8 memory cage) */
+template <typename OwnerT>
+Napi::Buffer<uint8_t> externalBuffer(Napi::Env env, uint8_t *data, size_t length, OwnerT *owner) {
+  try {
+    return Napi::Buffer<uint8_t>::New(env, data, length,
+      [](Napi::Env, uint8_t*, OwnerT *hint) { delete hint; }, owner);
+  }
+  catch (const Napi::Error&) {
+    Napi::Buffer<uint8_t> result = Napi::Buffer<uint8_t>::Copy(env, data, length);
+    delete owner;
+    return result;
+  }
+}
+
+/* same as externalBuffer but as a plain ArrayBuffer, for use with the other typed arrays */
+template <typename OwnerT>
+Napi::ArrayBuffer externalArrayBuffer(Napi::Env env, void *data, size_t length, OwnerT *owner) {
+  try {
+    return Napi::ArrayBuffer::New(env, data, length,
+      [](Napi::Env, void*, OwnerT *hint) { delete hint; }, owner);
+  }
+  catch (const Napi::Error&) {
+    Napi::ArrayBuffer result = Napi::ArrayBuffer::New(env, length);
+    memcpy(result.Data(), data, length);
+    delete owner;
+    return result;
+  }
+}
+
+/**
+ * Per-environment (main thread or worker_thread) state of the module. Everything native that isn't
+ * tied to js values (thread pool, caches, buffer pools) is shared by all environments in the process
+ * and synchronized internally
+ */
+struct AddonData {
+  Napi::FunctionReference constructor;
+  // background jobs hold on to this so it may outlive the environment
+  std::shared_ptr<ResultDelivery> results;
+  // called when a save restored from a stale cache entry has been read again
+  Napi::FunctionReference updateCallback;
+  // paths being read again right now, so each gets revalidated only once at a time
+  std::set<std::string> revalidating;
+};
+
 Napi::Value create(const Napi::CallbackInfo &info);
+// exported as "open", named differently to not overload the posix function
+Napi::Value openSave(const Napi::CallbackInfo &info);
+Napi::Value configure(const Napi::CallbackInfo &info);
+Napi::Value createAtlas(const Napi::CallbackInfo &info);
+Napi::Value remapFormIds(const Napi::CallbackInfo &info);
+Napi::Value recompress(const Napi::CallbackInfo &info);
+Napi::Value fingerprintPlugins(const Napi::CallbackInfo &info);
+Napi::Value recompressBatch(const Napi::CallbackInfo &info);
+Napi::Value getThumbnail(const Napi::CallbackInfo &info);
+Napi::Value getThumbnailPath(const Napi::CallbackInfo &info);
+Napi::Value getStats(const Napi::CallbackInfo &info);
+Napi::Value getSlowLog(const Napi::CallbackInfo &info);
+Napi::Value trim(const Napi::CallbackInfo &info);
+Napi::Value onUpdate(const Napi::CallbackInfo &info);
 
 class GamebryoSaveGame : public Napi::ObjectWrap<GamebryoSaveGame>
 {
@@ -60,41 +121,123 @@ public:
       InstanceAccessor("location", &GamebryoSaveGame::location, nullptr, napi_enumerable),
       InstanceAccessor("saveNumber", &GamebryoSaveGame::saveNumber, nullptr, napi_enumerable),
       InstanceAccessor("plugins", &GamebryoSaveGame::plugins, nullptr, napi_enumerable),
+      InstanceAccessor("loadOrderFingerprint", &GamebryoSaveGame::loadOrderFingerprint, nullptr, napi_enumerable),
+      InstanceAccessor("pluginSetFingerprint", &GamebryoSaveGame::pluginSetFingerprint, nullptr, napi_enumerable),
       InstanceAccessor("creationTime", &GamebryoSaveGame::creationTime, nullptr, napi_enumerable),
       InstanceAccessor("fileName", &GamebryoSaveGame::fileName, nullptr, napi_enumerable),
       InstanceAccessor("screenshotSize", &GamebryoSaveGame::screenshotSize, nullptr, napi_enumerable),
       InstanceAccessor("playTime", &GamebryoSaveGame::playTime, nullptr, napi_enumerable),
       InstanceAccessor("screenshot", &GamebryoSaveGame::screenshot, nullptr, napi_enumerable),
       InstanceMethod("getScreenshot", &GamebryoSaveGame::getScreenshot),
+      InstanceMethod("readScreenshotInto", &GamebryoSaveGame::readScreenshotInto),
+      InstanceMethod("serializedSize", &GamebryoSaveGame::serializedSize),
+      InstanceMethod("serializeInto", &GamebryoSaveGame::serializeInto),
+      InstanceMethod("readChangeForms", &GamebryoSaveGame::readChangeForms),
+      InstanceMethod("getGlobalData", &GamebryoSaveGame::getGlobalData),
+      InstanceMethod("getMiscStats", &GamebryoSaveGame::getMiscStats),
+      InstanceMethod("getPlayerLocation", &GamebryoSaveGame::getPlayerLocation),
+      InstanceMethod("getGlobalVariables", &GamebryoSaveGame::getGlobalVariables),
+      InstanceMethod("getGameTime", &GamebryoSaveGame::getGameTime),
+      InstanceMethod("getWeather", &GamebryoSaveGame::getWeather),
+      InstanceMethod("getFormIdArray", &GamebryoSaveGame::getFormIdArray),
+      InstanceMethod("scanScripts", &GamebryoSaveGame::scanScripts),
+      InstanceMethod("rewriteScreenshot", &GamebryoSaveGame::rewriteScreenshot),
+      InstanceAccessor("readyState", &GamebryoSaveGame::readyState, nullptr),
+      InstanceAccessor("parseError", &GamebryoSaveGame::parseError, nullptr),
+      InstanceAccessor("stale", &GamebryoSaveGame::stale, nullptr),
+      InstanceMethod("whenReady", &GamebryoSaveGame::whenReady),
       });
-    Napi::FunctionReference* constructor = new Napi::FunctionReference();
-    *constructor = Napi::Persistent(func);
+    AddonData *data = new AddonData();
+    data->constructor = Napi::Persistent(func);
+    data->results = std::make_shared<ResultDelivery>(env);
     exports.Set("GamebryoSaveGame", func);
 
-    env.SetInstanceData<Napi::FunctionReference>(constructor);
+    // freed by node when the environment shuts down
+    env.SetInstanceData<AddonData>(data);
     return exports;
   }
 
   GamebryoSaveGame(const Napi::CallbackInfo &info);
 
   static Napi::Object CreateNewItem(Napi::Env env) {
-    Napi::FunctionReference* constructor = env.GetInstanceData<Napi::FunctionReference>();
+    AddonData *data = env.GetInstanceData<AddonData>();
     // this creates the object with no filename set so it doesn't get read at this point, allowing it to be read
     // asynchronously later
-    return constructor->New({ env.Null() });
+    return data->constructor.New({ env.Null() });
   }
 
   virtual ~GamebryoSaveGame();
 
+  /* how far reading has progressed. Objects from open() are handed out while they are still
+   * being read, their accessors wait for the phase that provides the data they return */
+  enum Phase {
+    PHASE_READING = 0,
+    // name, level, location, save number, play time
+    PHASE_HEADER = 1,
+    PHASE_SCREENSHOT = 2,
+    // plugins and everything else
+    PHASE_COMPLETE = 3,
+  };
+
   void readAsync(const Napi::Env& env, const std::string& fileName, bool quick, const Napi::Function& cb);
 
+  /* start reading in the background, the object can be used right away */
+  void openAsync(const Napi::Env &env, const std::string &fileName, bool quick);
+
+  /* block until reading has reached phase. Throws the read error if it failed before that */
+  void waitForPhase(Phase phase) const;
+
+  /* for accessors. Block until reading has reached phase or failed, returns false in the latter
+   * case. The fields of that phase stay empty then, parseError tells what went wrong */
+  bool awaitPhase(Phase phase) const;
+
+  /* for accessors of data from the content, throws to js if that isn't read for this game */
+  void requireContent(const Napi::Env &env) const {
+    if (!contentSupported()) {
+      throw Napi::Error::New(env, "not supported for this game");
+    }
+  }
+
+  Napi::Value readyState(const Napi::CallbackInfo &info);
+  // section and offset at which reading failed if it failed after the header, otherwise undefined
+  Napi::Value parseError(const Napi::CallbackInfo &info) { return parseErrorToJS(info.Env()); }
+  Napi::Value parseErrorToJS(Napi::Env env) const;
+  // restored from an outdated shared cache entry, an up to date copy is being read in the background.
+  // A stale entry is restored in one step so this is known once the header is
+  Napi::Value stale(const Napi::CallbackInfo &info) {
+    awaitPhase(PHASE_HEADER);
+    return Napi::Boolean::New(info.Env(), m_Stale);
+  }
+  // promise resolved with the object once the specified phase has been read
+  Napi::Value whenReady(const Napi::CallbackInfo &info);
+  /* resolve or reject the promises from whenReady that can be settled now. js thread only */
+  void settlePhasePromises(Napi::Env env);
+
   // creation time in seconds since the unix epoch
-  Napi::Value creationTime(const Napi::CallbackInfo &info) { return Napi::Number::New(info.Env(), m_CreationTime); }
-  Napi::Value characterName(const Napi::CallbackInfo &info) { return Napi::String::New(info.Env(), m_PCName); }
-  Napi::Value characterLevel(const Napi::CallbackInfo &info) { return Napi::Number::New(info.Env(), m_PCLevel); }
-  Napi::Value location(const Napi::CallbackInfo &info) { return Napi::String::New(info.Env(), m_PCLocation); }
-  Napi::Value saveNumber(const Napi::CallbackInfo &info) { return Napi::Number::New(info.Env(), m_SaveNumber); }
+  // (may fall back to the file time after the header has been read)
+  Napi::Value creationTime(const Napi::CallbackInfo &info) {
+    awaitPhase(PHASE_COMPLETE);
+    return Napi::Number::New(info.Env(), m_CreationTime);
+  }
+  Napi::Value characterName(const Napi::CallbackInfo &info) {
+    awaitPhase(PHASE_HEADER);
+    return Napi::String::New(info.Env(), m_PCName);
+  }
+  Napi::Value characterLevel(const Napi::CallbackInfo &info) {
+    awaitPhase(PHASE_HEADER);
+    return Napi::Number::New(info.Env(), m_PCLevel);
+  }
+  Napi::Value location(const Napi::CallbackInfo &info) {
+    awaitPhase(PHASE_HEADER);
+    return Napi::String::New(info.Env(), m_PCLocation);
+  }
+  Napi::Value saveNumber(const Napi::CallbackInfo &info) {
+    awaitPhase(PHASE_HEADER);
+    return Napi::Number::New(info.Env(), m_SaveNumber);
+  }
   Napi::Value plugins(const Napi::CallbackInfo& info) {
+    awaitPhase(PHASE_COMPLETE);
+    requireContent(info.Env());
     Napi::Array res = Napi::Array::New(info.Env());
     int idx = 0;
     for (const std::string& plugin : m_Plugins) {
@@ -102,34 +245,150 @@ public:
     }
     return res;
   }
+  Napi::Value loadOrderFingerprint(const Napi::CallbackInfo &info) {
+    awaitPhase(PHASE_COMPLETE);
+    requireContent(info.Env());
+    return Napi::String::New(info.Env(), PluginFingerprint::toHex(m_PluginFingerprint.loadOrder()));
+  }
+  Napi::Value pluginSetFingerprint(const Napi::CallbackInfo &info) {
+    awaitPhase(PHASE_COMPLETE);
+    requireContent(info.Env());
+    return Napi::String::New(info.Env(), PluginFingerprint::toHex(m_PluginFingerprint.pluginSet()));
+  }
   Napi::Value screenshotSize(const Napi::CallbackInfo &info) {
+    awaitPhase(PHASE_SCREENSHOT);
     Napi::Object result = Napi::Object::New(info.Env());
     result.Set("width",  Napi::Number::New(info.Env(), m_ScreenshotDim.width()));
     result.Set("height", Napi::Number::New(info.Env(), m_ScreenshotDim.height()));
     return result;
   }
-  Napi::Value playTime(const Napi::CallbackInfo &info) { return Napi::String::New(info.Env(), m_Playtime); }
+  Napi::Value playTime(const Napi::CallbackInfo &info) {
+    awaitPhase(PHASE_HEADER);
+    return Napi::String::New(info.Env(), m_Playtime);
+  }
 
   Napi::Value screenshot(const Napi::CallbackInfo &info) { return getScreenshot(info); }
   
   Napi::Value getScreenshot(const Napi::CallbackInfo &info) {
+    awaitPhase(PHASE_SCREENSHOT);
+    std::shared_ptr<FileRegion> region = m_Screenshot.region();
+    if (region) {
+      // hand out the loaded file region directly, the buffer keeps it alive
+      uint8_t *data;
+      try {
+        data = region->data();
+      }
+      catch (const std::exception &e) {
+        throw Napi::Error::New(info.Env(), e.what());
+      }
+      return externalBuffer(info.Env(), data, region->size(), new std::shared_ptr<FileRegion>(region));
+    }
+
     Napi::Buffer<uint8_t> buffer = Napi::Buffer<uint8_t>::New(info.Env(), m_Screenshot.size());
 
-    uint8_t *outData = buffer.Data();
-    memcpy(outData, m_Screenshot.data(), (std::min)(buffer.ByteLength(), m_Screenshot.size()));
+    try {
+      m_Screenshot.copyTo(buffer.Data());
+    }
+    catch (const std::exception &e) {
+      throw Napi::Error::New(info.Env(), e.what());
+    }
     return buffer;
   }
 
-  const std::vector<uint8_t> &screenshotData() const {
+  Napi::Value readScreenshotInto(const Napi::CallbackInfo &info) {
+    if (!info[0].IsTypedArray()) {
+      throw Napi::TypeError::New(info.Env(), "expected a Buffer or Uint8Array as the target");
+    }
+    awaitPhase(PHASE_SCREENSHOT);
+    Napi::Uint8Array target = info[0].As<Napi::Uint8Array>();
+    size_t offset = info.Length() > 1 ? info[1].ToNumber().Int64Value() : 0;
+    if ((offset > target.ByteLength()) || (target.ByteLength() - offset < m_Screenshot.size())) {
+      throw Napi::RangeError::New(info.Env(), fmt::format("target buffer too small, {} bytes required", m_Screenshot.size()));
+    }
+
+    try {
+      m_Screenshot.copyTo(target.Data() + offset);
+    }
+    catch (const std::exception &e) {
+      throw Napi::Error::New(info.Env(), e.what());
+    }
+    return Napi::Number::New(info.Env(), static_cast<double>(m_Screenshot.size()));
+  }
+
+  Napi::Value serializedSize(const Napi::CallbackInfo &info) {
+    awaitPhase(PHASE_COMPLETE);
+    return Napi::Number::New(info.Env(), static_cast<double>(serialize(nullptr, 0)));
+  }
+
+  Napi::Value serializeInto(const Napi::CallbackInfo &info) {
+    if (!info[0].IsTypedArray()) {
+      throw Napi::TypeError::New(info.Env(), "expected a Uint8Array as the target");
+    }
+    awaitPhase(PHASE_COMPLETE);
+    // a Uint8Array over a SharedArrayBuffer works just the same as a regular one here
+    Napi::Uint8Array target = info[0].As<Napi::Uint8Array>();
+    size_t offset = info.Length() > 1 ? info[1].ToNumber().Int64Value() : 0;
+    size_t required = serialize(nullptr, 0);
+    if ((offset > target.ByteLength()) || (target.ByteLength() - offset < required)) {
+      throw Napi::RangeError::New(info.Env(), fmt::format("target buffer too small, {} bytes required", required));
+    }
+
+    try {
+      serialize(target.Data() + offset, required);
+    }
+    catch (const std::exception &e) {
+      throw Napi::Error::New(info.Env(), e.what());
+    }
+    return Napi::Number::New(info.Env(), static_cast<double>(required));
+  }
+
+  Napi::Value readChangeForms(const Napi::CallbackInfo &info);
+
+  // lazy accessors for the global data tables, these only decode the part of the body they need.
+  // With a callback as the last argument they do that on the thread pool and pass the result to it
+  Napi::Value getGlobalData(const Napi::CallbackInfo &info);
+  Napi::Value getMiscStats(const Napi::CallbackInfo &info);
+  Napi::Value getPlayerLocation(const Napi::CallbackInfo &info);
+  Napi::Value getGlobalVariables(const Napi::CallbackInfo &info);
+  Napi::Value getGameTime(const Napi::CallbackInfo &info);
+  Napi::Value getWeather(const Napi::CallbackInfo &info);
+  Napi::Value getFormIdArray(const Napi::CallbackInfo &info);
+
+  // count script instances in the papyrus section, flagging those of scripts that don't exist (anymore)
+  Napi::Value scanScripts(const Napi::CallbackInfo &info);
+
+  // write a copy of the save with the screenshot scaled down or removed
+  Napi::Value rewriteScreenshot(const Napi::CallbackInfo &info);
+
+  /* write all fields and the screenshot in the layout documented in index.d.ts.
+   * Returns the number of bytes required, only writes if out is set */
+  size_t serialize(uint8_t *out, size_t capacity) const;
+
+  const Screenshot &screenshotData() const {
     return m_Screenshot;
   }
 
+  const Dimensions &screenshotDimensions() const {
+    return m_ScreenshotDim;
+  }
+
   Napi::Value fileName(const Napi::CallbackInfo &info) { return Napi::String::New(info.Env(), m_FileName); }
 
 private:
 
   friend class FileWrapper;
 
+  /* where the body of the save (from the file location table onwards) starts, so that it
+   * can be revisited after the initial parse */
+  struct BodyLocation {
+    BodyFormat format;
+    unsigned short compression;
+    uint64_t compressedOffset;
+    unsigned long compressedSize;
+    unsigned long uncompressedSize;
+    uint64_t tableOffset;
+  };
+
   class FileWrapper
   {
   public:
@@ -147,6 +406,10 @@ private:
      **/
     void setBZString(bool);
 
+    /** Skip over screenshot and plugins instead of storing them in the save game
+     **/
+    void setDiscard(bool);
+
     bool header(const char *expected);
 
     template <typename T> void skip(int count = 1)
@@ -179,6 +442,9 @@ private:
       return m_Decoder->tell();
     }
 
+    // whether reading currently happens inside the compressed part of the file
+    bool compressed() const { return m_Compressed; }
+
     void seek(uint64_t pos) {
       m_Decoder->seek(pos);
     }
@@ -199,30 +465,115 @@ private:
     /* Read the list of light plugins */
     void readLightPlugins();
 
+    /* Read a string stored in a field of fixed length, zero terminated unless it fills the field */
+    void readFixedString(std::string &value, size_t length);
+
+    /* Read a single plugin name stored as a fixed length string (the masters of Morrowind saves) */
+    void readPlugin(size_t length);
+
+    /* Reads a BGR image with an unused fourth byte per pixel (Morrowind) */
+    void readImageBGRX(unsigned long width, unsigned long height);
+
+    /* size of the file */
+    uint64_t size();
+
+    /* if the file is a chunked container (BCPS), read through it from now on. Returns false if
+     * it isn't one, the position is unspecified afterwards in either case */
+    bool unwrapContainer();
+
+    /* hint that the next size bytes are about to be read. In a chunked container the chunks they
+     * span get decompressed in parallel right away, otherwise this does nothing */
+    void prefetch(uint64_t size);
+
     /* treat the following bytes as compressed */
     void setCompression(unsigned short format, unsigned long compressedSize, unsigned long uncompressedSize);
 
     void sanityCheck(bool conditionMatch, const char* message);
 
+    /* location of the body, assuming we're positioned at its start right now */
+    BodyLocation bodyLocation(BodyFormat format);
+
+    std::shared_ptr<IDecoder> decoder() const { return m_Decoder; }
+
+    /* seconds spent decompressing the body so far */
+    double decompressTime() const;
+
   private:
     GamebryoSaveGame *m_Game;
     std::shared_ptr<IDecoder> m_Decoder;
     bool m_HasFieldMarkers;
     bool m_BZString;
+    bool m_Discard;
+    bool m_Compressed;
+    unsigned short m_CompressionFormat;
+    uint64_t m_CompressedOffset;
+    unsigned long m_CompressedSize;
+    unsigned long m_UncompressedSize;
     CodePage m_Encoding;
   };
 
   CodePage determineEncoding(const std::string &fileName);
 
   void read();
+  void parse();
+  /* if the save was restored from a stale cache entry, read it again into a new object in the
+   * background and hand that to the update callback. js thread only */
+  void revalidate(Napi::Env env);
+  /* add the parse just finished to the slow log if it took long enough. error is nullptr on success */
+  void logSlowParse(const char *error);
+  const char *gameName() const;
+  /* false for games of which only the header fields are read (Starfield). Plugins and body
+   * aren't available for those */
+  bool contentSupported() const;
+
+  /* called from the reading thread as phases complete. Phases can only move forward */
+  void setPhase(Phase phase);
+  void failRead(const std::string &error);
+  /* remember in which section reading failed and where. Called on the reading thread */
+  void recordParseError(FileWrapper &file, const std::exception &error);
+
+  /* restore the fields from a shared cache entry. Returns false if the entry can't be used */
+  bool restoreCached(const std::vector<uint8_t> &entry);
+  void storeCached(SharedCache &cache, const SharedCache::Key &key) const;
+  void storeThumbnail(ThumbnailStore &store, const FileKey &key) const;
+
   void readOblivion(FileWrapper &file);
   void readSkyrim(FileWrapper &file);
   void readFO3(FileWrapper &file);
   void readFO4(FileWrapper &file);
+  void readMorrowind(FileWrapper &file);
+  void readStarfield(FileWrapper &file);
+
+  // everything after the header fields, skipped in quick mode
+  void readOblivionContent(FileWrapper &file);
+  void readSkyrimContent(FileWrapper &file);
+  void readFO3Content(FileWrapper &file);
+  void readFO4Content(FileWrapper &file);
+  void readMorrowindContent(FileWrapper &file);
+  void readStarfieldContent(FileWrapper &file);
+
+  /* walk the content (in discard mode) if that didn't happen during the initial parse so that the
+   * locations of screenshot and body are known. m_BodyMutex has to be held */
+  void locateContent();
+
+  /* open the save positioned at its file location table. If the body location isn't known yet
+   * (quick read) the file is walked again without touching the fields already read */
+  std::shared_ptr<IDecoder> openBody(BodyFormat &format);
+
+  /* payload of a global data entry, cached after the first request. nullptr if the save has none */
+  std::shared_ptr<const std::vector<uint8_t>> globalData(uint32_t type);
+
+  /* result of convert for the global data entry of the given type (undefined if there is none).
+   * If info[callbackIdx] is a function the entry gets read in the background and the result
+   * passed to that callback instead */
+  Napi::Value globalDataToJS(const Napi::CallbackInfo &info, size_t callbackIdx, uint32_t type,
+                             std::function<Napi::Value(Napi::Env, const std::vector<uint8_t>&)> convert);
+
+  /* the form id array, cached after the first request */
+  std::shared_ptr<const std::vector<uint32_t>> formIdArray();
 
 private:
 
-  Napi::ThreadSafeFunction m_ThreadCB;
 
   bool m_QuickRead;
   std::string m_FileName;
@@ -233,8 +584,51 @@ private:
   uint32_t m_SaveNumber;
   uint32_t m_CreationTime;
   std::vector<std::string> m_Plugins;
+  PluginFingerprint m_PluginFingerprint;
   Dimensions m_ScreenshotDim;
-  std::vector<uint8_t> m_Screenshot;
+  Screenshot m_Screenshot;
+
+  unsigned long m_HeaderVersion;
+  uint64_t m_ContentOffset;
+  void (GamebryoSaveGame::*m_ContentReader)(FileWrapper &file);
+  bool m_ContentLocated;
+  // restored from a cache entry for an older version of the file
+  bool m_Stale;
+  // this object reads a save again because the previous result was stale, so it doesn't accept stale entries
+  bool m_Revalidation;
+  ScreenshotLayout m_ScreenshotLayout;
+  std::mutex m_BodyMutex;
+  BodyLocation m_Body;
+  std::mutex m_GlobalDataMutex;
+  std::map<uint32_t, std::shared_ptr<const std::vector<uint8_t>>> m_GlobalData;
+  std::shared_ptr<const std::vector<uint32_t>> m_FormIds;
+
+  std::atomic<int> m_Phase;
+  bool m_ReadFailed;
+  std::string m_ReadError;
+  struct ParseError {
+    // empty if there was none
+    std::string section;
+    uint64_t offset{ 0 };
+    bool compressed{ false };
+    std::string message;
+  };
+  ParseError m_ParseError;
+  // when the parts of the file were done, for the slow log. Only set during read() and only if the
+  // log is enabled. A point left at its default wasn't reached
+  struct ParseTiming {
+    std::chrono::steady_clock::time_point start;
+    std::chrono::steady_clock::time_point opened;
+    std::chrono::steady_clock::time_point phases[PHASE_COMPLETE + 1];
+    double decompressTime{ 0.0 };
+  };
+  std::unique_ptr<ParseTiming> m_Timing;
+  mutable std::mutex m_PhaseMutex;
+  mutable std::condition_variable m_PhaseChanged;
+  // set while reading in the background for open(), phase changes get announced through this
+  std::shared_ptr<ResultDelivery> m_PhaseDelivery;
+  // js thread only
+  std::vector<std::pair<Phase, Napi::Promise::Deferred>> m_PhasePromises;
 
 };
 
@@ -245,6 +639,22 @@ Napi::Object InitAll(Napi::Env env, Napi::Object exports) {
   GamebryoSaveGame::Init(env, exports);
 
   exports.Set("create", Napi::Function::New(env, create));
+  exports.Set("open", Napi::Function::New(env, openSave));
+  exports.Set("configure", Napi::Function::New(env, configure));
+  exports.Set("createAtlas", Napi::Function::New(env, createAtlas));
+  exports.Set("remapFormIds", Napi::Function::New(env, remapFormIds));
+  exports.Set("recompress", Napi::Function::New(env, recompress));
+  exports.Set("fingerprintPlugins", Napi::Function::New(env, fingerprintPlugins));
+  exports.Set("recompressBatch", Napi::Function::New(env, recompressBatch));
+  exports.Set("getThumbnail", Napi::Function::New(env, getThumbnail));
+  exports.Set("getThumbnailPath", Napi::Function::New(env, getThumbnailPath));
+  exports.Set("getStats", Napi::Function::New(env, getStats));
+  exports.Set("getSlowLog", Napi::Function::New(env, getSlowLog));
+  exports.Set("trim", Napi::Function::New(env, trim));
+  exports.Set("onUpdate", Napi::Function::New(env, onUpdate));
+
+  CpuDispatch::init();
+  MemoryPressure::instance().setMonitoring(true);
 
   return exports;
 }
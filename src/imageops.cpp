@@ -0,0 +1,119 @@
+#include "imageops.h"
+#include "cpudispatch.h"
+
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+#include <zlib.h>
+
+namespace {
+
+void writeU32BE(uint8_t *out, uint32_t value) {
+  out[0] = static_cast<uint8_t>(value >> 24);
+  out[1] = static_cast<uint8_t>(value >> 16);
+  out[2] = static_cast<uint8_t>(value >> 8);
+  out[3] = static_cast<uint8_t>(value);
+}
+
+void appendChunk(std::vector<uint8_t> &out, const char *type, const uint8_t *data, size_t size) {
+  size_t offset = out.size();
+  out.resize(offset + 12 + size);
+  writeU32BE(&out[offset], static_cast<uint32_t>(size));
+  memcpy(&out[offset + 4], type, 4);
+  if (size > 0) {
+    memcpy(&out[offset + 8], data, size);
+  }
+  // the crc covers type and data
+  uLong crc = crc32(0L, &out[offset + 4], static_cast<uInt>(size + 4));
+  writeU32BE(&out[offset + 8 + size], static_cast<uint32_t>(crc));
+}
+
+}
+
+void downscaleRGBA(const uint8_t *src, uint32_t srcWidth, uint32_t srcHeight,
+                   uint8_t *dst, uint32_t dstWidth, uint32_t dstHeight, uint32_t dstStride)
+{
+  auto sumRGBA = CpuDispatch::kernels().sumRGBA;
+  for (uint32_t y = 0; y < dstHeight; ++y) {
+    uint32_t srcY0 = static_cast<uint32_t>(static_cast<uint64_t>(y) * srcHeight / dstHeight);
+    uint32_t srcY1 = (std::max)(srcY0 + 1, static_cast<uint32_t>(static_cast<uint64_t>(y + 1) * srcHeight / dstHeight));
+    uint8_t *out = dst + static_cast<size_t>(y) * dstStride;
+
+    for (uint32_t x = 0; x < dstWidth; ++x, out += 4) {
+      uint32_t srcX0 = static_cast<uint32_t>(static_cast<uint64_t>(x) * srcWidth / dstWidth);
+      uint32_t srcX1 = (std::max)(srcX0 + 1, static_cast<uint32_t>(static_cast<uint64_t>(x + 1) * srcWidth / dstWidth));
+
+      uint32_t sum[4] = { 0, 0, 0, 0 };
+      for (uint32_t sy = srcY0; sy < srcY1; ++sy) {
+        sumRGBA(src + (static_cast<size_t>(sy) * srcWidth + srcX0) * 4, srcX1 - srcX0, sum);
+      }
+
+      uint32_t count = (srcY1 - srcY0) * (srcX1 - srcX0);
+      for (int c = 0; c < 4; ++c) {
+        out[c] = static_cast<uint8_t>((sum[c] + count / 2) / count);
+      }
+    }
+  }
+}
+
+void fitInto(uint32_t width, uint32_t height, uint32_t maxWidth, uint32_t maxHeight,
+             uint32_t &outWidth, uint32_t &outHeight)
+{
+  if ((width == 0) || (height == 0)) {
+    outWidth = outHeight = 0;
+    return;
+  }
+
+  // compare the aspect ratios without going through floating point
+  if (static_cast<uint64_t>(width) * maxHeight > static_cast<uint64_t>(height) * maxWidth) {
+    outWidth = maxWidth;
+    outHeight = static_cast<uint32_t>((static_cast<uint64_t>(height) * maxWidth + width / 2) / width);
+  } else {
+    outHeight = maxHeight;
+    outWidth = static_cast<uint32_t>((static_cast<uint64_t>(width) * maxHeight + height / 2) / height);
+  }
+  outWidth = (std::max)(1u, (std::min)(outWidth, maxWidth));
+  outHeight = (std::max)(1u, (std::min)(outHeight, maxHeight));
+}
+
+std::vector<uint8_t> encodePNG(const uint8_t *rgba, uint32_t width, uint32_t height)
+{
+  static const uint8_t SIGNATURE[] = { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1a, '\n' };
+
+  // each row is prefixed with its filter type. Sub (difference to the pixel on the left) is cheap
+  // and compresses screenshots a good deal better than no filter at all
+  size_t rowSize = static_cast<size_t>(width) * 4;
+  std::vector<uint8_t> filtered((rowSize + 1) * height);
+  for (uint32_t y = 0; y < height; ++y) {
+    const uint8_t *in = rgba + y * rowSize;
+    uint8_t *out = &filtered[y * (rowSize + 1)];
+    *out++ = 1;
+    memcpy(out, in, (std::min<size_t>)(4, rowSize));
+    for (size_t i = 4; i < rowSize; ++i) {
+      out[i] = static_cast<uint8_t>(in[i] - in[i - 4]);
+    }
+  }
+
+  uLongf compressedSize = compressBound(static_cast<uLong>(filtered.size()));
+  std::vector<uint8_t> compressed(compressedSize);
+  if (compress2(compressed.data(), &compressedSize, filtered.data(), static_cast<uLong>(filtered.size()),
+                Z_DEFAULT_COMPRESSION) != Z_OK) {
+    throw std::runtime_error("failed to compress image");
+  }
+
+  uint8_t header[13];
+  writeU32BE(header, width);
+  writeU32BE(header + 4, height);
+  header[8] = 8;  // bit depth
+  header[9] = 6;  // color type rgba
+  header[10] = 0; // compression
+  header[11] = 0; // filter method
+  header[12] = 0; // no interlacing
+
+  std::vector<uint8_t> result(SIGNATURE, SIGNATURE + sizeof(SIGNATURE));
+  result.reserve(sizeof(SIGNATURE) + 3 * 12 + sizeof(header) + compressedSize);
+  appendChunk(result, "IHDR", header, sizeof(header));
+  appendChunk(result, "IDAT", compressed.data(), compressedSize);
+  appendChunk(result, "IEND", nullptr, 0);
+  return result;
+}
@@ -0,0 +1,18 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+/* scale an rgba image to the specified size, averaging all source pixels covered by each
+ * target pixel (or repeating pixels when enlarging).
+ * dstStride is the distance between rows in the target buffer in bytes */
+void downscaleRGBA(const uint8_t *src, uint32_t srcWidth, uint32_t srcHeight,
+                   uint8_t *dst, uint32_t dstWidth, uint32_t dstHeight, uint32_t dstStride);
+
+/* determine the largest size an image can be scaled to while fitting into the bounds
+ * without changing its aspect ratio */
+void fitInto(uint32_t width, uint32_t height, uint32_t maxWidth, uint32_t maxHeight,
+             uint32_t &outWidth, uint32_t &outHeight);
+
+/* encode an rgba image as png (8 bits per channel, sub filter, zlib compressed) */
+std::vector<uint8_t> encodePNG(const uint8_t *rgba, uint32_t width, uint32_t height);
@@ -0,0 +1,306 @@
+#include "memorypressure.h"
+#include "bufferpool.h"
+#include "savebody.h"
+#include "screenshot.h"
+
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+
+#ifdef _WIN32
+#include <malloc.h>
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#endif
+
+#ifdef __GLIBC__
+#include <malloc.h>
+#endif
+
+namespace {
+
+// pressure usually lasts a while, after a trim wait this long before reacting again
+const int TRIM_COOLDOWN_MS = 5000;
+
+#ifndef _WIN32
+
+// notify when tasks were stalled on memory for 150ms within 2 seconds (the shortest window
+// unprivileged processes may use)
+const char PSI_TRIGGER[] = "some 150000 2000000";
+
+int openPSI(const std::string &path) {
+  int fd = ::open(path.c_str(), O_RDWR | O_NONBLOCK | O_CLOEXEC);
+  if (fd < 0) {
+    return -1;
+  }
+  if (::write(fd, PSI_TRIGGER, sizeof(PSI_TRIGGER)) < 0) {
+    ::close(fd);
+    return -1;
+  }
+  return fd;
+}
+
+/* directory of the cgroup (v2) we're in, empty if there is none */
+std::string cgroupDirectory() {
+  std::ifstream file("/proc/self/cgroup");
+  std::string line;
+  while (std::getline(file, line)) {
+    if (line.compare(0, 3, "0::") == 0) {
+      return "/sys/fs/cgroup" + line.substr(3);
+    }
+  }
+  return std::string();
+}
+
+/* number of times the cgroup hit its high or max limit or ran out of memory */
+uint64_t readEventCount(int fd) {
+  char buffer[512];
+  if (::lseek(fd, 0, SEEK_SET) < 0) {
+    return 0;
+  }
+  ssize_t size = ::read(fd, buffer, sizeof(buffer) - 1);
+  if (size <= 0) {
+    return 0;
+  }
+  buffer[size] = '\0';
+
+  uint64_t result = 0;
+  for (char *line = buffer; (line != nullptr) && (*line != '\0'); ) {
+    char *end = strchr(line, '\n');
+    if (end != nullptr) {
+      *end = '\0';
+    }
+    char *value = strchr(line, ' ');
+    if (value != nullptr) {
+      *value++ = '\0';
+      if ((strcmp(line, "high") == 0) || (strcmp(line, "max") == 0) || (strcmp(line, "oom") == 0)) {
+        result += strtoull(value, nullptr, 10);
+      }
+    }
+    line = end != nullptr ? end + 1 : nullptr;
+  }
+  return result;
+}
+
+#endif
+
+}
+
+MemoryPressure &MemoryPressure::instance()
+{
+  // intentionally leaked, the monitor thread may still be running at exit
+  static MemoryPressure *s_Instance = new MemoryPressure();
+  return *s_Instance;
+}
+
+MemoryPressure::MemoryPressure()
+  : m_Source("none")
+  , m_Events(0)
+  , m_Trims(0)
+  , m_Freed(0)
+#ifdef _WIN32
+  , m_StopEvent(nullptr)
+  , m_Notification(nullptr)
+#else
+  , m_PressureFD(-1)
+  , m_CountEvents(false)
+  , m_EventCount(0)
+#endif
+{
+  memset(&m_LastTrim, 0, sizeof(TrimResult));
+#ifndef _WIN32
+  m_StopPipe[0] = m_StopPipe[1] = -1;
+#endif
+}
+
+void MemoryPressure::setMonitoring(bool enabled)
+{
+  std::lock_guard<std::mutex> control(m_ControlMutex);
+  if (!enabled) {
+    stopMonitor();
+    return;
+  }
+  if (m_Thread.joinable()) {
+    return;
+  }
+
+  std::string source;
+#ifdef _WIN32
+  m_Notification = ::CreateMemoryResourceNotification(LowMemoryResourceNotification);
+  m_StopEvent = ::CreateEventW(nullptr, TRUE, FALSE, nullptr);
+  if ((m_Notification == nullptr) || (m_StopEvent == nullptr)) {
+    stopMonitor();
+    return;
+  }
+  source = "windows";
+#else
+  m_PressureFD = openPSI("/proc/pressure/memory");
+  source = "psi";
+  std::string cgroup = cgroupDirectory();
+  if ((m_PressureFD < 0) && !cgroup.empty()) {
+    m_PressureFD = openPSI(cgroup + "/memory.pressure");
+    source = "cgroup-psi";
+    if (m_PressureFD < 0) {
+      m_PressureFD = ::open((cgroup + "/memory.events").c_str(), O_RDONLY | O_CLOEXEC);
+      source = "cgroup-events";
+      if (m_PressureFD >= 0) {
+        m_CountEvents = true;
+        m_EventCount = readEventCount(m_PressureFD);
+      }
+    }
+  }
+  if ((m_PressureFD < 0) || (::pipe(m_StopPipe) != 0)) {
+    stopMonitor();
+    return;
+  }
+#endif
+
+  {
+    std::lock_guard<std::mutex> lock(m_Mutex);
+    m_Source = source;
+  }
+  m_Thread = std::thread([this] { monitor(); });
+}
+
+void MemoryPressure::stopMonitor()
+{
+  if (m_Thread.joinable()) {
+#ifdef _WIN32
+    ::SetEvent(m_StopEvent);
+#else
+    char stop = 0;
+    while ((::write(m_StopPipe[1], &stop, 1) < 0) && (errno == EINTR)) {
+    }
+#endif
+    m_Thread.join();
+  }
+
+#ifdef _WIN32
+  if (m_Notification != nullptr) {
+    ::CloseHandle(m_Notification);
+    m_Notification = nullptr;
+  }
+  if (m_StopEvent != nullptr) {
+    ::CloseHandle(m_StopEvent);
+    m_StopEvent = nullptr;
+  }
+#else
+  for (int *fd : { &m_PressureFD, &m_StopPipe[0], &m_StopPipe[1] }) {
+    if (*fd >= 0) {
+      ::close(*fd);
+      *fd = -1;
+    }
+  }
+  m_CountEvents = false;
+#endif
+
+  std::lock_guard<std::mutex> lock(m_Mutex);
+  m_Source = "none";
+}
+
+void MemoryPressure::monitor()
+{
+  while (waitForPressure()) {
+    {
+      std::lock_guard<std::mutex> lock(m_Mutex);
+      ++m_Events;
+    }
+    trim();
+    if (!sleep(TRIM_COOLDOWN_MS)) {
+      break;
+    }
+  }
+}
+
+bool MemoryPressure::waitForPressure()
+{
+#ifdef _WIN32
+  HANDLE handles[] = { m_StopEvent, m_Notification };
+  return ::WaitForMultipleObjects(2, handles, FALSE, INFINITE) == WAIT_OBJECT_0 + 1;
+#else
+  for (;;) {
+    pollfd fds[2];
+    fds[0].fd = m_PressureFD;
+    fds[0].events = POLLPRI;
+    fds[0].revents = 0;
+    fds[1].fd = m_StopPipe[0];
+    fds[1].events = POLLIN;
+    fds[1].revents = 0;
+    if (::poll(fds, 2, -1) < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      return false;
+    }
+    if (fds[1].revents != 0) {
+      return false;
+    }
+    if (m_CountEvents) {
+      // the file signals any change, only some of them mean pressure
+      uint64_t count = readEventCount(m_PressureFD);
+      if (count > m_EventCount) {
+        m_EventCount = count;
+        return true;
+      }
+    } else if ((fds[0].revents & POLLERR) != 0) {
+      // the psi trigger is gone
+      return false;
+    } else if ((fds[0].revents & POLLPRI) != 0) {
+      return true;
+    }
+  }
+#endif
+}
+
+bool MemoryPressure::sleep(int milliseconds)
+{
+#ifdef _WIN32
+  return ::WaitForSingleObject(m_StopEvent, milliseconds) == WAIT_TIMEOUT;
+#else
+  pollfd fd;
+  fd.fd = m_StopPipe[0];
+  fd.events = POLLIN;
+  fd.revents = 0;
+  int res;
+  while (((res = ::poll(&fd, 1, milliseconds)) < 0) && (errno == EINTR)) {
+  }
+  return res == 0;
+#endif
+}
+
+MemoryPressure::TrimResult MemoryPressure::trim()
+{
+  TrimResult result;
+  result.screenshotCache = Screenshot::trimCache();
+  result.bufferPool = BufferPool::instance().trim();
+  result.inflaters = trimInflaters();
+
+  // hand what the allocator keeps cached back to the system as well
+#ifdef _WIN32
+  _heapmin();
+#elif defined(__GLIBC__)
+  malloc_trim(0);
+#endif
+
+  std::lock_guard<std::mutex> lock(m_Mutex);
+  ++m_Trims;
+  m_Freed += result.total();
+  m_LastTrim = result;
+  return result;
+}
+
+MemoryPressure::Stats MemoryPressure::stats() const
+{
+  std::lock_guard<std::mutex> lock(m_Mutex);
+  Stats result;
+  result.monitor = m_Source;
+  result.pressureEvents = m_Events;
+  result.trims = m_Trims;
+  result.freedTotal = m_Freed;
+  result.lastTrim = m_LastTrim;
+  return result;
+}
@@ -0,0 +1,83 @@
+#pragma once
+
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <thread>
+
+/**
+ * Frees memory held by caches and pools (decoded screenshots, idle buffers, per-thread decompression
+ * state) when the system runs low on memory, so that a game running next to us doesn't get pushed
+ * into swap by memory we only keep around for speed.
+ * Pressure is detected through PSI (/proc/pressure/memory, or the memory.pressure of our cgroup),
+ * the memory.events of our cgroup or the low memory notification on windows, whichever is available.
+ * trim() does the same on demand
+ */
+class MemoryPressure {
+public:
+  /* bytes freed by a trim, per source */
+  struct TrimResult {
+    uint64_t screenshotCache;
+    uint64_t bufferPool;
+    uint64_t inflaters;
+
+    uint64_t total() const { return screenshotCache + bufferPool + inflaters; }
+  };
+
+  struct Stats {
+    // the mechanism used to detect pressure, "none" if monitoring is off or nothing is available
+    std::string monitor;
+    uint64_t pressureEvents;
+    uint64_t trims;
+    uint64_t freedTotal;
+    TrimResult lastTrim;
+  };
+
+  static MemoryPressure &instance();
+
+  /* start or stop watching for memory pressure */
+  void setMonitoring(bool enabled);
+
+  /* free what can be freed right now */
+  TrimResult trim();
+
+  Stats stats() const;
+
+private:
+
+  MemoryPressure();
+
+  void stopMonitor();
+  void monitor();
+  /* the next pressure event, false once the monitor is supposed to stop */
+  bool waitForPressure();
+  /* false if the monitor is supposed to stop within the delay */
+  bool sleep(int milliseconds);
+
+private:
+
+  // serializes starting and stopping the monitor
+  std::mutex m_ControlMutex;
+  std::thread m_Thread;
+
+  mutable std::mutex m_Mutex;
+  std::string m_Source;
+  uint64_t m_Events;
+  uint64_t m_Trims;
+  uint64_t m_Freed;
+  TrimResult m_LastTrim;
+
+#ifdef _WIN32
+  void *m_StopEvent;
+  void *m_Notification;
+#else
+  // wakes up the monitor thread when it's supposed to stop
+  int m_StopPipe[2];
+  int m_PressureFD;
+  // set if m_PressureFD is the memory.events of the cgroup rather than a psi trigger. Pressure is
+  // then the sum of its counters increasing
+  bool m_CountEvents;
+  uint64_t m_EventCount;
+#endif
+
+};
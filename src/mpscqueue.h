@@ -0,0 +1,61 @@
+#pragma once
+
+#include <atomic>
+#include <utility>
+
+/**
+ * Unbounded multi-producer single-consumer queue (after Dmitry Vyukov's intrusive mpsc queue).
+ * push never blocks or retries, any number of threads may call it at the same time.
+ * pop must only be called from one thread at a time. A push that is still in progress may not be
+ * visible to pop yet, callers need their own signal to make sure the consumer looks again afterwards
+ */
+template <typename T>
+class MPSCQueue {
+public:
+  MPSCQueue()
+    : m_Head(new Node())
+    , m_Tail(m_Head.load())
+  {
+  }
+
+  ~MPSCQueue() {
+    T value;
+    while (pop(value)) {
+    }
+    delete m_Tail;
+  }
+
+  MPSCQueue(const MPSCQueue&) = delete;
+  MPSCQueue &operator=(const MPSCQueue&) = delete;
+
+  void push(T value) {
+    Node *node = new Node(std::move(value));
+    Node *previous = m_Head.exchange(node, std::memory_order_acq_rel);
+    previous->next.store(node, std::memory_order_release);
+  }
+
+  bool pop(T &value) {
+    // m_Tail is a node whose value has been consumed already, the next one holds the oldest value
+    Node *next = m_Tail->next.load(std::memory_order_acquire);
+    if (next == nullptr) {
+      return false;
+    }
+    value = std::move(next->value);
+    delete m_Tail;
+    m_Tail = next;
+    return true;
+  }
+
+private:
+
+  struct Node {
+    Node() : value(), next(nullptr) {}
+    explicit Node(T &&val) : value(std::move(val)), next(nullptr) {}
+    T value;
+    std::atomic<Node*> next;
+  };
+
+  std::atomic<Node*> m_Head;
+  Node *m_Tail;
+
+};
@@ -0,0 +1,262 @@
+#include "readscheduler.h"
+#include "threadpool.h"
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <exception>
+#include <thread>
+
+#include "fmt/format.h"
+
+namespace {
+
+// a window ends after this much time and at least MIN_WINDOW_JOBS completions
+const std::chrono::milliseconds WINDOW_DURATION(1000);
+const uint32_t MIN_WINDOW_JOBS = 4;
+
+// throughput has to change by this factor to count as a change at all
+const double THROUGHPUT_TOLERANCE = 1.05;
+// latency growing by more than this without a throughput gain means the storage is saturated
+const double LATENCY_TOLERANCE = 1.5;
+
+uint32_t hardwareThreads() {
+  return (std::max)(2u, std::thread::hardware_concurrency());
+}
+
+}
+
+ReadScheduler &ReadScheduler::instance()
+{
+  // intentionally leaked, like the thread pool
+  static ReadScheduler *s_Instance = new ReadScheduler();
+  return *s_Instance;
+}
+
+ReadScheduler::ReadScheduler()
+  : m_BackgroundRunning(false)
+  , m_Limit(2)
+  , m_MaxLimit((std::max)(8u, hardwareThreads() * 2))
+  , m_Adaptive(true)
+  , m_Reason("initial")
+  , m_InFlight(0)
+  , m_Completed(0)
+  , m_WindowStart(Clock::now())
+  , m_WindowCompleted(0)
+  , m_WindowRunTime(0.0)
+  , m_WindowQueueTime(0.0)
+  , m_WindowStarved(false)
+  , m_LastChange(0)
+  , m_Throughput(0.0)
+  , m_Latency(0.0)
+  , m_QueueLatency(0.0)
+{
+  // reads spend most of their time waiting for the disk, so this pool is separate from
+  // the cpu bound one and may have more threads than there are cores
+  m_Pool.reset(new ThreadPool(m_MaxLimit));
+}
+
+void ReadScheduler::configure(uint32_t limit, uint32_t maxLimit)
+{
+  std::unique_lock<std::mutex> lock(m_Mutex);
+  if (maxLimit != 0) {
+    m_MaxLimit = (std::min)(maxLimit, static_cast<uint32_t>(m_Pool->size()));
+  }
+  m_Adaptive = limit == 0;
+  if (m_Adaptive) {
+    m_Limit = (std::min)(m_Limit, m_MaxLimit);
+    m_Reason = "configured adaptive";
+  } else {
+    m_Limit = (std::min)(limit, static_cast<uint32_t>(m_Pool->size()));
+    m_Reason = "configured fixed";
+  }
+  m_WindowStart = Clock::now();
+  m_WindowCompleted = 0;
+  m_WindowRunTime = m_WindowQueueTime = 0.0;
+  m_WindowStarved = false;
+  m_LastChange = 0;
+  pump(lock);
+}
+
+void ReadScheduler::submit(std::function<void()> job)
+{
+  std::unique_lock<std::mutex> lock(m_Mutex);
+  m_Queue.push_back(Job{ std::move(job), Clock::now(), false });
+  pump(lock);
+}
+
+void ReadScheduler::submitBackground(std::function<void()> job)
+{
+  std::unique_lock<std::mutex> lock(m_Mutex);
+  m_BackgroundQueue.push_back(Job{ std::move(job), Clock::now(), true });
+  pump(lock);
+}
+
+void ReadScheduler::runAll(size_t count, const std::function<void(size_t)> &func)
+{
+  struct State {
+    size_t done{ 0 };
+    std::exception_ptr error;
+    std::mutex mutex;
+    std::condition_variable finished;
+  };
+
+  if (count == 0) {
+    return;
+  }
+
+  std::shared_ptr<State> state = std::make_shared<State>();
+  std::shared_ptr<std::function<void(size_t)>> funcPtr = std::make_shared<std::function<void(size_t)>>(func);
+  for (size_t idx = 0; idx < count; ++idx) {
+    submit([state, funcPtr, idx, count]() {
+      try {
+        (*funcPtr)(idx);
+      }
+      catch (...) {
+        std::lock_guard<std::mutex> lock(state->mutex);
+        if (!state->error) {
+          state->error = std::current_exception();
+        }
+      }
+      std::lock_guard<std::mutex> lock(state->mutex);
+      if (++state->done == count) {
+        state->finished.notify_all();
+      }
+    });
+  }
+
+  std::unique_lock<std::mutex> lock(state->mutex);
+  state->finished.wait(lock, [&]() { return state->done == count; });
+  if (state->error) {
+    std::rethrow_exception(state->error);
+  }
+}
+
+ReadScheduler::Stats ReadScheduler::stats() const
+{
+  std::lock_guard<std::mutex> lock(m_Mutex);
+  Stats result;
+  result.limit = m_Limit;
+  result.maxLimit = m_MaxLimit;
+  result.adaptive = m_Adaptive;
+  result.reason = m_Reason;
+  result.inFlight = m_InFlight;
+  result.queued = m_Queue.size();
+  result.queuedBackground = m_BackgroundQueue.size();
+  result.completed = m_Completed;
+  result.throughput = m_Throughput;
+  result.latencyMs = m_Latency;
+  result.queueMs = m_QueueLatency;
+  return result;
+}
+
+void ReadScheduler::pump(std::unique_lock<std::mutex>&)
+{
+  while (m_InFlight < m_Limit) {
+    std::deque<Job> *queue = &m_Queue;
+    if (m_Queue.empty()) {
+      if (m_BackgroundQueue.empty() || m_BackgroundRunning) {
+        break;
+      }
+      queue = &m_BackgroundQueue;
+      m_BackgroundRunning = true;
+    }
+    ++m_InFlight;
+    std::shared_ptr<Job> job = std::make_shared<Job>(std::move(queue->front()));
+    queue->pop_front();
+    m_Pool->submit([this, job]() { run(std::move(*job)); });
+  }
+  if (m_InFlight < m_Limit) {
+    m_WindowStarved = true;
+  }
+}
+
+void ReadScheduler::run(Job job)
+{
+  Clock::time_point start = Clock::now();
+  try {
+    job.func();
+  }
+  catch (...) {
+    // jobs report their errors themselves, this is only a safety net for the worker thread
+  }
+  Clock::time_point end = Clock::now();
+
+  std::unique_lock<std::mutex> lock(m_Mutex);
+  --m_InFlight;
+  if (job.background) {
+    m_BackgroundRunning = false;
+  }
+  ++m_Completed;
+  ++m_WindowCompleted;
+  m_WindowRunTime += std::chrono::duration<double, std::milli>(end - start).count();
+  m_WindowQueueTime += std::chrono::duration<double, std::milli>(start - job.queued).count();
+  if ((m_WindowCompleted >= MIN_WINDOW_JOBS) && (end - m_WindowStart >= WINDOW_DURATION)) {
+    adapt(end);
+  }
+  pump(lock);
+}
+
+void ReadScheduler::adapt(Clock::time_point now)
+{
+  double seconds = std::chrono::duration<double>(now - m_WindowStart).count();
+  double throughput = m_WindowCompleted / seconds;
+  double latency = m_WindowRunTime / m_WindowCompleted;
+  double previousThroughput = m_Throughput;
+  double previousLatency = m_Latency;
+
+  m_Throughput = throughput;
+  m_Latency = latency;
+  m_QueueLatency = m_WindowQueueTime / m_WindowCompleted;
+
+  bool starved = m_WindowStarved;
+  m_WindowStart = now;
+  m_WindowCompleted = 0;
+  m_WindowRunTime = m_WindowQueueTime = 0.0;
+  m_WindowStarved = false;
+
+  if (!m_Adaptive) {
+    return;
+  }
+
+  int lastChange = m_LastChange;
+  m_LastChange = 0;
+
+  if (starved) {
+    // the limit wasn't what held anything back
+    m_Reason = fmt::format("holding, no backlog ({:.1f} reads/s)", throughput);
+    return;
+  }
+
+  if (lastChange < 0) {
+    // measure at the reduced limit before probing upwards again
+    m_Reason = fmt::format("holding after decrease ({:.1f} reads/s, {:.1f} ms)", throughput, latency);
+    return;
+  }
+
+  if (lastChange > 0) {
+    // did the last increase pay off?
+    bool gained = throughput > previousThroughput * THROUGHPUT_TOLERANCE;
+    bool dropped = throughput * THROUGHPUT_TOLERANCE < previousThroughput;
+    bool slower = latency > previousLatency * LATENCY_TOLERANCE;
+    if (dropped || (slower && !gained)) {
+      uint32_t reduced = (std::max)(1u, (std::min)(m_Limit - 1, m_Limit * 3 / 4));
+      m_Reason = dropped
+        ? fmt::format("decreased from {}, throughput fell from {:.1f} to {:.1f} reads/s",
+                      m_Limit, previousThroughput, throughput)
+        : fmt::format("decreased from {}, latency rose from {:.1f} to {:.1f} ms without more throughput",
+                      m_Limit, previousLatency, latency);
+      m_Limit = reduced;
+      m_LastChange = -1;
+      return;
+    }
+  }
+
+  if (m_Limit < m_MaxLimit) {
+    ++m_Limit;
+    m_LastChange = 1;
+    m_Reason = fmt::format("increased to probe for more throughput ({:.1f} reads/s, {:.1f} ms)", throughput, latency);
+  } else {
+    m_Reason = fmt::format("at maximum ({:.1f} reads/s, {:.1f} ms)", throughput, latency);
+  }
+}
@@ -0,0 +1,108 @@
+#pragma once
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+
+class ThreadPool;
+
+/**
+ * Runs file reading jobs (parsing saves, batch conversions) with a limit on how many are in flight.
+ * The best limit depends on the storage: a local ssd profits from many parallel reads while a usb disk
+ * or network share gets slower with each additional one. Unless a fixed limit is configured, the limit
+ * is adapted at runtime (AIMD): while jobs are waiting it grows by one per measurement window. If an
+ * increase lowered throughput, or raised latency without raising throughput, the limit is cut by a
+ * quarter and held for one window before probing again
+ */
+class ReadScheduler {
+public:
+  struct Stats {
+    uint32_t limit;
+    uint32_t maxLimit;
+    bool adaptive;
+    // why the limit is what it is
+    std::string reason;
+    uint32_t inFlight;
+    size_t queued;
+    size_t queuedBackground;
+    uint64_t completed;
+    // of the last measurement window
+    double throughput;
+    double latencyMs;
+    double queueMs;
+  };
+
+  static ReadScheduler &instance();
+
+  /* limit 0 adapts the limit automatically, otherwise it's fixed. maxLimit caps the adaptive limit,
+   * 0 keeps the current maximum */
+  void configure(uint32_t limit, uint32_t maxLimit);
+
+  /* run job as soon as the limit allows */
+  void submit(std::function<void()> job);
+
+  /* run job when no other jobs are waiting. Only one background job runs at a time so they don't
+   * hold up jobs submitted after them for long */
+  void submitBackground(std::function<void()> job);
+
+  /* run func for each index in [0, count) through the scheduler and wait for all of them.
+   * If any invocation throws, the first exception is rethrown */
+  void runAll(size_t count, const std::function<void(size_t)> &func);
+
+  Stats stats() const;
+
+private:
+
+  typedef std::chrono::steady_clock Clock;
+
+  struct Job {
+    std::function<void()> func;
+    Clock::time_point queued;
+    bool background;
+  };
+
+  ReadScheduler();
+
+  /* start queued jobs while there are free slots. Only takes the lock to show it has to be held */
+  void pump(std::unique_lock<std::mutex> &lock);
+  void run(Job job);
+  void adapt(Clock::time_point now);
+
+private:
+
+  std::unique_ptr<ThreadPool> m_Pool;
+
+  mutable std::mutex m_Mutex;
+  std::deque<Job> m_Queue;
+  std::deque<Job> m_BackgroundQueue;
+  bool m_BackgroundRunning;
+  uint32_t m_Limit;
+  uint32_t m_MaxLimit;
+  bool m_Adaptive;
+  std::string m_Reason;
+  uint32_t m_InFlight;
+  uint64_t m_Completed;
+
+  // current measurement window
+  Clock::time_point m_WindowStart;
+  uint32_t m_WindowCompleted;
+  double m_WindowRunTime;
+  double m_WindowQueueTime;
+  // whether there was a moment during the window when fewer jobs than allowed were running because
+  // none were waiting. The measurements then say nothing about whether the limit is right
+  bool m_WindowStarved;
+
+  // change made at the end of the last window: 1 increased, -1 decreased, 0 none
+  int m_LastChange;
+
+  // results of the last window
+  double m_Throughput;
+  double m_Latency;
+  double m_QueueLatency;
+
+};
@@ -0,0 +1,186 @@
+#include "recompress.h"
+#include "fileops.h"
+#include "streamcodec.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <fstream>
+#include <limits>
+#include <stdexcept>
+#include <vector>
+
+#include "string_cast.h"
+#include "fmt/format.h"
+
+namespace {
+
+const char SKYRIM_MAGIC[] = "TESV_SAVEGAME";
+const size_t MAGIC_LENGTH = sizeof(SKYRIM_MAGIC) - 1;
+// header versions before this are the original Skyrim which doesn't compress
+const uint32_t SKYRIMSE_VERSION = 0x0c;
+
+const size_t COPY_CHUNK = 1024 * 1024;
+
+template <typename T> T readValue(std::ifstream &file, const std::string &fileName) {
+  T value;
+  if (!file.read(reinterpret_cast<char*>(&value), sizeof(T))) {
+    throw std::runtime_error(fmt::format("unexpected end of file in \"{}\"", fileName));
+  }
+  return value;
+}
+
+template <typename T> T valueAt(const std::vector<char> &buffer, size_t offset) {
+  T value;
+  memcpy(&value, buffer.data() + offset, sizeof(T));
+  return value;
+}
+
+void write(std::ofstream &file, const void *data, size_t size, const std::string &fileName) {
+  if (!file.write(static_cast<const char*>(data), size)) {
+    throw std::runtime_error(fmt::format("failed to write \"{}\": {}", fileName, strerror(errno)));
+  }
+}
+
+RecompressResult recompressTo(std::ifstream &in, const std::string &input,
+                              std::ofstream &out, const std::string &output, uint16_t format) {
+  RecompressResult result;
+
+  // everything up to the body: magic, header (ending in screenshot size and compression format),
+  // screenshot and the body size fields
+  std::vector<char> prefix(MAGIC_LENGTH);
+  if (!in.read(prefix.data(), MAGIC_LENGTH) || (memcmp(prefix.data(), SKYRIM_MAGIC, MAGIC_LENGTH) != 0)) {
+    throw std::runtime_error(fmt::format("\"{}\" is not a Skyrim save", input));
+  }
+  uint32_t headerSize = readValue<uint32_t>(in, input);
+  if (headerSize < 4 + 10) {
+    throw std::runtime_error(fmt::format("invalid header size in \"{}\"", input));
+  }
+  prefix.resize(MAGIC_LENGTH + 4 + headerSize);
+  memcpy(&prefix[MAGIC_LENGTH], &headerSize, 4);
+  if (!in.read(&prefix[MAGIC_LENGTH + 4], headerSize)) {
+    throw std::runtime_error(fmt::format("unexpected end of file in \"{}\"", input));
+  }
+  if (valueAt<uint32_t>(prefix, MAGIC_LENGTH + 4) < SKYRIMSE_VERSION) {
+    throw std::runtime_error(fmt::format("\"{}\" is from a version of Skyrim that doesn't support compression", input));
+  }
+
+  size_t formatOffset = prefix.size() - 2;
+  uint64_t width = valueAt<uint32_t>(prefix, prefix.size() - 10);
+  uint64_t height = valueAt<uint32_t>(prefix, prefix.size() - 6);
+  result.sourceFormat = valueAt<uint16_t>(prefix, formatOffset);
+
+  size_t screenshotOffset = prefix.size();
+  prefix.resize(prefix.size() + static_cast<size_t>(width * height * 4) + 8);
+  if (!in.read(&prefix[screenshotOffset], prefix.size() - screenshotOffset)) {
+    throw std::runtime_error(fmt::format("unexpected end of file in \"{}\"", input));
+  }
+  uint32_t uncompressedSize = valueAt<uint32_t>(prefix, prefix.size() - 8);
+  uint32_t compressedSize = valueAt<uint32_t>(prefix, prefix.size() - 4);
+  uint64_t bodySize = result.sourceFormat == COMPRESSION_NONE ? uncompressedSize : compressedSize;
+
+  memcpy(&prefix[formatOffset], &format, sizeof(uint16_t));
+  write(out, prefix.data(), prefix.size(), output);
+  uint64_t bodyOffset = prefix.size();
+
+  std::unique_ptr<StreamCodec> decompressor = createDecompressor(result.sourceFormat);
+  std::unique_ptr<StreamCodec> compressor = createCompressor(format);
+
+  std::vector<uint8_t> chunkBuffer(COPY_CHUNK);
+  std::vector<uint8_t> decompressed;
+  std::vector<uint8_t> compressed;
+  uint64_t totalDecompressed = 0;
+  uint64_t totalCompressed = 0;
+
+  auto forward = [&](bool final) {
+    if (final) {
+      decompressor->finish(decompressed);
+    }
+    totalDecompressed += decompressed.size();
+    compressor->update(decompressed.data(), decompressed.size(), compressed);
+    decompressed.clear();
+    if (final) {
+      compressor->finish(compressed);
+    }
+    write(out, compressed.data(), compressed.size(), output);
+    totalCompressed += compressed.size();
+    compressed.clear();
+  };
+
+  uint64_t left = bodySize;
+  while (left > 0) {
+    size_t chunk = static_cast<size_t>((std::min<uint64_t>)(left, chunkBuffer.size()));
+    if (!in.read(reinterpret_cast<char*>(chunkBuffer.data()), chunk)) {
+      throw std::runtime_error(fmt::format("unexpected end of file in \"{}\"", input));
+    }
+    left -= chunk;
+    decompressor->update(chunkBuffer.data(), chunk, decompressed);
+    forward(false);
+  }
+  forward(true);
+
+  if (totalDecompressed != uncompressedSize) {
+    throw std::runtime_error(fmt::format("body of \"{}\" has the wrong size ({} instead of {})",
+                                         input, totalDecompressed, uncompressedSize));
+  }
+  if (totalCompressed > (std::numeric_limits<uint32_t>::max)()) {
+    throw std::runtime_error(fmt::format("body of \"{}\" too large after compression", input));
+  }
+
+  // whatever follows the body is copied verbatim
+  while (in.read(reinterpret_cast<char*>(chunkBuffer.data()), chunkBuffer.size()) || (in.gcount() > 0)) {
+    write(out, chunkBuffer.data(), static_cast<size_t>(in.gcount()), output);
+  }
+
+  uint32_t newCompressedSize = format == COMPRESSION_NONE ? 0 : static_cast<uint32_t>(totalCompressed);
+  out.seekp(bodyOffset - 4);
+  write(out, &newCompressedSize, sizeof(uint32_t), output);
+
+  in.clear();
+  in.seekg(0, std::ios::end);
+  result.inputSize = static_cast<uint64_t>(in.tellg());
+  out.seekp(0, std::ios::end);
+  result.outputSize = static_cast<uint64_t>(out.tellp());
+  return result;
+}
+
+}
+
+RecompressResult recompressSave(const std::string &input, const std::string &output, uint16_t format)
+{
+  if ((format != COMPRESSION_ZLIB) && (format != COMPRESSION_LZ4)) {
+    throw std::runtime_error(fmt::format("unsupported compression format {}", format));
+  }
+
+  std::ifstream in(toWC(input.c_str(), CodePage::UTF8, input.length()).c_str(), std::ios::in | std::ios::binary);
+  if (!in.is_open()) {
+    throw std::runtime_error(fmt::format("failed to open \"{}\": {}", input, strerror(errno)));
+  }
+
+  std::string tempName = tempFileName(output);
+  RecompressResult result;
+  {
+    std::ofstream out(toWC(tempName.c_str(), CodePage::UTF8, tempName.length()).c_str(),
+                      std::ios::out | std::ios::binary | std::ios::trunc);
+    if (!out.is_open()) {
+      throw std::runtime_error(fmt::format("failed to open \"{}\": {}", tempName, strerror(errno)));
+    }
+
+    try {
+      result = recompressTo(in, input, out, tempName, format);
+      out.close();
+      if (out.fail()) {
+        throw std::runtime_error(fmt::format("failed to write \"{}\": {}", tempName, strerror(errno)));
+      }
+    }
+    catch (...) {
+      out.close();
+      removeFile(tempName);
+      throw;
+    }
+  }
+  in.close();
+
+  replaceFile(tempName, output);
+  return result;
+}
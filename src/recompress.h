@@ -0,0 +1,15 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+
+struct RecompressResult {
+  uint16_t sourceFormat;
+  uint64_t inputSize;
+  uint64_t outputSize;
+};
+
+/* rewrite a Skyrim SE save with its body compressed in the specified format (see BodyCompression).
+ * Header, screenshot and plugin list are copied as is, the body gets decompressed and recompressed
+ * in chunks. The output is written to a temporary file first so input and output may be the same */
+RecompressResult recompressSave(const std::string &input, const std::string &output, uint16_t format);
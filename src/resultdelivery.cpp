@@ -0,0 +1,111 @@
+#include "resultdelivery.h"
+
+#include <algorithm>
+
+namespace {
+
+std::atomic<size_t> s_BatchSize{ 32 };
+
+}
+
+size_t ResultDelivery::batchSize()
+{
+  return s_BatchSize;
+}
+
+void ResultDelivery::setBatchSize(size_t size)
+{
+  s_BatchSize = (std::max<size_t>)(1, size);
+}
+
+ResultDelivery::ResultDelivery(Napi::Env env)
+  : m_Scheduled(false)
+  , m_Outstanding(0)
+  , m_FunctionState(std::make_shared<FunctionState>())
+{
+  // the function gets closed when the environment shuts down. Completions still queued at that
+  // point are leaked, the js values they reference can't be released anymore anyway
+  std::shared_ptr<FunctionState> state = m_FunctionState;
+  m_Function = Napi::ThreadSafeFunction::New(env, Napi::Function(), "GamebryoResults", 0, 1,
+    [state](Napi::Env) {
+      std::lock_guard<std::mutex> lock(state->mutex);
+      state->closed = true;
+    });
+  // only keep the event loop alive while results are outstanding
+  m_Function.Unref(env);
+}
+
+void ResultDelivery::expect(Napi::Env env)
+{
+  if (m_Outstanding++ == 0) {
+    m_Function.Ref(env);
+  }
+}
+
+void ResultDelivery::push(Completion *completion)
+{
+  enqueue(completion, true);
+}
+
+void ResultDelivery::post(Completion *completion)
+{
+  enqueue(completion, false);
+}
+
+void ResultDelivery::enqueue(Completion *completion, bool counted)
+{
+  m_Queue.push(std::make_pair(completion, counted));
+  if (!m_Scheduled.exchange(true)) {
+    wakeup();
+  }
+}
+
+void ResultDelivery::wakeup()
+{
+  std::lock_guard<std::mutex> lock(m_FunctionState->mutex);
+  if (!m_FunctionState->closed) {
+    m_Function.NonBlockingCall([this](Napi::Env env, Napi::Function) { drain(env); });
+  }
+}
+
+void ResultDelivery::drain(Napi::Env env)
+{
+  // clear the flag before looking at the queue. A completion pushed from here on either gets
+  // picked up below or schedules another wakeup
+  m_Scheduled = false;
+
+  size_t limit = batchSize();
+  size_t delivered = 0;
+  size_t counted = 0;
+  std::pair<Completion*, bool> item;
+  while ((delivered < limit) && m_Queue.pop(item)) {
+    Completion *completion = item.first;
+    {
+      Napi::HandleScope scope(env);
+      try {
+        completion->deliver(env);
+      }
+      catch (const Napi::Error &e) {
+        // an exception thrown by the js callback. Report it the way node would and carry on
+        // with the other results
+        Napi::Error error = e;
+        napi_fatal_exception(env, error.Value());
+      }
+    }
+    delete completion;
+    ++delivered;
+    if (item.second) {
+      ++counted;
+    }
+  }
+
+  m_Outstanding -= (std::min)(m_Outstanding, counted);
+  if (m_Outstanding == 0) {
+    m_Function.Unref(env);
+  }
+
+  if ((delivered == limit) && !m_Scheduled.exchange(true)) {
+    // there may be more, give the event loop a chance to do something else first
+    wakeup();
+  }
+}
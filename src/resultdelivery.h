@@ -0,0 +1,74 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <memory>
+#include <mutex>
+#include <utility>
+#include <napi.h>
+
+#include "mpscqueue.h"
+
+/**
+ * Result of a background job, delivered on the js thread
+ */
+class Completion {
+public:
+  virtual ~Completion() {}
+  /* called on the js thread, the completion is deleted afterwards */
+  virtual void deliver(Napi::Env env) = 0;
+};
+
+/**
+ * Hands results from worker threads to the js thread of one environment. Workers push their
+ * completions into a lock-free queue and return immediately instead of waiting for js to get
+ * around to them. One thread safe function per environment drains the queue, delivering up to
+ * batchSize() completions per wakeup of the event loop
+ */
+class ResultDelivery {
+public:
+  static size_t batchSize();
+  static void setBatchSize(size_t size);
+
+  explicit ResultDelivery(Napi::Env env);
+
+  ResultDelivery(const ResultDelivery&) = delete;
+  ResultDelivery &operator=(const ResultDelivery&) = delete;
+
+  /* js thread only. Announce that a completion will be pushed later, which keeps the event loop
+   * alive until it has been delivered */
+  void expect(Napi::Env env);
+
+  /* any thread. Never blocks on the js thread. Each push has to be preceded by an expect */
+  void push(Completion *completion);
+
+  /* like push but without a matching expect. For intermediate notifications that don't need to keep
+   * the event loop alive on their own because a counted completion follows */
+  void post(Completion *completion);
+
+private:
+
+  void enqueue(Completion *completion, bool counted);
+  void wakeup();
+  void drain(Napi::Env env);
+
+private:
+
+  // completions and whether they were announced with expect
+  MPSCQueue<std::pair<Completion*, bool>> m_Queue;
+  // set while a wakeup is pending, so that a burst of results causes only one
+  std::atomic<bool> m_Scheduled;
+  // js thread only
+  size_t m_Outstanding;
+
+  // whether the thread safe function was closed by the environment shutting down. Shared with
+  // its finalizer which may run after this object is gone
+  struct FunctionState {
+    std::mutex mutex;
+    bool closed{ false };
+  };
+
+  Napi::ThreadSafeFunction m_Function;
+  std::shared_ptr<FunctionState> m_FunctionState;
+
+};
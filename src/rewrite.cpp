@@ -0,0 +1,175 @@
+#include "rewrite.h"
+#include "fileops.h"
+#include "imageops.h"
+
+#include <cerrno>
+#include <cstring>
+#include <fstream>
+#include <limits>
+#include <stdexcept>
+#include <vector>
+
+#include "string_cast.h"
+#include "fmt/format.h"
+
+namespace {
+
+void patchU32(std::vector<char> &buffer, uint64_t offset, uint32_t value) {
+  if (offset + sizeof(uint32_t) > buffer.size()) {
+    throw std::runtime_error("invalid screenshot layout");
+  }
+  memcpy(&buffer[static_cast<size_t>(offset)], &value, sizeof(uint32_t));
+}
+
+uint32_t readU32(const std::vector<char> &buffer, uint64_t offset) {
+  if (offset + sizeof(uint32_t) > buffer.size()) {
+    throw std::runtime_error("invalid screenshot layout");
+  }
+  uint32_t value;
+  memcpy(&value, &buffer[static_cast<size_t>(offset)], sizeof(uint32_t));
+  return value;
+}
+
+/* read the copy back before it replaces anything: it has to start with the patched fields and be
+ * exactly as large as expected, otherwise the tail didn't get copied completely */
+void verifyCopy(const std::string &fileName, const std::vector<char> &head, uint64_t expectedSize) {
+  std::ifstream in(toWC(fileName.c_str(), CodePage::UTF8, fileName.length()).c_str(), std::ios::in | std::ios::binary);
+  if (!in.is_open()) {
+    throw std::runtime_error(fmt::format("failed to open \"{}\": {}", fileName, strerror(errno)));
+  }
+  std::vector<char> written(head.size());
+  if (!in.read(written.data(), written.size()) || (written != head)) {
+    throw std::runtime_error(fmt::format("verifying \"{}\" failed: header mismatch", fileName));
+  }
+  in.seekg(0, std::ios::end);
+  uint64_t size = static_cast<uint64_t>(in.tellg());
+  if (size != expectedSize) {
+    throw std::runtime_error(fmt::format("verifying \"{}\" failed: expected {} bytes, got {}", fileName, expectedSize, size));
+  }
+}
+
+/* scale the pixels in the save's own layout (rgb or rgba) */
+std::vector<uint8_t> scalePixels(const std::vector<uint8_t> &pixels, const ScreenshotLayout &layout,
+                                 uint32_t width, uint32_t height) {
+  size_t pixelCount = static_cast<size_t>(layout.width) * layout.height;
+  std::vector<uint8_t> rgba;
+  const uint8_t *source = pixels.data();
+  if (layout.bytesPerPixel == 3) {
+    rgba.resize(pixelCount * 4);
+    for (size_t i = 0; i < pixelCount; ++i) {
+      memcpy(&rgba[i * 4], &pixels[i * 3], 3);
+      rgba[i * 4 + 3] = 0xFF;
+    }
+    source = rgba.data();
+  }
+
+  std::vector<uint8_t> scaled(static_cast<size_t>(width) * height * 4);
+  downscaleRGBA(source, layout.width, layout.height, scaled.data(), width, height, width * 4);
+
+  if (layout.bytesPerPixel == 3) {
+    size_t scaledCount = static_cast<size_t>(width) * height;
+    for (size_t i = 0; i < scaledCount; ++i) {
+      memmove(&scaled[i * 3], &scaled[i * 4], 3);
+    }
+    scaled.resize(scaledCount * 3);
+  }
+  return scaled;
+}
+
+}
+
+RewriteResult rewriteScreenshot(const std::string &input, const std::string &output, const ScreenshotLayout &layout,
+                                uint32_t maxWidth, uint32_t maxHeight)
+{
+  if (layout.bytesPerPixel == 0) {
+    throw std::runtime_error("not supported for this game");
+  }
+  if ((layout.bytesPerPixel != 3) && (layout.bytesPerPixel != 4)) {
+    throw std::runtime_error("invalid screenshot layout");
+  }
+
+  RewriteResult result;
+  result.width = 0;
+  result.height = 0;
+  if ((maxWidth > 0) && (maxHeight > 0) && (layout.width > 0) && (layout.height > 0)) {
+    fitInto(layout.width, layout.height, maxWidth, maxHeight, result.width, result.height);
+    if ((result.width > layout.width) || (result.height > layout.height)) {
+      // never enlarge
+      result.width = layout.width;
+      result.height = layout.height;
+    }
+  }
+
+  std::ifstream in(toWC(input.c_str(), CodePage::UTF8, input.length()).c_str(), std::ios::in | std::ios::binary);
+  if (!in.is_open()) {
+    throw std::runtime_error(fmt::format("failed to open \"{}\": {}", input, strerror(errno)));
+  }
+  in.seekg(0, std::ios::end);
+  result.inputSize = static_cast<uint64_t>(in.tellg());
+  in.seekg(0);
+
+  uint64_t oldBytes = static_cast<uint64_t>(layout.width) * layout.height * layout.bytesPerPixel;
+  uint64_t newBytes = static_cast<uint64_t>(result.width) * result.height * layout.bytesPerPixel;
+  if (layout.pixelOffset + oldBytes > result.inputSize) {
+    throw std::runtime_error(fmt::format("unexpected end of file in \"{}\"", input));
+  }
+
+  // everything up to the pixels is small, patch the fields in memory
+  std::vector<char> head(static_cast<size_t>(layout.pixelOffset));
+  if (!in.read(head.data(), head.size())) {
+    throw std::runtime_error(fmt::format("unexpected end of file in \"{}\"", input));
+  }
+
+  std::vector<uint8_t> pixels;
+  if (newBytes > 0) {
+    std::vector<uint8_t> original(static_cast<size_t>(oldBytes));
+    if (!in.read(reinterpret_cast<char*>(original.data()), original.size())) {
+      throw std::runtime_error(fmt::format("unexpected end of file in \"{}\"", input));
+    }
+    pixels = ((result.width == layout.width) && (result.height == layout.height))
+      ? std::move(original)
+      : scalePixels(original, layout, result.width, result.height);
+  }
+  in.close();
+
+  int64_t delta = static_cast<int64_t>(newBytes) - static_cast<int64_t>(oldBytes);
+  patchU32(head, layout.widthOffset, result.width);
+  patchU32(head, layout.heightOffset, result.height);
+  for (uint64_t offset : { layout.sizeOffset, layout.headerSizeOffset }) {
+    if (offset != 0) {
+      patchU32(head, offset, static_cast<uint32_t>(static_cast<int64_t>(readU32(head, offset)) + delta));
+    }
+  }
+
+  std::string tempName = tempFileName(output);
+  result.outputSize = static_cast<uint64_t>(static_cast<int64_t>(result.inputSize) + delta);
+  try {
+    {
+      std::ofstream out(toWC(tempName.c_str(), CodePage::UTF8, tempName.length()).c_str(),
+                        std::ios::out | std::ios::binary | std::ios::trunc);
+      if (!out.is_open()) {
+        throw std::runtime_error(fmt::format("failed to open \"{}\": {}", tempName, strerror(errno)));
+      }
+      out.write(head.data(), head.size());
+      if (!pixels.empty()) {
+        out.write(reinterpret_cast<const char*>(pixels.data()), pixels.size());
+      }
+      out.close();
+      if (out.fail()) {
+        throw std::runtime_error(fmt::format("failed to write \"{}\": {}", tempName, strerror(errno)));
+      }
+    }
+
+    uint64_t tailOffset = layout.pixelOffset + oldBytes;
+    appendFileRange(input, tailOffset, result.inputSize - tailOffset, tempName);
+
+    verifyCopy(tempName, head, result.outputSize);
+  }
+  catch (...) {
+    removeFile(tempName);
+    throw;
+  }
+
+  replaceFile(tempName, output);
+  return result;
+}
@@ -0,0 +1,37 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+
+/**
+ * Where the screenshot and the fields describing it are in a save file
+ */
+struct ScreenshotLayout {
+  uint64_t widthOffset;
+  uint64_t heightOffset;
+  // field holding the size of the image section (Oblivion), 0 if there is none
+  uint64_t sizeOffset;
+  // save header size field which counts the image (Oblivion), 0 if there is none
+  uint64_t headerSizeOffset;
+  uint64_t pixelOffset;
+  uint32_t width;
+  uint32_t height;
+  // 3 (rgb) or 4 (rgba). 0 if the screenshot can't be rewritten (Morrowind)
+  uint32_t bytesPerPixel;
+};
+
+struct RewriteResult {
+  uint32_t width;
+  uint32_t height;
+  uint64_t inputSize;
+  uint64_t outputSize;
+};
+
+/* copy a save with its screenshot scaled down to fit maxWidth x maxHeight, or removed entirely if either
+ * is 0. Only the pixels and the fields describing them change, everything else is copied byte for byte.
+ * Since the body stays identical, absolute offsets in it (Skyrim, Fallout 4) no longer match so the
+ * copy is meant for archival, not for loading in the game.
+ * The output is written to a temporary file first so input and output may be the same, and only
+ * replaces the output after reading it back to check header and size */
+RewriteResult rewriteScreenshot(const std::string &input, const std::string &output, const ScreenshotLayout &layout,
+                                uint32_t maxWidth, uint32_t maxHeight);
@@ -0,0 +1,567 @@
+#include "savebody.h"
+#include "threadpool.h"
+#include "fmt/format.h"
+
+#include <zlib.h>
+#include <algorithm>
+#include <cctype>
+#include <cstddef>
+#include <cstdlib>
+#include <cstring>
+#include <limits>
+#include <mutex>
+#include <unordered_set>
+
+namespace {
+
+// number of records to decompress per pool task, most payloads are tiny
+const size_t CHANGEFORM_BATCH = 256;
+
+// ref ids have 22 bits to index the form id array
+const uint32_t MAX_FORMID_COUNT = 0x400000;
+
+void readRaw(IDecoder &decoder, void *buffer, size_t size) {
+  if (!decoder.read(static_cast<char*>(buffer), size)) {
+    decoder.clear();
+    throw std::runtime_error(fmt::format("unexpected end of file at \"{}\" (read of \"{}\" bytes)", decoder.tell(), size).c_str());
+  }
+}
+
+template <typename T> T readValue(IDecoder &decoder) {
+  T value;
+  readRaw(decoder, &value, sizeof(T));
+  return value;
+}
+
+uint32_t readRefId(IDecoder &decoder) {
+  uint8_t bytes[3];
+  readRaw(decoder, bytes, 3);
+  return (bytes[0] << 16) | (bytes[1] << 8) | bytes[2];
+}
+
+/* read an integer that's stored in 1, 2 or 4 bytes depending on sizeType */
+uint32_t readVarLength(IDecoder &decoder, uint8_t sizeType) {
+  switch (sizeType) {
+    case 0: return readValue<uint8_t>(decoder);
+    case 1: return readValue<uint16_t>(decoder);
+    case 2: return readValue<uint32_t>(decoder);
+    default: throw DataInvalid("invalid change form length type", decoder.tell());
+  }
+}
+
+/**
+ * Bounds checked reading from an in-memory global data payload
+ */
+class ByteReader {
+public:
+  ByteReader(const std::vector<uint8_t> &data) : m_Data(data), m_Pos(0) {}
+
+  void raw(void *out, size_t size) {
+    if (size > m_Data.size() - m_Pos) {
+      throw DataInvalid("global data truncated", m_Pos);
+    }
+    memcpy(out, m_Data.data() + m_Pos, size);
+    m_Pos += size;
+  }
+
+  template <typename T> T value() {
+    T result;
+    raw(&result, sizeof(T));
+    return result;
+  }
+
+  uint32_t refId() {
+    uint8_t bytes[3];
+    raw(bytes, 3);
+    return (bytes[0] << 16) | (bytes[1] << 8) | bytes[2];
+  }
+
+  /* variable size integer, the lowest two bits of the first byte determine the total number of bytes */
+  uint32_t vsval() {
+    uint8_t first = value<uint8_t>();
+    uint32_t result = first;
+    switch (first & 0x03) {
+      case 1: result |= value<uint8_t>() << 8; break;
+      case 2: result |= value<uint8_t>() << 8; result |= value<uint8_t>() << 16; break;
+    }
+    return result >> 2;
+  }
+
+  std::string wstring() {
+    uint16_t length = value<uint16_t>();
+    std::string result(length, '\0');
+    if (length > 0) {
+      raw(&result[0], length);
+    }
+    return result;
+  }
+
+private:
+  const std::vector<uint8_t> &m_Data;
+  size_t m_Pos;
+};
+
+void skip(IDecoder &decoder, uint64_t size) {
+  if (!decoder.seek(static_cast<size_t>(size), std::ios::cur)) {
+    decoder.clear();
+    throw std::runtime_error(fmt::format("unexpected end of file at \"{}\" (skip of \"{}\" bytes)", decoder.tell(), size).c_str());
+  }
+}
+
+std::string foldCase(std::string value) {
+  std::transform(value.begin(), value.end(), value.begin(),
+                 [](char ch) { return static_cast<char>(tolower(static_cast<unsigned char>(ch))); });
+  return value;
+}
+
+/**
+ * zlib stream that gets reused for all payloads decompressed on a thread. All of them are registered
+ * so that the state (around 40KB per thread) of those currently idle can be freed under memory pressure
+ */
+class ThreadInflater {
+public:
+  static ThreadInflater &get() {
+    thread_local ThreadInflater s_Inflater;
+    return s_Inflater;
+  }
+
+  static size_t trimAll() {
+    size_t result = 0;
+    std::lock_guard<std::mutex> lock(registryMutex());
+    for (ThreadInflater *inflater : registry()) {
+      std::unique_lock<std::mutex> inflaterLock(inflater->m_Mutex, std::try_to_lock);
+      if (inflaterLock.owns_lock()) {
+        size_t before = inflater->m_Allocated;
+        inflater->release();
+        result += before - inflater->m_Allocated;
+      }
+    }
+    return result;
+  }
+
+  ~ThreadInflater() {
+    {
+      std::lock_guard<std::mutex> lock(registryMutex());
+      std::vector<ThreadInflater*> &inflaters = registry();
+      inflaters.erase(std::remove(inflaters.begin(), inflaters.end(), this), inflaters.end());
+    }
+    release();
+  }
+
+  void inflate(const uint8_t *in, size_t inSize, uint8_t *out, size_t outSize) {
+    std::lock_guard<std::mutex> lock(m_Mutex);
+    if (!m_Initialized) {
+      m_Stream.zalloc = &ThreadInflater::allocate;
+      m_Stream.zfree = &ThreadInflater::deallocate;
+      m_Stream.opaque = this;
+      if (inflateInit(&m_Stream) != Z_OK) {
+        throw std::runtime_error("failed to initialize zlib inflate");
+      }
+      m_Initialized = true;
+    } else {
+      inflateReset(&m_Stream);
+    }
+
+    m_Stream.next_in = const_cast<Bytef*>(in);
+    m_Stream.avail_in = static_cast<uInt>(inSize);
+    m_Stream.next_out = out;
+    m_Stream.avail_out = static_cast<uInt>(outSize);
+    int res = ::inflate(&m_Stream, Z_FINISH);
+    if ((res != Z_STREAM_END) || (m_Stream.total_out != outSize)) {
+      throw std::runtime_error("failed to decompress change form");
+    }
+  }
+
+private:
+  ThreadInflater() : m_Initialized(false), m_Allocated(0) {
+    memset(&m_Stream, 0, sizeof(z_stream));
+    std::lock_guard<std::mutex> lock(registryMutex());
+    registry().push_back(this);
+  }
+
+  // leaked so they outlive the inflaters of threads ending during shutdown
+  static std::mutex &registryMutex() {
+    static std::mutex *s_Mutex = new std::mutex();
+    return *s_Mutex;
+  }
+
+  static std::vector<ThreadInflater*> &registry() {
+    static std::vector<ThreadInflater*> *s_Registry = new std::vector<ThreadInflater*>();
+    return *s_Registry;
+  }
+
+  // zlib allocations get a header with their size so we know how much the state occupies
+  static voidpf allocate(voidpf opaque, uInt items, uInt size) {
+    size_t bytes = static_cast<size_t>(items) * size;
+    uint8_t *block = static_cast<uint8_t*>(malloc(bytes + ALLOC_HEADER));
+    if (block == nullptr) {
+      return Z_NULL;
+    }
+    *reinterpret_cast<size_t*>(block) = bytes;
+    static_cast<ThreadInflater*>(opaque)->m_Allocated += bytes;
+    return block + ALLOC_HEADER;
+  }
+
+  static void deallocate(voidpf opaque, voidpf address) {
+    uint8_t *block = static_cast<uint8_t*>(address) - ALLOC_HEADER;
+    static_cast<ThreadInflater*>(opaque)->m_Allocated -= *reinterpret_cast<size_t*>(block);
+    free(block);
+  }
+
+  void release() {
+    if (m_Initialized) {
+      inflateEnd(&m_Stream);
+      m_Initialized = false;
+    }
+  }
+
+private:
+  // keeps the allocations aligned for any type
+  static const size_t ALLOC_HEADER = alignof(std::max_align_t);
+
+  std::mutex m_Mutex;
+  z_stream m_Stream;
+  bool m_Initialized;
+  size_t m_Allocated;
+};
+
+}
+
+size_t trimInflaters()
+{
+  return ThreadInflater::trimAll();
+}
+
+FileLocationTable readFileLocationTable(IDecoder &decoder, BodyFormat format)
+{
+  FileLocationTable result;
+  result.formIdArrayCountOffset = readValue<uint32_t>(decoder);
+  result.unknownTable3Offset = readValue<uint32_t>(decoder);
+  result.globalDataTable1Offset = readValue<uint32_t>(decoder);
+  result.globalDataTable2Offset = readValue<uint32_t>(decoder);
+  result.changeFormsOffset = readValue<uint32_t>(decoder);
+  result.globalDataTable3Offset = readValue<uint32_t>(decoder);
+  result.globalDataTable1Count = readValue<uint32_t>(decoder);
+  result.globalDataTable2Count = readValue<uint32_t>(decoder);
+  result.globalDataTable3Count = readValue<uint32_t>(decoder);
+  result.changeFormCount = readValue<uint32_t>(decoder);
+  // unused
+  for (int i = 0; i < 15; ++i) {
+    readValue<uint32_t>(decoder);
+  }
+
+  if (format == BodyFormat::SKYRIM) {
+    // skyrim writes one entry less than there actually is
+    ++result.globalDataTable3Count;
+  }
+
+  // global data table 1 immediately follows the location table
+  result.bias = static_cast<int64_t>(decoder.tell()) - result.globalDataTable1Offset;
+  return result;
+}
+
+bool findGlobalData(IDecoder &decoder, const FileLocationTable &table, uint32_t type, uint32_t &length)
+{
+  uint32_t offset = table.globalDataTable1Offset;
+  uint32_t count = table.globalDataTable1Count;
+  if (type >= 1000) {
+    offset = table.globalDataTable3Offset;
+    count = table.globalDataTable3Count;
+  } else if (type >= 100) {
+    offset = table.globalDataTable2Offset;
+    count = table.globalDataTable2Count;
+  }
+
+  if (!decoder.seek(table.position(offset))) {
+    decoder.clear();
+    throw DataInvalid("invalid global data offset", offset);
+  }
+
+  for (uint32_t i = 0; i < count; ++i) {
+    uint32_t entryType = readValue<uint32_t>(decoder);
+    length = readValue<uint32_t>(decoder);
+    if (entryType == type) {
+      return true;
+    }
+    if (!decoder.seek(length, std::ios::cur)) {
+      decoder.clear();
+      throw DataInvalid("invalid global data length", decoder.tell());
+    }
+  }
+  return false;
+}
+
+bool readGlobalData(IDecoder &decoder, const FileLocationTable &table, uint32_t type, std::vector<uint8_t> &data)
+{
+  uint32_t length;
+  if (!findGlobalData(decoder, table, type, length)) {
+    return false;
+  }
+  data.resize(length);
+  if (length > 0) {
+    readRaw(decoder, data.data(), length);
+  }
+  return true;
+}
+
+std::vector<MiscStat> parseMiscStats(const std::vector<uint8_t> &data)
+{
+  ByteReader reader(data);
+  uint32_t count = reader.value<uint32_t>();
+  std::vector<MiscStat> result;
+  for (uint32_t i = 0; i < count; ++i) {
+    MiscStat stat;
+    stat.name = reader.wstring();
+    stat.category = reader.value<uint8_t>();
+    stat.value = reader.value<int32_t>();
+    result.push_back(stat);
+  }
+  return result;
+}
+
+PlayerLocation parsePlayerLocation(const std::vector<uint8_t> &data)
+{
+  ByteReader reader(data);
+  PlayerLocation result;
+  result.nextObjectId = reader.value<uint32_t>();
+  result.worldSpace1 = reader.refId();
+  result.coorX = reader.value<int32_t>();
+  result.coorY = reader.value<int32_t>();
+  result.worldSpace2 = reader.refId();
+  result.posX = reader.value<float>();
+  result.posY = reader.value<float>();
+  result.posZ = reader.value<float>();
+  return result;
+}
+
+std::vector<GlobalVariable> parseGlobalVariables(const std::vector<uint8_t> &data)
+{
+  ByteReader reader(data);
+  uint32_t count = reader.vsval();
+  std::vector<GlobalVariable> result;
+  for (uint32_t i = 0; i < count; ++i) {
+    GlobalVariable var;
+    var.refId = reader.refId();
+    var.value = reader.value<float>();
+    result.push_back(var);
+  }
+  return result;
+}
+
+Weather parseWeather(const std::vector<uint8_t> &data)
+{
+  ByteReader reader(data);
+  Weather result;
+  result.climate = reader.refId();
+  result.weather = reader.refId();
+  result.previousWeather = reader.refId();
+  result.unknownWeather1 = reader.refId();
+  result.unknownWeather2 = reader.refId();
+  result.regionWeather = reader.refId();
+  result.currentTime = reader.value<float>();
+  result.beginTime = reader.value<float>();
+  result.weatherPercent = reader.value<float>();
+  return result;
+}
+
+PapyrusScan scanPapyrus(IDecoder &decoder, const FileLocationTable &table, BodyFormat format,
+                        bool wideIds, const std::vector<std::string> &knownScripts)
+{
+  PapyrusScan result;
+  result.instanceCount = 0;
+  result.orphanedCount = 0;
+
+  uint32_t length;
+  if (!findGlobalData(decoder, table, GLOBAL_PAPYRUS, length)) {
+    return result;
+  }
+
+  // none of the counts can be larger than the section itself, this protects against allocating
+  // absurd amounts of memory for broken saves
+  auto readCount = [&]() {
+    uint32_t count = readValue<uint32_t>(decoder);
+    if (count > length) {
+      throw DataInvalid("invalid papyrus count", decoder.tell());
+    }
+    return count;
+  };
+
+  readValue<uint16_t>(decoder); // header
+
+  // the string table count is 16 bit. 0xFFFF marks the extended table (written by skse once the
+  // table outgrows that), a 32 bit count follows and references into it are 32 bit as well
+  uint32_t stringCount = readValue<uint16_t>(decoder);
+  bool wideStrings = stringCount == 0xFFFF;
+  if (wideStrings) {
+    stringCount = readCount();
+  }
+  std::vector<std::string> strings(stringCount);
+  for (std::string &str : strings) {
+    uint16_t strLength = readValue<uint16_t>(decoder);
+    str.resize(strLength);
+    if (strLength > 0) {
+      readRaw(decoder, &str[0], strLength);
+    }
+  }
+
+  auto readString = [&]() -> uint32_t {
+    uint32_t idx = wideStrings ? readValue<uint32_t>(decoder) : readValue<uint16_t>(decoder);
+    if (idx >= stringCount) {
+      throw DataInvalid("invalid papyrus string index", decoder.tell());
+    }
+    return idx;
+  };
+
+  std::vector<bool> defined(stringCount, false);
+  std::vector<uint32_t> instances(stringCount, 0);
+
+  // definitions: name, parent type and the name and type of each member
+  auto skipDefinitions = [&](bool record) {
+    uint32_t count = readCount();
+    for (uint32_t i = 0; i < count; ++i) {
+      uint32_t name = readString();
+      if (record) {
+        defined[name] = true;
+      }
+      readString();
+      uint32_t memberCount = readCount();
+      skip(decoder, static_cast<uint64_t>(memberCount) * 2 * (wideStrings ? 4 : 2));
+    }
+  };
+
+  skipDefinitions(true);
+  if (format == BodyFormat::FALLOUT4) {
+    // struct definitions, same layout as scripts
+    skipDefinitions(false);
+  }
+
+  uint32_t instanceCount = readCount();
+  for (uint32_t i = 0; i < instanceCount; ++i) {
+    skip(decoder, wideIds ? 8 : 4);
+    uint32_t name = readString();
+    uint16_t flags = readValue<uint16_t>(decoder);
+    // unknown int16, ref id, unknown byte
+    skip(decoder, 2 + 3 + 1);
+    if ((format == BodyFormat::FALLOUT4) && ((flags & 0x03) == 0x03)) {
+      skip(decoder, 1);
+    }
+    ++instances[name];
+  }
+  result.instanceCount = instanceCount;
+
+  std::unordered_set<std::string> known;
+  for (const std::string &name : knownScripts) {
+    known.insert(foldCase(name));
+  }
+
+  for (uint32_t i = 0; i < stringCount; ++i) {
+    if (!defined[i] && (instances[i] == 0)) {
+      continue;
+    }
+    ScriptUsage usage;
+    usage.name = strings[i];
+    usage.instances = instances[i];
+    usage.undefined = !defined[i];
+    usage.missing = !known.empty() && (known.find(foldCase(strings[i])) == known.end());
+    if (usage.undefined || usage.missing) {
+      result.orphanedCount += usage.instances;
+    }
+    result.scripts.push_back(std::move(usage));
+  }
+
+  return result;
+}
+
+std::vector<uint32_t> readFormIdArray(IDecoder &decoder, const FileLocationTable &table)
+{
+  if (!decoder.seek(table.position(table.formIdArrayCountOffset))) {
+    decoder.clear();
+    throw DataInvalid("invalid form id array offset", table.formIdArrayCountOffset);
+  }
+
+  uint32_t count = readValue<uint32_t>(decoder);
+  if (count > MAX_FORMID_COUNT) {
+    throw DataInvalid("invalid form id array count", decoder.tell());
+  }
+
+  std::vector<uint32_t> result(count);
+  if (count > 0) {
+    readRaw(decoder, result.data(), count * sizeof(uint32_t));
+  }
+  return result;
+}
+
+ChangeForms readChangeForms(IDecoder &decoder, const FileLocationTable &table)
+{
+  ChangeForms result;
+  size_t count = table.changeFormCount;
+
+  if (!decoder.seek(table.position(table.changeFormsOffset))) {
+    decoder.clear();
+    throw DataInvalid("invalid change forms offset", table.changeFormsOffset);
+  }
+
+  result.refIds.reserve(count);
+  result.changeFlags.reserve(count);
+  result.types.reserve(count);
+  result.versions.reserve(count);
+  result.offsets.reserve(count + 1);
+
+  // sequential pass: collect the record headers and the raw payloads
+  std::vector<uint8_t> raw;
+  std::vector<size_t> rawOffsets;
+  std::vector<uint32_t> compressedSizes;
+  rawOffsets.reserve(count + 1);
+  compressedSizes.reserve(count);
+
+  uint64_t outSize = 0;
+  for (size_t i = 0; i < count; ++i) {
+    result.refIds.push_back(readRefId(decoder));
+    result.changeFlags.push_back(readValue<uint32_t>(decoder));
+    uint8_t type = readValue<uint8_t>(decoder);
+    result.types.push_back(type & 0x3F);
+    result.versions.push_back(readValue<uint8_t>(decoder));
+
+    uint32_t length1 = readVarLength(decoder, type >> 6);
+    uint32_t length2 = readVarLength(decoder, type >> 6);
+
+    rawOffsets.push_back(raw.size());
+    raw.resize(raw.size() + length1);
+    if (length1 > 0) {
+      readRaw(decoder, &raw[rawOffsets.back()], length1);
+    }
+
+    // length2 is the uncompressed size, 0 if the payload isn't compressed
+    compressedSizes.push_back(length2 != 0 ? length1 : 0);
+    result.offsets.push_back(static_cast<uint32_t>(outSize));
+    outSize += length2 != 0 ? length2 : length1;
+    if (outSize > (std::numeric_limits<uint32_t>::max)()) {
+      throw DataInvalid("change forms too large", decoder.tell());
+    }
+  }
+  rawOffsets.push_back(raw.size());
+  result.offsets.push_back(static_cast<uint32_t>(outSize));
+
+  result.data.resize(static_cast<size_t>(outSize));
+
+  // parallel pass: decompress payloads into their final place
+  size_t batches = (count + CHANGEFORM_BATCH - 1) / CHANGEFORM_BATCH;
+  ThreadPool::instance().parallelFor(batches, [&](size_t batch) {
+    size_t end = (std::min)(count, (batch + 1) * CHANGEFORM_BATCH);
+    for (size_t i = batch * CHANGEFORM_BATCH; i < end; ++i) {
+      const uint8_t *in = raw.data() + rawOffsets[i];
+      uint8_t *out = result.data.data() + result.offsets[i];
+      size_t outLength = result.offsets[i + 1] - result.offsets[i];
+      if (outLength == 0) {
+        continue;
+      }
+      if (compressedSizes[i] != 0) {
+        ThreadInflater::get().inflate(in, compressedSizes[i], out, outLength);
+      } else {
+        memcpy(out, in, outLength);
+      }
+    }
+  });
+
+  return result;
+}
@@ -0,0 +1,151 @@
+#pragma once
+
+#include "decoder.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+/* layout family of the save body (everything after the plugin list) */
+enum class BodyFormat {
+  NONE,
+  SKYRIM,
+  FALLOUT4,
+};
+
+/**
+ * The file location table at the start of the body in Skyrim and Fallout 4 saves
+ */
+struct FileLocationTable {
+  uint32_t formIdArrayCountOffset;
+  uint32_t unknownTable3Offset;
+  uint32_t globalDataTable1Offset;
+  uint32_t globalDataTable2Offset;
+  uint32_t changeFormsOffset;
+  uint32_t globalDataTable3Offset;
+  uint32_t globalDataTable1Count;
+  uint32_t globalDataTable2Count;
+  uint32_t globalDataTable3Count;
+  uint32_t changeFormCount;
+
+  // difference between the offsets stored in the table and actual positions in the stream we read from.
+  // Offsets are relative to the uncompressed file which doesn't match the decompressed body in
+  // Skyrim SE
+  int64_t bias;
+
+  size_t position(uint32_t offset) const { return static_cast<size_t>(static_cast<int64_t>(offset) + bias); }
+};
+
+/* read the file location table, the decoder has to be positioned at its start */
+FileLocationTable readFileLocationTable(IDecoder &decoder, BodyFormat format);
+
+/* the global data types we know how to decode. Types < 100 are in table 1, < 1000 in table 2,
+ * the rest in table 3 (after the change forms) */
+enum GlobalDataType : uint32_t {
+  GLOBAL_MISC_STATS = 0,
+  GLOBAL_PLAYER_LOCATION = 1,
+  GLOBAL_VARIABLES = 3,
+  GLOBAL_WEATHER = 6,
+  GLOBAL_PAPYRUS = 1001,
+};
+
+/* position the decoder at the payload of the global data entry of the specified type and
+ * return its length through length. Returns false if the save doesn't contain that type */
+bool findGlobalData(IDecoder &decoder, const FileLocationTable &table, uint32_t type, uint32_t &length);
+
+/* find the global data entry of the specified type and read its payload, skipping over
+ * all other entries. Returns false if the save doesn't contain that type */
+bool readGlobalData(IDecoder &decoder, const FileLocationTable &table, uint32_t type, std::vector<uint8_t> &data);
+
+struct MiscStat {
+  std::string name;
+  uint8_t category;
+  int32_t value;
+};
+
+struct PlayerLocation {
+  uint32_t nextObjectId;
+  uint32_t worldSpace1;
+  int32_t coorX;
+  int32_t coorY;
+  uint32_t worldSpace2;
+  float posX;
+  float posY;
+  float posZ;
+};
+
+struct GlobalVariable {
+  uint32_t refId;
+  float value;
+};
+
+struct Weather {
+  uint32_t climate;
+  uint32_t weather;
+  uint32_t previousWeather;
+  uint32_t unknownWeather1;
+  uint32_t unknownWeather2;
+  uint32_t regionWeather;
+  float currentTime;
+  float beginTime;
+  float weatherPercent;
+};
+
+std::vector<MiscStat> parseMiscStats(const std::vector<uint8_t> &data);
+PlayerLocation parsePlayerLocation(const std::vector<uint8_t> &data);
+std::vector<GlobalVariable> parseGlobalVariables(const std::vector<uint8_t> &data);
+Weather parseWeather(const std::vector<uint8_t> &data);
+
+/**
+ * Number of script instances per script in the papyrus section
+ */
+struct ScriptUsage {
+  std::string name;
+  uint32_t instances;
+  // instances reference this script but the save has no definition for it
+  bool undefined;
+  // the script isn't in the list of known scripts passed to the scan
+  bool missing;
+};
+
+struct PapyrusScan {
+  std::vector<ScriptUsage> scripts;
+  uint32_t instanceCount;
+  // number of instances of scripts that are missing or undefined
+  uint32_t orphanedCount;
+};
+
+/* walk the string table, script definitions and script instances of the papyrus section
+ * straight from the decoder. Only the string table is kept in memory.
+ * wideIds has to be set if instance ids are 64 bit (Skyrim SE, Fallout 4).
+ * knownScripts (compared case insensitively) is the list of scripts that exist in the data,
+ * if it's empty no script gets flagged as missing */
+PapyrusScan scanPapyrus(IDecoder &decoder, const FileLocationTable &table, BodyFormat format,
+                        bool wideIds, const std::vector<std::string> &knownScripts);
+
+/* read the form id array the ref ids of type 0 index into */
+std::vector<uint32_t> readFormIdArray(IDecoder &decoder, const FileLocationTable &table);
+
+/**
+ * All change forms of a save with their payloads decompressed, as parallel arrays in record order
+ */
+struct ChangeForms {
+  // the 24-bit ref id as stored in the save (upper two bits are the type)
+  std::vector<uint32_t> refIds;
+  std::vector<uint32_t> changeFlags;
+  // record type without the length size bits
+  std::vector<uint8_t> types;
+  std::vector<uint8_t> versions;
+  // start of each record's data in data, with an additional entry marking the end
+  std::vector<uint32_t> offsets;
+  std::vector<uint8_t> data;
+};
+
+/* find all change form records in one pass over the decoder, then decompress their payloads
+ * in parallel on the thread pool */
+ChangeForms readChangeForms(IDecoder &decoder, const FileLocationTable &table);
+
+/* free the decompression state kept by threads that aren't decompressing right now. Returns the
+ * number of bytes freed */
+size_t trimInflaters();
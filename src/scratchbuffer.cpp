@@ -0,0 +1,186 @@
+#include "scratchbuffer.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <mutex>
+#include <stdexcept>
+
+#include "string_cast.h"
+#include "fmt/format.h"
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+namespace {
+
+std::atomic<size_t> s_MemoryLimit{ 0 };
+std::atomic<size_t> s_InMemory{ 0 };
+
+std::mutex s_DirectoryMutex;
+std::string s_Directory;
+
+/* reserve size bytes of the memory budget, false if that would exceed the limit */
+bool reserveMemory(size_t size) {
+  size_t limit = s_MemoryLimit;
+  size_t current = s_InMemory;
+  do {
+    if ((limit != 0) && (current + size > limit)) {
+      return false;
+    }
+  } while (!s_InMemory.compare_exchange_weak(current, current + size));
+  return true;
+}
+
+std::string scratchDirectory() {
+  {
+    std::lock_guard<std::mutex> lock(s_DirectoryMutex);
+    if (!s_Directory.empty()) {
+      return s_Directory;
+    }
+  }
+#ifdef _WIN32
+  wchar_t buffer[MAX_PATH + 1];
+  DWORD length = ::GetTempPathW(MAX_PATH + 1, buffer);
+  return toMB(buffer, CodePage::UTF8, length);
+#else
+  const char *env = getenv("TMPDIR");
+  return (env != nullptr) && (*env != '\0') ? env : "/var/tmp";
+#endif
+}
+
+}
+
+void ScratchBuffer::setMemoryLimit(size_t bytes)
+{
+  s_MemoryLimit = bytes;
+}
+
+void ScratchBuffer::setDirectory(const std::string &path)
+{
+  std::lock_guard<std::mutex> lock(s_DirectoryMutex);
+  s_Directory = path;
+}
+
+ScratchBuffer::ScratchBuffer(size_t size, bool growable)
+  : m_Allocated(0)
+  , m_Mapped(nullptr)
+  , m_Data(nullptr)
+  , m_Size(size)
+{
+  if (growable) {
+    return;
+  }
+  if ((size == 0) || reserveMemory(size)) {
+    // not from the buffer pool: idle pooled memory would escape the memory limit
+    m_Memory.reset(new uint8_t[size]);
+    m_Allocated = size;
+    m_Data = m_Memory.get();
+  } else {
+    mapTempFile();
+  }
+}
+
+void ScratchBuffer::grow(size_t bytes)
+{
+  if ((m_Mapped != nullptr) || (bytes <= m_Allocated)) {
+    return;
+  }
+
+  // geometrically, to keep the copying linear
+  size_t target = (std::min)(m_Size, (std::max)(bytes, m_Allocated * 2));
+  if (reserveMemory(target - m_Allocated)) {
+    std::unique_ptr<uint8_t[]> memory(new uint8_t[target]);
+    if (m_Allocated > 0) {
+      memcpy(memory.get(), m_Memory.get(), m_Allocated);
+    }
+    m_Memory.swap(memory);
+    m_Allocated = target;
+    m_Data = m_Memory.get();
+  } else {
+    // the file is sized to the whole buffer right away, pages not written to don't take up space
+    mapTempFile();
+    if (m_Allocated > 0) {
+      memcpy(m_Data, m_Memory.get(), m_Allocated);
+    }
+    m_Memory.reset();
+    s_InMemory -= m_Allocated;
+    m_Allocated = 0;
+  }
+}
+
+ScratchBuffer::~ScratchBuffer()
+{
+  if (m_Mapped != nullptr) {
+#ifdef _WIN32
+    ::UnmapViewOfFile(m_Mapped);
+#else
+    ::munmap(m_Mapped, m_Size);
+#endif
+  }
+  s_InMemory -= m_Allocated;
+}
+
+void ScratchBuffer::mapTempFile()
+{
+  std::string directory = scratchDirectory();
+
+#ifdef _WIN32
+  std::wstring directoryW = toWC(directory.c_str(), CodePage::UTF8, directory.length());
+  wchar_t fileName[MAX_PATH + 1];
+  if (::GetTempFileNameW(directoryW.c_str(), L"gbs", 0, fileName) == 0) {
+    throw std::runtime_error(fmt::format("failed to create scratch file in \"{}\" (error {})", directory, ::GetLastError()));
+  }
+  // deleted automatically once the mapping is closed
+  HANDLE file = ::CreateFileW(fileName, GENERIC_READ | GENERIC_WRITE, 0, nullptr, CREATE_ALWAYS,
+                              FILE_ATTRIBUTE_TEMPORARY | FILE_FLAG_DELETE_ON_CLOSE, nullptr);
+  if (file == INVALID_HANDLE_VALUE) {
+    DWORD error = ::GetLastError();
+    ::DeleteFileW(fileName);
+    throw std::runtime_error(fmt::format("failed to create scratch file in \"{}\" (error {})", directory, error));
+  }
+
+  uint64_t size = m_Size;
+  HANDLE mapping = ::CreateFileMappingW(file, nullptr, PAGE_READWRITE,
+                                        static_cast<DWORD>(size >> 32), static_cast<DWORD>(size & 0xFFFFFFFF), nullptr);
+  ::CloseHandle(file);
+  if (mapping == nullptr) {
+    throw std::runtime_error(fmt::format("failed to map scratch file (error {})", ::GetLastError()));
+  }
+  m_Mapped = ::MapViewOfFile(mapping, FILE_MAP_WRITE, 0, 0, m_Size);
+  DWORD error = ::GetLastError();
+  ::CloseHandle(mapping);
+  if (m_Mapped == nullptr) {
+    throw std::runtime_error(fmt::format("failed to map scratch file (error {})", error));
+  }
+#else
+  std::string pattern = directory + "/gamebryosave-XXXXXX";
+  int fd = ::mkstemp(&pattern[0]);
+  if (fd == -1) {
+    throw std::runtime_error(fmt::format("failed to create scratch file in \"{}\": {}", directory, strerror(errno)));
+  }
+  // the file disappears as soon as the mapping is gone
+  ::unlink(pattern.c_str());
+
+  if (::ftruncate(fd, static_cast<off_t>(m_Size)) != 0) {
+    int error = errno;
+    ::close(fd);
+    throw std::runtime_error(fmt::format("failed to size scratch file: {}", strerror(error)));
+  }
+
+  void *base = ::mmap(nullptr, m_Size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  int error = errno;
+  ::close(fd);
+  if (base == MAP_FAILED) {
+    throw std::runtime_error(fmt::format("failed to map scratch file: {}", strerror(error)));
+  }
+  m_Mapped = base;
+#endif
+
+  m_Data = static_cast<uint8_t*>(m_Mapped);
+}
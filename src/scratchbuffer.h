@@ -0,0 +1,56 @@
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+#include <memory>
+#include <string>
+
+/**
+ * Large, fixed size work buffer (i.e. a decompressed save body).
+ * All scratch buffers together stay below a process-wide memory limit, buffers that would exceed it
+ * are backed by a mapping of an (already deleted) temporary file instead, so the os can page them out
+ * to disk rather than to swap. Growable buffers start out empty and only allocate as much memory
+ * as has been requested through grow, moving to a file once they no longer fit the limit.
+ * No limit (0) by default
+ */
+class ScratchBuffer {
+public:
+  /* bytes all in-memory scratch buffers may use together, 0 for unlimited */
+  static void setMemoryLimit(size_t bytes);
+
+  /* directory for the temporary files. Defaults to TMPDIR, or /var/tmp since /tmp is
+   * frequently in memory, or the user temp directory on windows */
+  static void setDirectory(const std::string &path);
+
+  explicit ScratchBuffer(size_t size, bool growable = false);
+  ~ScratchBuffer();
+
+  ScratchBuffer(const ScratchBuffer&) = delete;
+  ScratchBuffer &operator=(const ScratchBuffer&) = delete;
+
+  uint8_t *data() { return m_Data; }
+  const uint8_t *data() const { return m_Data; }
+  size_t size() const { return m_Size; }
+
+  /* make sure the first `bytes` bytes of a growable buffer can be accessed. This may move the
+   * data, pointers returned by data() before are invalid afterwards */
+  void grow(size_t bytes);
+
+  /* true if this buffer is backed by a file */
+  bool spilled() const { return m_Mapped != nullptr; }
+
+private:
+
+  void mapTempFile();
+
+private:
+
+  // not initialized, only the pages actually written to get committed
+  std::unique_ptr<uint8_t[]> m_Memory;
+  // size of m_Memory, all of it counts against the limit
+  size_t m_Allocated;
+  void *m_Mapped;
+  uint8_t *m_Data;
+  size_t m_Size;
+
+};
@@ -0,0 +1,215 @@
+#include "screenshot.h"
+#include "fileregion.h"
+#include "bufferpool.h"
+
+#include <lz4.h>
+#include <atomic>
+#include <cstring>
+#include <list>
+#include <mutex>
+#include <stdexcept>
+#include <unordered_map>
+
+namespace {
+
+typedef std::shared_ptr<const std::vector<uint8_t>> DecodedPtr;
+
+class DecodedCache {
+public:
+  static DecodedCache &instance() {
+    static DecodedCache s_Instance;
+    return s_Instance;
+  }
+
+  void setCapacity(size_t capacity) {
+    std::lock_guard<std::mutex> lock(m_Mutex);
+    m_Capacity = capacity;
+    shrink();
+  }
+
+  DecodedPtr get(uint64_t id) {
+    std::lock_guard<std::mutex> lock(m_Mutex);
+    auto iter = m_Index.find(id);
+    if (iter == m_Index.end()) {
+      return DecodedPtr();
+    }
+    // move to front
+    m_Entries.splice(m_Entries.begin(), m_Entries, iter->second);
+    return iter->second->second;
+  }
+
+  void put(uint64_t id, const DecodedPtr &data) {
+    std::lock_guard<std::mutex> lock(m_Mutex);
+    if (m_Capacity == 0) {
+      return;
+    }
+    auto iter = m_Index.find(id);
+    if (iter != m_Index.end()) {
+      m_Entries.erase(iter->second);
+    }
+    m_Entries.push_front(std::make_pair(id, data));
+    m_Index[id] = m_Entries.begin();
+    shrink();
+  }
+
+  size_t clear() {
+    EntryList entries;
+    {
+      std::lock_guard<std::mutex> lock(m_Mutex);
+      entries.swap(m_Entries);
+      m_Index.clear();
+    }
+    size_t result = 0;
+    for (const auto &entry : entries) {
+      if (entry.second.use_count() == 1) {
+        result += entry.second->capacity();
+      }
+    }
+    return result;
+  }
+
+  void remove(uint64_t id) {
+    std::lock_guard<std::mutex> lock(m_Mutex);
+    auto iter = m_Index.find(id);
+    if (iter != m_Index.end()) {
+      m_Entries.erase(iter->second);
+      m_Index.erase(iter);
+    }
+  }
+
+private:
+  typedef std::list<std::pair<uint64_t, DecodedPtr>> EntryList;
+
+  DecodedCache() : m_Capacity(8) {}
+
+  void shrink() {
+    while (m_Entries.size() > m_Capacity) {
+      m_Index.erase(m_Entries.back().first);
+      m_Entries.pop_back();
+    }
+  }
+
+private:
+  std::mutex m_Mutex;
+  size_t m_Capacity;
+  EntryList m_Entries;
+  std::unordered_map<uint64_t, EntryList::iterator> m_Index;
+};
+
+std::atomic<Screenshot::Retention> s_Retention{ Screenshot::Retention::RAW };
+std::atomic<bool> s_DeferLoading{ false };
+std::atomic<uint64_t> s_NextId{ 1 };
+
+}
+
+void Screenshot::setRetention(Retention retention, size_t cacheSize)
+{
+  s_Retention = retention;
+  DecodedCache::instance().setCapacity(cacheSize);
+}
+
+Screenshot::Retention Screenshot::retention()
+{
+  return s_Retention;
+}
+
+size_t Screenshot::trimCache()
+{
+  return DecodedCache::instance().clear();
+}
+
+void Screenshot::setDeferLoading(bool enabled)
+{
+  s_DeferLoading = enabled;
+}
+
+bool Screenshot::deferLoading()
+{
+  return s_DeferLoading;
+}
+
+Screenshot::Screenshot()
+  : m_Id(s_NextId++)
+  , m_Size(0)
+{
+}
+
+Screenshot::~Screenshot()
+{
+  if (!m_Compressed.empty()) {
+    DecodedCache::instance().remove(m_Id);
+  }
+  BufferPool::instance().release(std::move(m_Raw));
+}
+
+void Screenshot::assign(std::vector<uint8_t> &&rgba)
+{
+  DecodedCache::instance().remove(m_Id);
+  m_Size = rgba.size();
+  m_Compressed.clear();
+  BufferPool::instance().release(std::move(m_Raw));
+  m_Region.reset();
+
+  if ((s_Retention == Retention::COMPRESSED) && (m_Size > 0)) {
+    int bound = LZ4_compressBound(static_cast<int>(m_Size));
+    m_Compressed.resize(bound);
+    int compressedSize = LZ4_compress_default(reinterpret_cast<const char*>(rgba.data()), &m_Compressed[0],
+                                              static_cast<int>(m_Size), bound);
+    if (compressedSize > 0) {
+      m_Compressed.resize(compressedSize);
+      m_Compressed.shrink_to_fit();
+      BufferPool::instance().release(std::move(rgba));
+      return;
+    }
+    // compression failed, not the end of the world
+    m_Compressed.clear();
+  }
+
+  m_Raw = std::move(rgba);
+}
+
+void Screenshot::assignDeferred(const std::shared_ptr<FileRegion> &region)
+{
+  DecodedCache::instance().remove(m_Id);
+  m_Compressed.clear();
+  BufferPool::instance().release(std::move(m_Raw));
+  m_Region = region;
+  m_Size = region->size();
+}
+
+size_t Screenshot::residentSize() const
+{
+  if (m_Region) {
+    // nothing until the pixels are first used
+    return m_Region->residentSize();
+  }
+  return m_Compressed.empty() ? m_Raw.size() : m_Compressed.size();
+}
+
+void Screenshot::copyTo(uint8_t *out) const
+{
+  if (m_Region) {
+    memcpy(out, m_Region->data(), m_Size);
+  } else if (m_Compressed.empty()) {
+    memcpy(out, m_Raw.data(), m_Raw.size());
+  } else {
+    DecodedPtr decoded = decode();
+    memcpy(out, decoded->data(), m_Size);
+  }
+}
+
+std::shared_ptr<const std::vector<uint8_t>> Screenshot::decode() const
+{
+  DecodedPtr result = DecodedCache::instance().get(m_Id);
+  if (!result) {
+    std::shared_ptr<std::vector<uint8_t>> buffer = std::make_shared<std::vector<uint8_t>>(m_Size);
+    int res = LZ4_decompress_safe(m_Compressed.data(), reinterpret_cast<char*>(buffer->data()),
+                                  static_cast<int>(m_Compressed.size()), static_cast<int>(m_Size));
+    if (res != static_cast<int>(m_Size)) {
+      throw std::runtime_error("failed to decode screenshot");
+    }
+    result = buffer;
+    DecodedCache::instance().put(m_Id, result);
+  }
+  return result;
+}
@@ -0,0 +1,76 @@
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+#include <vector>
+#include <memory>
+
+class FileRegion;
+
+/**
+ * Pixel data of a save game screenshot in 32-bit rgba.
+ * Depending on the retention policy the pixels are either kept as is or lz4 compressed,
+ * in which case they get decoded on demand. Recently decoded images are kept in a small
+ * (process-wide) lru cache so that repeatedly displaying the same few saves stays cheap.
+ * Where the file contains the rgba data verbatim, the screenshot can also be backed by the region
+ * of the file, which is only loaded once the pixels are used
+ */
+class Screenshot {
+public:
+  enum class Retention {
+    RAW,
+    COMPRESSED,
+  };
+
+  /* change the policy for screenshots read from here on out.
+   * cacheSize is the number of decoded images to keep around */
+  static void setRetention(Retention retention, size_t cacheSize);
+  static Retention retention();
+
+  /* drop all cached decoded images, returns the number of bytes freed. Images still in use
+   * elsewhere don't count */
+  static size_t trimCache();
+
+  /* skip the pixels while parsing and read them from the file the first time they are used, where
+   * the format allows */
+  static void setDeferLoading(bool enabled);
+  static bool deferLoading();
+
+  Screenshot();
+  ~Screenshot();
+
+  Screenshot(const Screenshot&) = delete;
+  Screenshot &operator=(const Screenshot&) = delete;
+
+  /* take over rgba pixels, compressing them if that's what the retention policy says */
+  void assign(std::vector<uint8_t> &&rgba);
+
+  /* use pixels straight from a region of the file, loaded on first use */
+  void assignDeferred(const std::shared_ptr<FileRegion> &region);
+
+  /* the file region backing this image, if any */
+  std::shared_ptr<FileRegion> region() const { return m_Region; }
+
+  /* size of the decoded image in bytes */
+  size_t size() const { return m_Size; }
+
+  /* number of bytes actually held in memory for this image */
+  size_t residentSize() const;
+
+  /* write the decoded image to out, which needs room for size() bytes. Throws if the image is
+   * backed by a file that changed since */
+  void copyTo(uint8_t *out) const;
+
+private:
+
+  std::shared_ptr<const std::vector<uint8_t>> decode() const;
+
+private:
+
+  uint64_t m_Id;
+  size_t m_Size;
+  std::vector<uint8_t> m_Raw;
+  std::vector<char> m_Compressed;
+  std::shared_ptr<FileRegion> m_Region;
+
+};
@@ -0,0 +1,318 @@
+#include "sharedcache.h"
+
+#include <atomic>
+#include <chrono>
+#include <cerrno>
+#include <cstring>
+#include <mutex>
+#include <stdexcept>
+
+#include "string_cast.h"
+#include "fmt/format.h"
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+static_assert(sizeof(std::atomic<uint32_t>) == sizeof(uint32_t), "atomics in shared memory need to be plain integers");
+static_assert(sizeof(std::atomic<uint64_t>) == sizeof(uint64_t), "atomics in shared memory need to be plain integers");
+
+namespace {
+
+const char CACHE_MAGIC[4] = { 'G', 'B', 'S', 'C' };
+const uint32_t CACHE_VERSION = 2;
+
+// number of consecutive slots an entry may be stored in
+const uint64_t PROBE_COUNT = 4;
+
+const uint32_t FLAG_COMPLETE = 0x01;
+
+// a slot that has been locked for this long belongs to a writer that died (a store only copies a
+// few kilobytes), the next writer takes it over
+const uint64_t STALE_LOCK_SECONDS = 10;
+
+std::mutex s_InstanceMutex;
+std::shared_ptr<SharedCache> s_Instance;
+
+uint64_t hashPath(const std::string &path) {
+  uint64_t hash = 0xcbf29ce484222325ULL;
+  for (char ch : path) {
+    hash = (hash ^ static_cast<uint8_t>(ch)) * 0x100000001b3ULL;
+  }
+  // 0 marks empty slots
+  return hash == 0 ? 1 : hash;
+}
+
+/* wall clock since all processes need to agree on it */
+uint64_t lockClock() {
+  return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::seconds>(
+    std::chrono::system_clock::now().time_since_epoch()).count()) & 0xFFFFFFFF;
+}
+
+}
+
+struct SharedCache::Header {
+  char magic[4];
+  uint32_t version;
+  uint64_t slotCount;
+  uint32_t slotSize;
+  uint32_t padding;
+  // incremented with every store, used to find the oldest entry when evicting
+  std::atomic<uint64_t> clock;
+};
+
+struct SharedCache::Slot {
+  // the low 32 bits are odd while the slot is being written, the high 32 bits hold the time (lockClock)
+  // the writer took the slot at then. Both change in one step so a lock is never without its time
+  std::atomic<uint64_t> sequence;
+  uint32_t flags;
+  uint32_t pathLength;
+  uint32_t dataLength;
+  uint32_t padding;
+  uint64_t keyHash;
+  uint64_t stamp;
+  uint64_t fileSize;
+  int64_t modified;
+  // followed by path and data
+};
+
+namespace {
+
+const uint64_t HEADER_SIZE = 64;
+const uint64_t SLOT_HEADER_SIZE = 64;
+
+}
+
+std::shared_ptr<SharedCache> SharedCache::instance()
+{
+  std::lock_guard<std::mutex> lock(s_InstanceMutex);
+  return s_Instance;
+}
+
+void SharedCache::configure(const std::string &path, uint64_t size, uint32_t slotSize)
+{
+  std::shared_ptr<SharedCache> cache;
+  if (!path.empty()) {
+    cache = std::make_shared<SharedCache>(path, size, slotSize);
+  }
+  std::lock_guard<std::mutex> lock(s_InstanceMutex);
+  s_Instance = cache;
+}
+
+SharedCache::SharedCache(const std::string &path, uint64_t size, uint32_t slotSize)
+  : m_Base(nullptr)
+  , m_Size(0)
+  , m_Header(nullptr)
+{
+  static_assert(sizeof(Header) <= HEADER_SIZE, "cache header too large");
+  static_assert(sizeof(Slot) <= SLOT_HEADER_SIZE, "slot header too large");
+
+  slotSize = (slotSize + 63) & ~63U;
+  if ((slotSize <= SLOT_HEADER_SIZE) || (size < HEADER_SIZE + slotSize * PROBE_COUNT)) {
+    throw std::runtime_error("shared cache too small");
+  }
+
+#ifdef _WIN32
+  HANDLE file = ::CreateFileW(toWC(path.c_str(), CodePage::UTF8, path.length()).c_str(),
+                              GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE,
+                              nullptr, OPEN_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr);
+  if (file == INVALID_HANDLE_VALUE) {
+    throw std::runtime_error(fmt::format("failed to open shared cache \"{}\" (error {})", path, ::GetLastError()));
+  }
+
+  // only one process gets to initialize the file
+  OVERLAPPED overlapped;
+  memset(&overlapped, 0, sizeof(OVERLAPPED));
+  ::LockFileEx(file, LOCKFILE_EXCLUSIVE_LOCK, 0, 1, 0, &overlapped);
+
+  LARGE_INTEGER fileSize;
+  ::GetFileSizeEx(file, &fileSize);
+  bool created = fileSize.QuadPart == 0;
+  if (created) {
+    fileSize.QuadPart = static_cast<LONGLONG>(size);
+    ::SetFilePointerEx(file, fileSize, nullptr, FILE_BEGIN);
+    ::SetEndOfFile(file);
+  }
+  m_Size = static_cast<uint64_t>(fileSize.QuadPart);
+
+  HANDLE mapping = ::CreateFileMappingW(file, nullptr, PAGE_READWRITE, 0, 0, nullptr);
+  if (mapping != nullptr) {
+    m_Base = ::MapViewOfFile(mapping, FILE_MAP_ALL_ACCESS, 0, 0, static_cast<SIZE_T>(m_Size));
+    ::CloseHandle(mapping);
+  }
+  DWORD error = ::GetLastError();
+  if (m_Base == nullptr) {
+    ::UnlockFileEx(file, 0, 1, 0, &overlapped);
+    ::CloseHandle(file);
+    throw std::runtime_error(fmt::format("failed to map shared cache \"{}\" (error {})", path, error));
+  }
+#else
+  int fd = ::open(path.c_str(), O_RDWR | O_CREAT, 0644);
+  if (fd == -1) {
+    throw std::runtime_error(fmt::format("failed to open shared cache \"{}\": {}", path, strerror(errno)));
+  }
+
+  // only one process gets to initialize the file
+  ::flock(fd, LOCK_EX);
+
+  struct stat fileStat;
+  ::fstat(fd, &fileStat);
+  bool created = fileStat.st_size == 0;
+  if (created && (::ftruncate(fd, static_cast<off_t>(size)) != 0)) {
+    int error = errno;
+    ::close(fd);
+    throw std::runtime_error(fmt::format("failed to size shared cache \"{}\": {}", path, strerror(error)));
+  }
+  m_Size = created ? size : static_cast<uint64_t>(fileStat.st_size);
+
+  void *base = ::mmap(nullptr, static_cast<size_t>(m_Size), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  int error = errno;
+  if (base == MAP_FAILED) {
+    ::close(fd);
+    throw std::runtime_error(fmt::format("failed to map shared cache \"{}\": {}", path, strerror(error)));
+  }
+  m_Base = base;
+#endif
+
+  m_Header = static_cast<Header*>(m_Base);
+  if (created || (memcmp(m_Header->magic, CACHE_MAGIC, 4) != 0) || (m_Header->version != CACHE_VERSION)) {
+    // new or incompatible, start from scratch. Other processes having this mapped already
+    // would have to be using the same broken file so there is nothing to preserve
+    memset(m_Base, 0, static_cast<size_t>(m_Size));
+    m_Header->version = CACHE_VERSION;
+    m_Header->slotSize = slotSize;
+    m_Header->slotCount = (m_Size - HEADER_SIZE) / slotSize;
+    memcpy(m_Header->magic, CACHE_MAGIC, 4);
+  }
+
+#ifdef _WIN32
+  ::UnlockFileEx(file, 0, 1, 0, &overlapped);
+  ::CloseHandle(file);
+#else
+  ::flock(fd, LOCK_UN);
+  ::close(fd);
+#endif
+
+  if ((m_Header->slotSize <= SLOT_HEADER_SIZE)
+      || (HEADER_SIZE + m_Header->slotCount * m_Header->slotSize > m_Size)
+      || (m_Header->slotCount < PROBE_COUNT)) {
+    throw std::runtime_error(fmt::format("shared cache \"{}\" is damaged", path));
+  }
+}
+
+SharedCache::~SharedCache()
+{
+  if (m_Base != nullptr) {
+#ifdef _WIN32
+    ::UnmapViewOfFile(m_Base);
+#else
+    ::munmap(m_Base, static_cast<size_t>(m_Size));
+#endif
+  }
+}
+
+SharedCache::Slot *SharedCache::slot(uint64_t idx) const
+{
+  return reinterpret_cast<Slot*>(static_cast<uint8_t*>(m_Base) + HEADER_SIZE
+                                 + (idx % m_Header->slotCount) * m_Header->slotSize);
+}
+
+bool SharedCache::lookup(const Key &key, std::vector<uint8_t> &data, bool &complete, bool *stale) const
+{
+  uint64_t hash = hashPath(key.path);
+  size_t capacity = m_Header->slotSize - SLOT_HEADER_SIZE;
+
+  for (uint64_t probe = 0; probe < PROBE_COUNT; ++probe) {
+    Slot *entry = slot(hash + probe);
+    uint64_t sequence = entry->sequence.load(std::memory_order_acquire);
+    if ((sequence & 1) || (entry->keyHash != hash)) {
+      continue;
+    }
+
+    uint32_t pathLength = entry->pathLength;
+    uint32_t dataLength = entry->dataLength;
+    bool current = (entry->fileSize == key.fileSize) && (entry->modified == key.modified);
+    if ((static_cast<uint64_t>(pathLength) + dataLength > capacity)
+        || (pathLength != key.path.length())
+        || (!current && (stale == nullptr))) {
+      continue;
+    }
+    uint32_t flags = entry->flags;
+
+    const uint8_t *payload = reinterpret_cast<const uint8_t*>(entry) + SLOT_HEADER_SIZE;
+    bool pathMatches = memcmp(payload, key.path.data(), pathLength) == 0;
+    data.assign(payload + pathLength, payload + pathLength + dataLength);
+
+    // if the sequence changed, a writer got in between and what we copied may be garbage
+    std::atomic_thread_fence(std::memory_order_acquire);
+    if (entry->sequence.load(std::memory_order_relaxed) != sequence) {
+      continue;
+    }
+    if (pathMatches) {
+      complete = (flags & FLAG_COMPLETE) != 0;
+      if (stale != nullptr) {
+        *stale = !current;
+      }
+      return true;
+    }
+  }
+  data.clear();
+  return false;
+}
+
+void SharedCache::store(const Key &key, const uint8_t *data, size_t size, bool complete)
+{
+  uint64_t hash = hashPath(key.path);
+  if (key.path.length() + size > m_Header->slotSize - SLOT_HEADER_SIZE) {
+    return;
+  }
+
+  // reuse the slot of this save if there is one, otherwise take an empty or the oldest slot
+  Slot *target = nullptr;
+  for (uint64_t probe = 0; probe < PROBE_COUNT; ++probe) {
+    Slot *entry = slot(hash + probe);
+    if (entry->keyHash == hash) {
+      target = entry;
+      break;
+    }
+    if ((target == nullptr) || (target->keyHash != 0 && ((entry->keyHash == 0) || (entry->stamp < target->stamp)))) {
+      target = entry;
+    }
+  }
+
+  uint64_t now = lockClock();
+  uint64_t sequence = target->sequence.load(std::memory_order_relaxed);
+  uint32_t count = static_cast<uint32_t>(sequence);
+  if (count & 1) {
+    uint64_t lockedAt = sequence >> 32;
+    if ((now < lockedAt) || (now - lockedAt < STALE_LOCK_SECONDS)) {
+      // someone else is writing this slot right now
+      return;
+    }
+    // the writer was killed halfway through, take over from it. The slot stays odd (so readers
+    // keep skipping it) with our own lock time
+    ++count;
+  }
+  uint64_t locked = (now << 32) | static_cast<uint32_t>(count + 1);
+  if (!target->sequence.compare_exchange_strong(sequence, locked, std::memory_order_acquire)) {
+    return;
+  }
+  std::atomic_thread_fence(std::memory_order_release);
+
+  target->flags = complete ? FLAG_COMPLETE : 0;
+  target->keyHash = hash;
+  target->stamp = m_Header->clock.fetch_add(1, std::memory_order_relaxed);
+  target->fileSize = key.fileSize;
+  target->modified = key.modified;
+  target->pathLength = static_cast<uint32_t>(key.path.length());
+  target->dataLength = static_cast<uint32_t>(size);
+  uint8_t *payload = reinterpret_cast<uint8_t*>(target) + SLOT_HEADER_SIZE;
+  memcpy(payload, key.path.data(), key.path.length());
+  memcpy(payload + key.path.length(), data, size);
+
+  target->sequence.store(static_cast<uint32_t>(count + 2), std::memory_order_release);
+}
@@ -0,0 +1,57 @@
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "fileops.h"
+
+/**
+ * Cache of parse results in a memory mapped file that all processes using the same file share.
+ * The file is divided into fixed size slots. Entries are found by hashing the path of the save and
+ * probing a few neighbouring slots. Each slot is guarded by a sequence lock, so neither readers nor writers
+ * ever block. A reader that races with a writer treats that as a miss, and a writer that finds the slot
+ * busy just doesn't store, unless the lock is so old that its writer must have died. Entries are only
+ * valid as long as size and modification time of the save match
+ */
+class SharedCache {
+public:
+  typedef FileKey Key;
+
+  /* the cache used by all saves in this process, empty if none is configured */
+  static std::shared_ptr<SharedCache> instance();
+
+  /* open (creating it if necessary) the cache file at path and use it from here on. size and slotSize
+   * only apply when the file gets created, otherwise the layout of the existing file is used.
+   * An empty path disables the cache */
+  static void configure(const std::string &path, uint64_t size, uint32_t slotSize);
+
+  SharedCache(const std::string &path, uint64_t size, uint32_t slotSize);
+  ~SharedCache();
+
+  SharedCache(const SharedCache&) = delete;
+  SharedCache &operator=(const SharedCache&) = delete;
+
+  /* copy the entry for key to data. complete is set if the entry is from a full (not quick) read.
+   * If stale is passed, an outdated entry (same path, different size or modification time) counts
+   * as a hit as well and *stale tells which it was. Returns false on a miss */
+  bool lookup(const Key &key, std::vector<uint8_t> &data, bool &complete, bool *stale = nullptr) const;
+
+  /* store an entry, silently doing nothing if it doesn't fit into a slot or the slot is busy */
+  void store(const Key &key, const uint8_t *data, size_t size, bool complete);
+
+private:
+
+  struct Header;
+  struct Slot;
+
+  Slot *slot(uint64_t idx) const;
+
+private:
+
+  void *m_Base;
+  uint64_t m_Size;
+  Header *m_Header;
+
+};
@@ -0,0 +1,74 @@
+#include "slowlog.h"
+
+#include <algorithm>
+
+SlowLog &SlowLog::instance()
+{
+  static SlowLog s_Instance;
+  return s_Instance;
+}
+
+SlowLog::SlowLog()
+  : m_Threshold(0.0)
+  , m_Capacity(100)
+  , m_Next(0)
+{
+}
+
+void SlowLog::configure(double thresholdMs, size_t capacity)
+{
+  std::lock_guard<std::mutex> lock(m_Mutex);
+  m_Threshold = (std::max)(0.0, thresholdMs);
+  if ((capacity != 0) && (capacity != m_Capacity)) {
+    // keep the most recent entries in order
+    std::vector<Entry> entries;
+    size_t count = m_Entries.size();
+    for (size_t i = count - (std::min)(count, capacity); i < count; ++i) {
+      entries.push_back(std::move(m_Entries[(m_Next + i) % count]));
+    }
+    m_Entries.swap(entries);
+    m_Capacity = capacity;
+    m_Next = 0;
+  }
+}
+
+bool SlowLog::enabled() const
+{
+  std::lock_guard<std::mutex> lock(m_Mutex);
+  return m_Threshold > 0.0;
+}
+
+bool SlowLog::exceeds(double totalMs) const
+{
+  std::lock_guard<std::mutex> lock(m_Mutex);
+  return (m_Threshold > 0.0) && (totalMs >= m_Threshold);
+}
+
+void SlowLog::add(Entry &&entry)
+{
+  std::lock_guard<std::mutex> lock(m_Mutex);
+  if (m_Entries.size() < m_Capacity) {
+    m_Entries.push_back(std::move(entry));
+  } else {
+    m_Entries[m_Next] = std::move(entry);
+    m_Next = (m_Next + 1) % m_Capacity;
+  }
+}
+
+std::vector<SlowLog::Entry> SlowLog::entries() const
+{
+  std::lock_guard<std::mutex> lock(m_Mutex);
+  std::vector<Entry> result;
+  result.reserve(m_Entries.size());
+  for (size_t i = 0; i < m_Entries.size(); ++i) {
+    result.push_back(m_Entries[(m_Next + i) % m_Entries.size()]);
+  }
+  return result;
+}
+
+void SlowLog::clear()
+{
+  std::lock_guard<std::mutex> lock(m_Mutex);
+  m_Entries.clear();
+  m_Next = 0;
+}
@@ -0,0 +1,68 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <vector>
+
+/**
+ * Record of parses that took longer than a threshold, to find out which saves (or which storage)
+ * make listing saves slow without having to profile on the users system.
+ * Only the most recent entries are kept, in a fixed size ring buffer
+ */
+class SlowLog {
+public:
+  struct Entry {
+    std::string path;
+    uint64_t fileSize;
+    // milliseconds since the unix epoch at the end of the parse
+    int64_t time;
+    std::string game;
+    std::string compression;
+    bool quick;
+    // restored from the shared cache instead of parsed
+    bool cached;
+    // empty if the parse succeeded
+    std::string error;
+    double totalMs;
+    double openMs;
+    double headerMs;
+    double imageMs;
+    // part of pluginsMs, decompression happens while reading past the screenshot
+    double decompressMs;
+    double pluginsMs;
+  };
+
+  static SlowLog &instance();
+
+  /* parses taking at least thresholdMs get logged, 0 disables the log. capacity is the number
+   * of entries kept, 0 keeps the current capacity */
+  void configure(double thresholdMs, size_t capacity);
+
+  bool enabled() const;
+
+  /* whether a parse of this duration should be logged */
+  bool exceeds(double totalMs) const;
+
+  void add(Entry &&entry);
+
+  /* the logged entries, oldest first */
+  std::vector<Entry> entries() const;
+
+  void clear();
+
+private:
+
+  SlowLog();
+
+private:
+
+  mutable std::mutex m_Mutex;
+  double m_Threshold;
+  std::vector<Entry> m_Entries;
+  size_t m_Capacity;
+  // where the next entry goes once the buffer is full
+  size_t m_Next;
+
+};
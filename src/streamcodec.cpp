@@ -0,0 +1,408 @@
+#include "streamcodec.h"
+#include "fmt/format.h"
+
+#include <zlib.h>
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+
+namespace {
+
+// lz4 block format constraints
+const size_t MIN_MATCH = 4;
+const size_t LAST_LITERALS = 5;
+const size_t MF_LIMIT = 12;
+const size_t MAX_DISTANCE = 65535;
+
+const int HASH_BITS = 16;
+
+// buffered data is only moved once this much can be dropped from the front
+const size_t COMPACT_THRESHOLD = 1024 * 1024;
+
+const size_t ZLIB_CHUNK = 256 * 1024;
+
+uint32_t read32(const uint8_t *ptr) {
+  uint32_t value;
+  memcpy(&value, ptr, sizeof(uint32_t));
+  return value;
+}
+
+uint32_t hashSequence(uint32_t sequence) {
+  return (sequence * 2654435761U) >> (32 - HASH_BITS);
+}
+
+void writeLength(std::vector<uint8_t> &out, size_t length) {
+  while (length >= 255) {
+    out.push_back(255);
+    length -= 255;
+  }
+  out.push_back(static_cast<uint8_t>(length));
+}
+
+/**
+ * Produces a single lz4 block from streamed input.
+ * The lz4 library can only stream by emitting a sequence of independent blocks, which the games
+ * can't read, so this is a (greedy, hash table based) encoder of its own that keeps one sequence
+ * stream going over a 64k window
+ */
+class LZ4BlockEncoder : public StreamCodec {
+public:
+  LZ4BlockEncoder()
+    : m_Base(0)
+    , m_Pos(0)
+    , m_Anchor(0)
+    , m_SearchCount(1 << 6)
+    , m_Table(1 << HASH_BITS, 0)
+  {
+  }
+
+  virtual void update(const uint8_t *data, size_t size, std::vector<uint8_t> &out) {
+    m_Buffer.insert(m_Buffer.end(), data, data + size);
+    compress(out);
+    compact();
+  }
+
+  virtual void finish(std::vector<uint8_t> &out) {
+    compress(out);
+    // the block always ends in a sequence of literals only
+    uint64_t end = m_Base + m_Buffer.size();
+    emit(out, static_cast<size_t>(end - m_Anchor), 0, 0);
+    m_Anchor = m_Pos = end;
+  }
+
+private:
+
+  const uint8_t *at(uint64_t pos) const {
+    return m_Buffer.data() + (pos - m_Base);
+  }
+
+  /* find matches in the data buffered so far. Matches are limited as if the current end was
+   * the end of the block, which remains correct no matter what follows */
+  void compress(std::vector<uint8_t> &out) {
+    uint64_t end = m_Base + m_Buffer.size();
+    if (end <= MF_LIMIT) {
+      return;
+    }
+    uint64_t matchStartLimit = end - MF_LIMIT;
+    uint64_t matchEndLimit = end - LAST_LITERALS;
+
+    while (m_Pos < matchStartLimit) {
+      uint32_t sequence = read32(at(m_Pos));
+      uint32_t hash = hashSequence(sequence);
+      // positions are stored off by one so 0 can mean "empty"
+      uint64_t candidate = m_Table[hash];
+      m_Table[hash] = m_Pos + 1;
+
+      if ((candidate != 0) && (candidate - 1 >= m_Base) && (m_Pos - (candidate - 1) <= MAX_DISTANCE)
+          && (read32(at(candidate - 1)) == sequence)) {
+        uint64_t matchPos = candidate - 1;
+        uint64_t start = m_Pos;
+        // extend backwards over pending literals
+        while ((start > m_Anchor) && (matchPos > m_Base) && (*at(start - 1) == *at(matchPos - 1))) {
+          --start;
+          --matchPos;
+        }
+        uint64_t matchEnd = m_Pos + MIN_MATCH;
+        uint64_t source = (candidate - 1) + MIN_MATCH;
+        while ((matchEnd < matchEndLimit) && (*at(matchEnd) == *at(source))) {
+          ++matchEnd;
+          ++source;
+        }
+
+        emit(out, static_cast<size_t>(start - m_Anchor), static_cast<size_t>(start - matchPos),
+             static_cast<size_t>(matchEnd - start));
+        m_Pos = m_Anchor = matchEnd;
+        m_SearchCount = 1 << 6;
+        if (matchEnd - 2 + MIN_MATCH <= end) {
+          m_Table[hashSequence(read32(at(matchEnd - 2)))] = matchEnd - 2 + 1;
+        }
+        continue;
+      }
+
+      // skip ahead faster the longer we don't find anything, as lz4 itself does
+      m_Pos += m_SearchCount++ >> 6;
+    }
+  }
+
+  void emit(std::vector<uint8_t> &out, size_t literals, size_t offset, size_t matchLength) {
+    size_t extraMatch = matchLength > 0 ? matchLength - MIN_MATCH : 0;
+    out.push_back(static_cast<uint8_t>(((std::min<size_t>)(literals, 15) << 4) | (std::min<size_t>)(extraMatch, 15)));
+    if (literals >= 15) {
+      writeLength(out, literals - 15);
+    }
+    const uint8_t *literalData = at(m_Anchor);
+    out.insert(out.end(), literalData, literalData + literals);
+    if (matchLength > 0) {
+      out.push_back(static_cast<uint8_t>(offset & 0xFF));
+      out.push_back(static_cast<uint8_t>(offset >> 8));
+      if (extraMatch >= 15) {
+        writeLength(out, extraMatch - 15);
+      }
+    }
+  }
+
+  /* drop data that's neither pending literals nor inside the match window */
+  void compact() {
+    uint64_t end = m_Base + m_Buffer.size();
+    uint64_t keepFrom = (std::min)(m_Anchor, m_Pos > MAX_DISTANCE ? m_Pos - MAX_DISTANCE : 0);
+    keepFrom = (std::min)(keepFrom, end);
+    if (keepFrom - m_Base >= COMPACT_THRESHOLD) {
+      m_Buffer.erase(m_Buffer.begin(), m_Buffer.begin() + static_cast<size_t>(keepFrom - m_Base));
+      m_Base = keepFrom;
+    }
+  }
+
+private:
+
+  std::vector<uint8_t> m_Buffer;
+  // absolute position of the first byte in m_Buffer
+  uint64_t m_Base;
+  // next position to look for a match at
+  uint64_t m_Pos;
+  // start of the literals not written yet
+  uint64_t m_Anchor;
+  uint32_t m_SearchCount;
+  std::vector<uint64_t> m_Table;
+
+};
+
+/**
+ * Decodes a single lz4 block from streamed input, keeping only the 64k of output
+ * matches can refer back to
+ */
+class LZ4BlockDecoder : public StreamCodec {
+public:
+  LZ4BlockDecoder()
+    : m_InputPos(0)
+  {
+  }
+
+  virtual void update(const uint8_t *data, size_t size, std::vector<uint8_t> &out) {
+    m_Input.insert(m_Input.end(), data, data + size);
+    decode(false, out);
+  }
+
+  virtual void finish(std::vector<uint8_t> &out) {
+    decode(true, out);
+    if (m_InputPos != m_Input.size()) {
+      throw std::runtime_error("lz4 data ended unexpectedly");
+    }
+  }
+
+private:
+
+  /* read an extended length field. Returns false if the input doesn't contain all of it yet */
+  bool readLength(size_t &pos, size_t &length) const {
+    while (true) {
+      if (pos >= m_Input.size()) {
+        return false;
+      }
+      uint8_t value = m_Input[pos++];
+      length += value;
+      if (value != 255) {
+        return true;
+      }
+    }
+  }
+
+  /* decode all sequences that are complete. Only at the end of input do we know that the
+   * last literals aren't followed by a match */
+  void decode(bool final, std::vector<uint8_t> &out) {
+    size_t flushFrom = m_Window.size();
+
+    while (m_InputPos < m_Input.size()) {
+      size_t pos = m_InputPos;
+      uint8_t token = m_Input[pos++];
+
+      size_t literals = token >> 4;
+      if ((literals == 15) && !readLength(pos, literals)) {
+        break;
+      }
+      if (m_Input.size() - pos < literals) {
+        break;
+      }
+      size_t literalPos = pos;
+      pos += literals;
+
+      if (pos == m_Input.size()) {
+        if (!final) {
+          break;
+        }
+        m_Window.insert(m_Window.end(), m_Input.begin() + literalPos, m_Input.begin() + pos);
+        m_InputPos = pos;
+        break;
+      }
+
+      if (m_Input.size() - pos < 2) {
+        break;
+      }
+      size_t offset = m_Input[pos] | (m_Input[pos + 1] << 8);
+      pos += 2;
+      size_t matchLength = token & 0x0F;
+      if ((matchLength == 15) && !readLength(pos, matchLength)) {
+        break;
+      }
+      matchLength += MIN_MATCH;
+
+      m_Window.insert(m_Window.end(), m_Input.begin() + literalPos, m_Input.begin() + literalPos + literals);
+      if ((offset == 0) || (offset > m_Window.size())) {
+        throw std::runtime_error(fmt::format("invalid lz4 match offset {}", offset));
+      }
+
+      size_t source = m_Window.size() - offset;
+      m_Window.resize(m_Window.size() + matchLength);
+      uint8_t *target = m_Window.data() + m_Window.size() - matchLength;
+      if (offset >= matchLength) {
+        memcpy(target, m_Window.data() + source, matchLength);
+      } else {
+        // overlapping, repeats the last offset bytes
+        for (size_t i = 0; i < matchLength; ++i) {
+          target[i] = m_Window[source + i];
+        }
+      }
+
+      m_InputPos = pos;
+    }
+
+    out.insert(out.end(), m_Window.begin() + flushFrom, m_Window.end());
+
+    if (m_InputPos >= COMPACT_THRESHOLD) {
+      m_Input.erase(m_Input.begin(), m_Input.begin() + m_InputPos);
+      m_InputPos = 0;
+    }
+    if (m_Window.size() >= MAX_DISTANCE + COMPACT_THRESHOLD) {
+      m_Window.erase(m_Window.begin(), m_Window.end() - MAX_DISTANCE);
+    }
+  }
+
+private:
+
+  std::vector<uint8_t> m_Input;
+  size_t m_InputPos;
+  std::vector<uint8_t> m_Window;
+
+};
+
+class ZlibCompressor : public StreamCodec {
+public:
+  ZlibCompressor() {
+    memset(&m_Stream, 0, sizeof(z_stream));
+    if (deflateInit(&m_Stream, Z_DEFAULT_COMPRESSION) != Z_OK) {
+      throw std::runtime_error("failed to initialize zlib deflate");
+    }
+  }
+
+  virtual ~ZlibCompressor() {
+    deflateEnd(&m_Stream);
+  }
+
+  virtual void update(const uint8_t *data, size_t size, std::vector<uint8_t> &out) {
+    run(data, size, Z_NO_FLUSH, out);
+  }
+
+  virtual void finish(std::vector<uint8_t> &out) {
+    run(nullptr, 0, Z_FINISH, out);
+  }
+
+private:
+
+  void run(const uint8_t *data, size_t size, int flush, std::vector<uint8_t> &out) {
+    m_Stream.next_in = const_cast<Bytef*>(data);
+    m_Stream.avail_in = static_cast<uInt>(size);
+    int res;
+    do {
+      size_t offset = out.size();
+      out.resize(offset + ZLIB_CHUNK);
+      m_Stream.next_out = out.data() + offset;
+      m_Stream.avail_out = static_cast<uInt>(ZLIB_CHUNK);
+      res = deflate(&m_Stream, flush);
+      out.resize(out.size() - m_Stream.avail_out);
+      if (res == Z_STREAM_ERROR) {
+        throw std::runtime_error("failed to compress zlib data");
+      }
+    } while ((m_Stream.avail_out == 0) || ((flush == Z_FINISH) && (res != Z_STREAM_END)));
+  }
+
+private:
+
+  z_stream m_Stream;
+
+};
+
+class ZlibDecompressor : public StreamCodec {
+public:
+  ZlibDecompressor()
+    : m_Done(false)
+  {
+    memset(&m_Stream, 0, sizeof(z_stream));
+    if (inflateInit(&m_Stream) != Z_OK) {
+      throw std::runtime_error("failed to initialize zlib inflate");
+    }
+  }
+
+  virtual ~ZlibDecompressor() {
+    inflateEnd(&m_Stream);
+  }
+
+  virtual void update(const uint8_t *data, size_t size, std::vector<uint8_t> &out) {
+    m_Stream.next_in = const_cast<Bytef*>(data);
+    m_Stream.avail_in = static_cast<uInt>(size);
+    while (!m_Done && ((m_Stream.avail_in > 0) || (m_Stream.avail_out == 0))) {
+      size_t offset = out.size();
+      out.resize(offset + ZLIB_CHUNK);
+      m_Stream.next_out = out.data() + offset;
+      m_Stream.avail_out = static_cast<uInt>(ZLIB_CHUNK);
+      int res = inflate(&m_Stream, Z_NO_FLUSH);
+      out.resize(out.size() - m_Stream.avail_out);
+      if (res == Z_STREAM_END) {
+        m_Done = true;
+      } else if ((res != Z_OK) && (res != Z_BUF_ERROR)) {
+        throw std::runtime_error("failed to decompress zlib data");
+      }
+    }
+  }
+
+  virtual void finish(std::vector<uint8_t>&) {
+    if (!m_Done) {
+      throw std::runtime_error("zlib data ended unexpectedly");
+    }
+  }
+
+private:
+
+  z_stream m_Stream;
+  bool m_Done;
+
+};
+
+class PassThrough : public StreamCodec {
+public:
+  virtual void update(const uint8_t *data, size_t size, std::vector<uint8_t> &out) {
+    out.insert(out.end(), data, data + size);
+  }
+
+  virtual void finish(std::vector<uint8_t>&) {
+  }
+};
+
+}
+
+std::unique_ptr<StreamCodec> createCompressor(uint16_t format)
+{
+  switch (format) {
+    case COMPRESSION_NONE: return std::unique_ptr<StreamCodec>(new PassThrough());
+    case COMPRESSION_ZLIB: return std::unique_ptr<StreamCodec>(new ZlibCompressor());
+    case COMPRESSION_LZ4: return std::unique_ptr<StreamCodec>(new LZ4BlockEncoder());
+    default: throw std::runtime_error(fmt::format("unsupported compression format {}", format));
+  }
+}
+
+std::unique_ptr<StreamCodec> createDecompressor(uint16_t format)
+{
+  switch (format) {
+    case COMPRESSION_NONE: return std::unique_ptr<StreamCodec>(new PassThrough());
+    case COMPRESSION_ZLIB: return std::unique_ptr<StreamCodec>(new ZlibDecompressor());
+    case COMPRESSION_LZ4: return std::unique_ptr<StreamCodec>(new LZ4BlockDecoder());
+    default: throw std::runtime_error(fmt::format("unsupported compression format {}", format));
+  }
+}
@@ -0,0 +1,32 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+/* body compression formats of Skyrim SE saves */
+enum BodyCompression : uint16_t {
+  COMPRESSION_NONE = 0,
+  COMPRESSION_ZLIB = 1,
+  COMPRESSION_LZ4 = 2,
+};
+
+/**
+ * Compressor or decompressor that gets fed its input in chunks of arbitrary size and
+ * produces output as it goes, so neither side ever has to be in memory as a whole
+ */
+class StreamCodec {
+public:
+  virtual ~StreamCodec() {}
+
+  /* process the next chunk of input, appending whatever output is ready to out */
+  virtual void update(const uint8_t *data, size_t size, std::vector<uint8_t> &out) = 0;
+
+  /* signal the end of input and append the remaining output */
+  virtual void finish(std::vector<uint8_t> &out) = 0;
+};
+
+/* codecs for the specified format. lz4 means a single lz4 block, as the games use it, not the frame format */
+std::unique_ptr<StreamCodec> createCompressor(uint16_t format);
+std::unique_ptr<StreamCodec> createDecompressor(uint16_t format);
@@ -14,7 +14,7 @@ enum class CodePage {
 };
 
 #ifdef _WIN32
-UINT windowsCP(CodePage codePage)
+static UINT windowsCP(CodePage codePage)
 {
   switch (codePage) {
     case CodePage::LOCAL:    return CP_ACP;
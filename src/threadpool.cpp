@@ -0,0 +1,111 @@
+#include "threadpool.h"
+
+#include <algorithm>
+#include <atomic>
+#include <exception>
+#include <memory>
+
+ThreadPool &ThreadPool::instance()
+{
+  // intentionally leaked, joining threads during static destruction is asking for trouble
+  static ThreadPool *s_Instance = new ThreadPool((std::max)(2u, std::thread::hardware_concurrency()));
+  return *s_Instance;
+}
+
+ThreadPool::ThreadPool(size_t threadCount)
+  : m_Stop(false)
+{
+  for (size_t i = 0; i < threadCount; ++i) {
+    m_Threads.emplace_back([this]() { work(); });
+  }
+}
+
+ThreadPool::~ThreadPool()
+{
+  {
+    std::lock_guard<std::mutex> lock(m_Mutex);
+    m_Stop = true;
+  }
+  m_Wakeup.notify_all();
+  for (std::thread &thread : m_Threads) {
+    thread.join();
+  }
+}
+
+void ThreadPool::submit(std::function<void()> task)
+{
+  {
+    std::lock_guard<std::mutex> lock(m_Mutex);
+    m_Queue.push_back(std::move(task));
+  }
+  m_Wakeup.notify_one();
+}
+
+void ThreadPool::parallelFor(size_t count, const std::function<void(size_t)> &func)
+{
+  struct State {
+    std::atomic<size_t> next{ 0 };
+    size_t done{ 0 };
+    std::exception_ptr error;
+    std::mutex mutex;
+    std::condition_variable finished;
+  };
+
+  if (count == 0) {
+    return;
+  }
+
+  std::shared_ptr<State> state = std::make_shared<State>();
+
+  // helpers may only get to run after all items are processed, so they must not
+  // reference anything on this stack frame except through the shared state
+  std::shared_ptr<std::function<void(size_t)>> funcPtr = std::make_shared<std::function<void(size_t)>>(func);
+  auto process = [state, funcPtr, count]() {
+    size_t idx;
+    while ((idx = state->next++) < count) {
+      try {
+        (*funcPtr)(idx);
+      }
+      catch (...) {
+        std::lock_guard<std::mutex> lock(state->mutex);
+        if (!state->error) {
+          state->error = std::current_exception();
+        }
+      }
+      std::lock_guard<std::mutex> lock(state->mutex);
+      if (++state->done == count) {
+        state->finished.notify_all();
+      }
+    }
+  };
+
+  size_t helpers = (std::min)(count - 1, size());
+  for (size_t i = 0; i < helpers; ++i) {
+    submit(process);
+  }
+
+  process();
+
+  std::unique_lock<std::mutex> lock(state->mutex);
+  state->finished.wait(lock, [&]() { return state->done == count; });
+  if (state->error) {
+    std::rethrow_exception(state->error);
+  }
+}
+
+void ThreadPool::work()
+{
+  while (true) {
+    std::function<void()> task;
+    {
+      std::unique_lock<std::mutex> lock(m_Mutex);
+      m_Wakeup.wait(lock, [this]() { return m_Stop || !m_Queue.empty(); });
+      if (m_Stop && m_Queue.empty()) {
+        return;
+      }
+      task = std::move(m_Queue.front());
+      m_Queue.pop_front();
+    }
+    task();
+  }
+}
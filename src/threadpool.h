@@ -0,0 +1,46 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/**
+ * Fixed size pool of worker threads shared by all the jobs the module runs in the background
+ */
+class ThreadPool {
+public:
+  /* the process-wide pool, one thread per core */
+  static ThreadPool &instance();
+
+  explicit ThreadPool(size_t threadCount);
+  ~ThreadPool();
+
+  ThreadPool(const ThreadPool&) = delete;
+  ThreadPool &operator=(const ThreadPool&) = delete;
+
+  size_t size() const { return m_Threads.size(); }
+
+  void submit(std::function<void()> task);
+
+  /* run func for each index in [0, count) on the pool and wait for all of them to finish.
+   * The calling thread works on the items as well so this is safe to use from within a pool thread.
+   * If any invocation throws, the first exception is rethrown here */
+  void parallelFor(size_t count, const std::function<void(size_t)> &func);
+
+private:
+
+  void work();
+
+private:
+
+  std::vector<std::thread> m_Threads;
+  std::deque<std::function<void()>> m_Queue;
+  std::mutex m_Mutex;
+  std::condition_variable m_Wakeup;
+  bool m_Stop;
+
+};
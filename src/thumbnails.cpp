@@ -0,0 +1,391 @@
+#include "thumbnails.h"
+#include "fingerprint.h"
+#include "imageops.h"
+
+#include <chrono>
+#include <cstring>
+#include <fstream>
+#include <stdexcept>
+
+#include "string_cast.h"
+
+namespace {
+
+const char INDEX_MAGIC[4] = { 'G', 'B', 'T', 'I' };
+const uint32_t INDEX_VERSION = 1;
+
+// how long the writer waits for more thumbnails to join a batch, and how large a batch gets at most
+const std::chrono::milliseconds BATCH_DELAY(500);
+const size_t BATCH_SIZE = 64;
+
+std::mutex s_InstanceMutex;
+std::shared_ptr<ThumbnailStore> s_Instance;
+
+uint64_t hashImage(const uint8_t *rgba, uint32_t width, uint32_t height) {
+  // 64-bit fnv-1a over 8 byte words, good enough to tell screenshots apart
+  uint64_t hash = 0xcbf29ce484222325ULL;
+  hash = (hash ^ ((static_cast<uint64_t>(width) << 32) | height)) * 0x100000001b3ULL;
+  size_t size = static_cast<size_t>(width) * height * 4;
+  size_t offset = 0;
+  for (; offset + sizeof(uint64_t) <= size; offset += sizeof(uint64_t)) {
+    uint64_t word;
+    memcpy(&word, rgba + offset, sizeof(uint64_t));
+    hash = (hash ^ word) * 0x100000001b3ULL;
+    hash ^= hash >> 29;
+  }
+  for (; offset < size; ++offset) {
+    hash = (hash ^ rgba[offset]) * 0x100000001b3ULL;
+  }
+  return hash;
+}
+
+void appendRecord(std::vector<char> &out, const std::string &path, uint64_t fileSize, int64_t modified,
+                  uint64_t hash) {
+  uint32_t pathLength = static_cast<uint32_t>(path.length());
+  size_t offset = out.size();
+  out.resize(offset + sizeof(uint32_t) + pathLength + 3 * sizeof(uint64_t));
+  char *pos = &out[offset];
+  memcpy(pos, &pathLength, sizeof(uint32_t));
+  memcpy(pos += sizeof(uint32_t), path.data(), pathLength);
+  memcpy(pos += pathLength, &fileSize, sizeof(uint64_t));
+  memcpy(pos += sizeof(uint64_t), &modified, sizeof(int64_t));
+  memcpy(pos += sizeof(int64_t), &hash, sizeof(uint64_t));
+}
+
+void indexHeader(std::vector<char> &out) {
+  out.insert(out.end(), INDEX_MAGIC, INDEX_MAGIC + 4);
+  const char *version = reinterpret_cast<const char*>(&INDEX_VERSION);
+  out.insert(out.end(), version, version + sizeof(uint32_t));
+}
+
+}
+
+std::shared_ptr<ThumbnailStore> ThumbnailStore::instance()
+{
+  std::lock_guard<std::mutex> lock(s_InstanceMutex);
+  return s_Instance;
+}
+
+void ThumbnailStore::configure(const std::string &directory, uint32_t maxSize)
+{
+  std::shared_ptr<ThumbnailStore> store;
+  if (!directory.empty()) {
+    store = std::make_shared<ThumbnailStore>(directory, maxSize);
+  }
+  std::shared_ptr<ThumbnailStore> previous;
+  {
+    std::lock_guard<std::mutex> lock(s_InstanceMutex);
+    previous = s_Instance;
+    s_Instance = store;
+  }
+  if (previous) {
+    previous->flush();
+  }
+}
+
+ThumbnailStore::ThumbnailStore(const std::string &directory, uint32_t maxSize)
+  : m_Directory(directory)
+  , m_MaxSize(maxSize)
+  , m_IndexRecords(0)
+  , m_Writing(false)
+  , m_FlushRequested(false)
+  , m_Stop(false)
+{
+  if (m_MaxSize == 0) {
+    throw std::runtime_error("invalid thumbnail size");
+  }
+  createDirectory(m_Directory);
+  loadIndex();
+  m_Thread = std::thread(&ThumbnailStore::writer, this);
+}
+
+ThumbnailStore::~ThumbnailStore()
+{
+  {
+    std::lock_guard<std::mutex> lock(m_Mutex);
+    m_Stop = true;
+  }
+  m_Wakeup.notify_all();
+  m_Thread.join();
+}
+
+std::string ThumbnailStore::imagePath(uint64_t hash) const
+{
+  return m_Directory + "/" + PluginFingerprint::toHex(hash) + ".png";
+}
+
+std::string ThumbnailStore::indexPath() const
+{
+  return m_Directory + "/index";
+}
+
+bool ThumbnailStore::find(const FileKey &key, uint64_t &hash) const
+{
+  auto iter = m_Index.find(key.path);
+  if ((iter == m_Index.end())
+      || (iter->second.fileSize != key.fileSize)
+      || (iter->second.modified != key.modified)) {
+    return false;
+  }
+  hash = iter->second.hash;
+  return true;
+}
+
+bool ThumbnailStore::has(const FileKey &key) const
+{
+  std::lock_guard<std::mutex> lock(m_Mutex);
+  uint64_t hash;
+  return find(key, hash);
+}
+
+void ThumbnailStore::add(const FileKey &key, const uint8_t *rgba, uint32_t width, uint32_t height)
+{
+  if ((width == 0) || (height == 0)) {
+    return;
+  }
+
+  uint64_t hash = hashImage(rgba, width, height);
+  bool known;
+  {
+    std::lock_guard<std::mutex> lock(m_Mutex);
+    known = m_PendingImages.find(hash) != m_PendingImages.end();
+  }
+  uint64_t size;
+  int64_t modified;
+  ImagePtr image;
+  if (!known && !statFile(imagePath(hash), size, modified)) {
+    // never enlarge
+    uint32_t thumbWidth = width;
+    uint32_t thumbHeight = height;
+    if ((width > m_MaxSize) || (height > m_MaxSize)) {
+      fitInto(width, height, m_MaxSize, m_MaxSize, thumbWidth, thumbHeight);
+    }
+    if ((thumbWidth != width) || (thumbHeight != height)) {
+      std::vector<uint8_t> scaled(static_cast<size_t>(thumbWidth) * thumbHeight * 4);
+      downscaleRGBA(rgba, width, height, scaled.data(), thumbWidth, thumbHeight, thumbWidth * 4);
+      image = std::make_shared<std::vector<uint8_t>>(encodePNG(scaled.data(), thumbWidth, thumbHeight));
+    } else {
+      image = std::make_shared<std::vector<uint8_t>>(encodePNG(rgba, width, height));
+    }
+  }
+
+  Entry entry{ key.fileSize, key.modified, hash };
+  bool wakeWriter;
+  {
+    std::lock_guard<std::mutex> lock(m_Mutex);
+    if (image) {
+      m_PendingImages.emplace(hash, image);
+    }
+    m_Index[key.path] = entry;
+    m_PendingRecords.push_back(std::make_pair(key.path, entry));
+    wakeWriter = (m_PendingRecords.size() == 1) || (m_PendingRecords.size() >= BATCH_SIZE);
+  }
+  if (wakeWriter) {
+    m_Wakeup.notify_all();
+  }
+}
+
+std::string ThumbnailStore::path(const FileKey &key)
+{
+  uint64_t hash;
+  bool pending;
+  {
+    std::lock_guard<std::mutex> lock(m_Mutex);
+    if (!find(key, hash)) {
+      return std::string();
+    }
+    pending = m_PendingImages.find(hash) != m_PendingImages.end();
+  }
+  if (pending) {
+    flush();
+  }
+  // writing may have failed or the file was deleted since
+  std::string fileName = imagePath(hash);
+  uint64_t size;
+  int64_t modified;
+  return statFile(fileName, size, modified) ? fileName : std::string();
+}
+
+bool ThumbnailStore::read(const FileKey &key, std::vector<uint8_t> &png) const
+{
+  uint64_t hash;
+  {
+    std::lock_guard<std::mutex> lock(m_Mutex);
+    if (!find(key, hash)) {
+      return false;
+    }
+    auto iter = m_PendingImages.find(hash);
+    if (iter != m_PendingImages.end()) {
+      png = *iter->second;
+      return true;
+    }
+  }
+
+  std::string fileName = imagePath(hash);
+  std::ifstream file(toWC(fileName.c_str(), CodePage::UTF8, fileName.length()).c_str(),
+                     std::ios::in | std::ios::binary | std::ios::ate);
+  if (!file.is_open()) {
+    return false;
+  }
+  png.resize(static_cast<size_t>(file.tellg()));
+  file.seekg(0);
+  return static_cast<bool>(file.read(reinterpret_cast<char*>(png.data()), png.size()));
+}
+
+void ThumbnailStore::flush()
+{
+  std::unique_lock<std::mutex> lock(m_Mutex);
+  if (m_PendingRecords.empty() && !m_Writing) {
+    return;
+  }
+  m_FlushRequested = true;
+  m_Wakeup.notify_all();
+  m_Written.wait(lock, [this]() { return m_PendingRecords.empty() && !m_Writing; });
+}
+
+void ThumbnailStore::loadIndex()
+{
+  std::string fileName = indexPath();
+  std::ifstream file(toWC(fileName.c_str(), CodePage::UTF8, fileName.length()).c_str(),
+                     std::ios::in | std::ios::binary | std::ios::ate);
+  std::vector<char> data;
+  if (file.is_open()) {
+    data.resize(static_cast<size_t>(file.tellg()));
+    file.seekg(0);
+    if (!file.read(data.data(), data.size())) {
+      data.clear();
+    }
+  }
+
+  size_t offset = 8;
+  if ((data.size() >= offset)
+      && (memcmp(data.data(), INDEX_MAGIC, 4) == 0)
+      && (memcmp(data.data() + 4, &INDEX_VERSION, sizeof(uint32_t)) == 0)) {
+    // later records replace earlier ones for the same path. A truncated record at the end (from a
+    // write that didn't complete) is ignored
+    while (offset + sizeof(uint32_t) <= data.size()) {
+      uint32_t pathLength;
+      memcpy(&pathLength, data.data() + offset, sizeof(uint32_t));
+      size_t recordSize = sizeof(uint32_t) + pathLength + 3 * sizeof(uint64_t);
+      if (recordSize > data.size() - offset) {
+        break;
+      }
+      const char *pos = data.data() + offset + sizeof(uint32_t);
+      Entry entry;
+      memcpy(&entry.fileSize, pos + pathLength, sizeof(uint64_t));
+      memcpy(&entry.modified, pos + pathLength + sizeof(uint64_t), sizeof(int64_t));
+      memcpy(&entry.hash, pos + pathLength + 2 * sizeof(uint64_t), sizeof(uint64_t));
+      m_Index[std::string(pos, pathLength)] = entry;
+      offset += recordSize;
+      ++m_IndexRecords;
+    }
+    if ((offset == data.size()) && (m_IndexRecords <= m_Index.size() * 2 + BATCH_SIZE)) {
+      return;
+    }
+  }
+
+  // missing, damaged or mostly outdated, write a compacted index
+  std::vector<char> compacted;
+  indexHeader(compacted);
+  for (const auto &iter : m_Index) {
+    appendRecord(compacted, iter.first, iter.second.fileSize, iter.second.modified, iter.second.hash);
+  }
+  std::string tempName = tempFileName(fileName);
+  try {
+    writeFile(tempName, compacted.data(), compacted.size());
+    syncFile(tempName);
+    replaceFile(tempName, fileName);
+  }
+  catch (...) {
+    removeFile(tempName);
+    throw;
+  }
+  syncFile(m_Directory);
+  m_IndexRecords = m_Index.size();
+}
+
+void ThumbnailStore::writer()
+{
+  std::unique_lock<std::mutex> lock(m_Mutex);
+  while (true) {
+    m_Wakeup.wait(lock, [this]() { return m_Stop || !m_PendingRecords.empty(); });
+    if (m_PendingRecords.empty()) {
+      break;
+    }
+    // give saves parsed around the same time a chance to join this batch
+    m_Wakeup.wait_for(lock, BATCH_DELAY, [this]() {
+      return m_Stop || m_FlushRequested || (m_PendingRecords.size() >= BATCH_SIZE);
+    });
+
+    std::vector<std::pair<uint64_t, ImagePtr>> images(m_PendingImages.begin(), m_PendingImages.end());
+    std::vector<std::pair<std::string, Entry>> records;
+    records.swap(m_PendingRecords);
+    m_FlushRequested = false;
+    m_Writing = true;
+    lock.unlock();
+
+    try {
+      writeBatch(images, records);
+    }
+    catch (const std::exception&) {
+      // thumbnails are only a cache, they will be generated again next time
+    }
+
+    lock.lock();
+    for (const auto &image : images) {
+      m_PendingImages.erase(image.first);
+    }
+    m_IndexRecords += records.size();
+    m_Writing = false;
+    m_Written.notify_all();
+  }
+}
+
+void ThumbnailStore::writeBatch(const std::vector<std::pair<uint64_t, ImagePtr>> &images,
+                                const std::vector<std::pair<std::string, Entry>> &records)
+{
+  // write all images first, then sync them all, so the disk gets to handle them together
+  std::vector<std::pair<std::string, std::string>> written;
+  try {
+    for (const auto &image : images) {
+      std::string fileName = imagePath(image.first);
+      std::string tempName = tempFileName(fileName);
+      written.push_back(std::make_pair(tempName, fileName));
+      writeFile(tempName, image.second->data(), image.second->size());
+    }
+    for (const auto &file : written) {
+      syncFile(file.first);
+    }
+    for (const auto &file : written) {
+      replaceFile(file.first, file.second);
+    }
+  }
+  catch (...) {
+    // the names are unique so leftovers would never get overwritten
+    for (const auto &file : written) {
+      removeFile(file.first);
+    }
+    throw;
+  }
+
+  // the index only references images that are on disk at this point
+  std::vector<char> data;
+  std::string fileName = indexPath();
+  uint64_t size;
+  int64_t modified;
+  if (!statFile(fileName, size, modified) || (size == 0)) {
+    indexHeader(data);
+  }
+  for (const auto &record : records) {
+    appendRecord(data, record.first, record.second.fileSize, record.second.modified, record.second.hash);
+  }
+  {
+    std::ofstream index(toWC(fileName.c_str(), CodePage::UTF8, fileName.length()).c_str(),
+                        std::ios::out | std::ios::binary | std::ios::app);
+    if (!index.is_open() || !index.write(data.data(), data.size())) {
+      throw std::runtime_error("failed to write thumbnail index");
+    }
+  }
+  syncFile(fileName);
+  syncFile(m_Directory);
+}
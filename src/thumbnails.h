@@ -0,0 +1,90 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include "fileops.h"
+
+/**
+ * Directory of downscaled screenshots (png) named after the hash of their pixels, plus an index
+ * mapping save files (path, size, modification time) to those hashes. That way thumbnails can be
+ * served without opening the save and identical screenshots are only stored once.
+ * New thumbnails are written in batches by a background thread, syncing all files of a batch
+ * and the index together
+ */
+class ThumbnailStore {
+public:
+  /* the store used by all saves in this process, empty if none is configured */
+  static std::shared_ptr<ThumbnailStore> instance();
+
+  /* use the thumbnails in directory (created if necessary) from here on, scaled to fit
+   * maxSize x maxSize. An empty directory disables the store. Pending thumbnails of the
+   * previous store are written before this returns */
+  static void configure(const std::string &directory, uint32_t maxSize);
+
+  ThumbnailStore(const std::string &directory, uint32_t maxSize);
+  ~ThumbnailStore();
+
+  ThumbnailStore(const ThumbnailStore&) = delete;
+  ThumbnailStore &operator=(const ThumbnailStore&) = delete;
+
+  bool has(const FileKey &key) const;
+
+  /* create the thumbnail for a save from its rgba screenshot. It can be read right away but only
+   * gets written to disk with the next batch */
+  void add(const FileKey &key, const uint8_t *rgba, uint32_t width, uint32_t height);
+
+  /* path of the thumbnail for a save, empty if there is none. Writes pending thumbnails if necessary */
+  std::string path(const FileKey &key);
+
+  /* the png data of the thumbnail for a save, false if there is none */
+  bool read(const FileKey &key, std::vector<uint8_t> &png) const;
+
+  /* write all pending thumbnails and wait for that to finish */
+  void flush();
+
+private:
+
+  struct Entry {
+    uint64_t fileSize;
+    int64_t modified;
+    uint64_t hash;
+  };
+
+  typedef std::shared_ptr<const std::vector<uint8_t>> ImagePtr;
+
+  std::string imagePath(uint64_t hash) const;
+  std::string indexPath() const;
+  bool find(const FileKey &key, uint64_t &hash) const;
+
+  void loadIndex();
+  void writer();
+  void writeBatch(const std::vector<std::pair<uint64_t, ImagePtr>> &images,
+                  const std::vector<std::pair<std::string, Entry>> &records);
+
+private:
+
+  std::string m_Directory;
+  uint32_t m_MaxSize;
+
+  mutable std::mutex m_Mutex;
+  std::condition_variable m_Wakeup;
+  std::condition_variable m_Written;
+  std::unordered_map<std::string, Entry> m_Index;
+  // records in the index file, including ones superseded since
+  size_t m_IndexRecords;
+  // encoded but not yet written to disk
+  std::unordered_map<uint64_t, ImagePtr> m_PendingImages;
+  std::vector<std::pair<std::string, Entry>> m_PendingRecords;
+  bool m_Writing;
+  bool m_FlushRequested;
+  bool m_Stop;
+  std::thread m_Thread;
+
+};